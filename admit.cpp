@@ -0,0 +1,340 @@
+/* admit.cpp: admission control for CGI/server requests
+
+Copyright (C) 2026, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.    */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#ifndef _WIN32
+#include <sys/file.h>
+#include <sys/stat.h>
+#endif
+#include "admit.h"
+
+/* 'list_cgi.cpp' used to gate requests with fopen( "lock.txt", "a") :
+if that failed (i.e.,  I'd made the file read-only),  you got "Server is
+busy".  Otherwise,  everything ran at once.  When an observing campaign
+hits the site at dusk,  that means either every request piles on and
+they all get slow,  or none run at all.
+
+   Instead,  we now have 'n_workers' worker slots and 'max_queued' queue
+slots.  Each slot is a file in 'lock_dir',  and holding a slot means
+holding an flock( ) on that file.  The kernel releases the lock when the
+process exits,  so a request killed by avoid_runaway_process( ) (or a
+crash) can't leave a slot stuck.  A request :
+
+   -- takes a free worker slot,  if there is one and nobody is queued,
+      and runs;
+   -- otherwise,  takes a free queue slot and waits (polling the worker
+      slots) for up to 'deadline' seconds before giving up;
+   -- or,  if the queue is full as well,  is rejected at once.
+
+   Queued requests are admitted in the order they arrived.  Each writes
+its arrival time (and process ID,  to break ties) into its queue slot's
+file,  and only tries for a worker slot when no other held queue slot
+has an earlier time.  Otherwise,  a request arriving just as a worker
+slot freed up could take it from one that had been waiting for seconds.
+
+   All of this is set up in a small text file (default 'admit.txt'),
+in the same spirit as the 'Wait' line in 'url_fail.txt' :
+
+Workers 4
+Queue 16
+Deadline 30
+Locks locks
+Log cgi_log.txt
+
+   (all optional;  those are the defaults.)  'Workers 0' turns the site
+off,  rejecting everything at once.  Each request then gets one
+line in the log,  giving how long it waited,  how long it ran,  and the
+return value or the reason it was rejected.       */
+
+double admit_current_time( void)
+{
+   struct timeval tv;
+
+   gettimeofday( &tv, NULL);
+   return( (double)tv.tv_sec + (double)tv.tv_usec * 1e-6);
+}
+
+static void load_admission_config( admit_t *adm, const char *config_filename)
+{
+   FILE *ifile = fopen( config_filename, "rb");
+
+   adm->n_workers = 4;
+   adm->max_queued = 16;
+   adm->deadline = 30.;
+   strcpy( adm->lock_dir, "locks");
+   strcpy( adm->log_filename, "cgi_log.txt");
+   if( ifile)
+      {
+      char buff[200];
+
+      while( fgets( buff, sizeof( buff), ifile))
+         if( *buff != '#')
+            {
+            buff[strcspn( buff, "\r\n")] = '\0';
+            if( !memcmp( buff, "Workers ", 8))
+               adm->n_workers = atoi( buff + 8);
+            else if( !memcmp( buff, "Queue ", 6))
+               adm->max_queued = atoi( buff + 6);
+            else if( !memcmp( buff, "Deadline ", 9))
+               adm->deadline = atof( buff + 9);
+            else if( !memcmp( buff, "Locks ", 6))
+               snprintf( adm->lock_dir, sizeof( adm->lock_dir), "%.99s", buff + 6);
+            else if( !memcmp( buff, "Log ", 4))
+               snprintf( adm->log_filename, sizeof( adm->log_filename), "%.99s", buff + 4);
+            }
+      fclose( ifile);
+      }
+}
+
+#ifdef _WIN32
+static int try_slot( const admit_t *, const char, const int)
+{
+   return( 0);       /* no flock( ) here;  everybody gets in */
+}
+
+static void release_slot( const int)
+{
+}
+
+static void write_ticket( const admit_t *, const int)
+{
+}
+
+static bool is_first_in_line( const admit_t *, const int)
+{
+   return( true);
+}
+#else
+
+/* Returns a file descriptor holding an exclusive lock on the given slot,
+-1 if someone else holds it,  or -2 if the lock file couldn't be opened. */
+
+static int try_slot( const admit_t *adm, const char slot_type, const int slot)
+{
+   char filename[140];
+   int fd;
+
+   snprintf( filename, sizeof( filename), "%s/%c%d.lck", adm->lock_dir,
+                                    slot_type, slot);
+   fd = open( filename, O_RDWR | O_CREAT, 0666);
+   if( fd < 0)
+      {
+      mkdir( adm->lock_dir, 0777);
+      fd = open( filename, O_RDWR | O_CREAT, 0666);
+      if( fd < 0)
+         return( -2);
+      }
+   if( flock( fd, LOCK_EX | LOCK_NB))
+      {
+      close( fd);
+      fd = -1;
+      }
+   return( fd);
+}
+
+static void release_slot( const int fd)
+{
+   if( fd >= 0)
+      {
+      if( ftruncate( fd, 0))     /* so nobody reads a stale ticket */
+         perror( "Admission ticket");
+      flock( fd, LOCK_UN);
+      close( fd);
+      }
+}
+
+/* Tickets are the arrival time in microseconds,  so that everybody
+compares exactly the same numbers. */
+
+static long long ticket_time( const admit_t *adm)
+{
+   return( (long long)( adm->t_arrival * 1e+6));
+}
+
+static void write_ticket( const admit_t *adm, const int fd)
+{
+   char buff[60];
+
+   snprintf( buff, sizeof( buff), "%lld %d\n", ticket_time( adm),
+                                                   (int)getpid( ));
+   if( ftruncate( fd, 0) || pwrite( fd, buff, strlen( buff), 0) < 0)
+      perror( "Admission ticket");
+}
+
+/* Returns true if no other held queue slot has an earlier ticket.  A held
+slot whose ticket can't be read yet (its owner has only just taken it) is
+assumed to be ahead of us;  we'll look again in 25 milliseconds. */
+
+static bool is_first_in_line( const admit_t *adm, const int queue_slot)
+{
+   const long long my_ticket = ticket_time( adm);
+   int i;
+
+   for( i = 0; i < adm->max_queued; i++)
+      if( i != queue_slot)
+         {
+         char filename[140], buff[60];
+         int fd, pid;
+         ssize_t n_read;
+         long long t;
+
+         snprintf( filename, sizeof( filename), "%s/q%d.lck", adm->lock_dir, i);
+         fd = open( filename, O_RDONLY);
+         if( fd < 0)
+            continue;
+         if( !flock( fd, LOCK_SH | LOCK_NB))
+            {                    /* nobody's holding this slot */
+            flock( fd, LOCK_UN);
+            close( fd);
+            continue;
+            }
+         n_read = pread( fd, buff, sizeof( buff) - 1, 0);
+         close( fd);
+         if( n_read <= 0)
+            return( false);
+         buff[n_read] = '\0';
+         if( sscanf( buff, "%lld %d", &t, &pid) != 2)
+            return( false);
+         if( t < my_ticket || (t == my_ticket && pid < (int)getpid( )))
+            return( false);
+         }
+   return( true);
+}
+#endif
+
+/* Returns 1 if we got a worker slot,  0 if they're all busy,  -2 if
+the lock files can't be created. */
+
+static int try_worker_slots( admit_t *adm)
+{
+   int i;
+
+   for( i = 0; i < adm->n_workers; i++)
+      {
+      adm->worker_fd = try_slot( adm, 'w', i);
+      if( adm->worker_fd == -2)
+         return( -2);
+      if( adm->worker_fd >= 0)
+         {
+         adm->worker_slot = i;
+         adm->t_admitted = admit_current_time( );
+         return( 1);
+         }
+      }
+   return( 0);
+}
+
+/* Returns true if nobody holds a queue slot,  i.e.,  no request is
+waiting ahead of us. */
+
+static bool queue_is_empty( const admit_t *adm)
+{
+   int i;
+
+   for( i = 0; i < adm->max_queued; i++)
+      {
+      const int fd = try_slot( adm, 'q', i);
+
+      if( fd == -1)
+         return( false);
+      release_slot( fd);
+      }
+   return( true);
+}
+
+int admit_request( admit_t *adm, const char *config_filename)
+{
+   int queue_fd = -1, queue_slot, rval;
+
+   adm->t_arrival = adm->t_admitted = admit_current_time( );
+   adm->worker_slot = adm->worker_fd = -1;
+   load_admission_config( adm, config_filename);
+   if( adm->n_workers <= 0)
+      return( ADMIT_QUEUE_FULL);
+   if( queue_is_empty( adm))
+      {
+      rval = try_worker_slots( adm);
+      if( rval == 1)
+         return( ADMIT_OK);
+      if( rval == -2)
+         return( ADMIT_SETUP_FAILED);
+      }
+   for( queue_slot = 0; queue_fd < 0 && queue_slot < adm->max_queued; queue_slot++)
+      queue_fd = try_slot( adm, 'q', queue_slot);
+   if( queue_fd < 0)
+      return( ADMIT_QUEUE_FULL);
+   queue_slot--;
+   write_ticket( adm, queue_fd);
+   while( admit_current_time( ) < adm->t_arrival + adm->deadline)
+      {
+      if( is_first_in_line( adm, queue_slot) && try_worker_slots( adm) == 1)
+         {
+         release_slot( queue_fd);
+         return( ADMIT_OK);
+         }
+      usleep( 25000);            /* check back every 25 milliseconds */
+      }
+   release_slot( queue_fd);
+   return( ADMIT_DEADLINE_PASSED);
+}
+
+void release_admission( admit_t *adm)
+{
+   release_slot( adm->worker_fd);
+   adm->worker_fd = -1;
+}
+
+/* One line per request.  It's written with a single write( ) to a file
+opened for appending,  so lines from simultaneous requests don't get
+interleaved.  'rval' is either the return value from dummy_main( ) or,
+for rejected requests,  one of the ADMIT_* error codes. */
+
+void log_request_timing( const admit_t *adm, const int rval,
+                                    const char *details)
+{
+   const double t_now = admit_current_time( );
+   const time_t t0 = (time_t)adm->t_arrival;
+   char buff[600], time_buff[30];
+   const int fd = open( adm->log_filename, O_WRONLY | O_APPEND | O_CREAT, 0666);
+   const char *reason = (rval == ADMIT_QUEUE_FULL ? "queue full" :
+                        (rval == ADMIT_DEADLINE_PASSED ? "deadline passed" :
+                         "lock files unavailable"));
+
+   if( fd < 0)
+      return;
+   strftime( time_buff, sizeof( time_buff), "%Y-%m-%d %H:%M:%S", gmtime( &t0));
+   if( adm->worker_slot >= 0)          /* request was admitted and run */
+      snprintf( buff, sizeof( buff),
+               "%s wait %8.3f run %8.3f slot %2d rval %d : %s\n",
+               time_buff, adm->t_admitted - adm->t_arrival,
+               t_now - adm->t_admitted, adm->worker_slot, rval, details);
+   else
+      snprintf( buff, sizeof( buff),
+               "%s wait %8.3f REJECTED (%s) : %s\n",
+               time_buff, t_now - adm->t_arrival, reason, details);
+   if( write( fd, buff, strlen( buff)) < 0)
+      perror( "Admission log");
+   close( fd);
+}
@@ -0,0 +1,38 @@
+/* admit.h: admission control for CGI/server requests
+
+Copyright (C) 2026, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.    */
+
+#define ADMIT_OK                    0
+#define ADMIT_QUEUE_FULL           -1
+#define ADMIT_DEADLINE_PASSED      -2
+#define ADMIT_SETUP_FAILED         -3
+
+typedef struct
+{
+   int n_workers, max_queued;
+   double deadline;           /* max seconds to wait in the queue */
+   char lock_dir[100], log_filename[100];
+   int worker_slot, worker_fd;
+   double t_arrival, t_admitted;
+} admit_t;
+
+int admit_request( admit_t *adm, const char *config_filename);
+void release_admission( admit_t *adm);
+void log_request_timing( const admit_t *adm, const int rval,
+                                    const char *details);
+double admit_current_time( void);
@@ -0,0 +1,139 @@
+/* cgi_args.cpp: converting CGI form fields to 'list_gps' arguments
+
+Copyright (C) 2017, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.    */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "cgi_args.h"
+
+/* Both the CGI version ('list_cgi.cpp') and the server ('gps_serv.cpp')
+get a set of form fields (time,  observatory code,  sort order,  etc.)
+and turn them into a command line for dummy_main( ) in 'list_gps.cpp'.
+The first three arguments are (unused) program name,  time,  and MPC code;
+other fields become '-(letter)(value)' options.
+
+   The 'ast' field is a bit different:  it's astrometry,  which is written
+to a file,  and the command line becomes (program name) -f(filename)
+plus whatever options follow. */
+
+void init_cgi_args( cgi_args_t *cargs, const char *ast_filename)
+{
+   memset( cargs, 0, sizeof( cgi_args_t));
+   cargs->n_args = 3;
+   cargs->args[0] = NULL;
+   cargs->args[1] = cargs->time_text;
+   cargs->args[2] = cargs->observatory_code;
+   strcpy( cargs->observatory_code, "XXX");
+   cargs->ast_filename = ast_filename;
+}
+
+static void add_arg( cgi_args_t *cargs, const char option, const char *value)
+{
+   char *arg = (char *)malloc( strlen( value) + 3);
+
+   assert( arg);
+   arg[0] = '-';
+   arg[1] = option;
+   strcpy( arg + 2, value);
+   if( cargs->n_args < MAX_CGI_ARGS && cargs->n_allocated < MAX_CGI_ARGS)
+      {
+      cargs->args[cargs->n_args++] = arg;
+      cargs->allocated[cargs->n_allocated++] = arg;
+      }
+   else
+      free( arg);
+}
+
+/* Returns the option letter the field turned into,  or zero if the field
+wasn't recognized (or was rejected for being too long/short). */
+
+int add_cgi_field( cgi_args_t *cargs, const char *field, char *buff)
+{
+   char option = 0;
+
+   if( !strcmp( field, "time") && strlen( buff) < 80)
+      strcpy( cargs->time_text, buff);
+   if( !strcmp( field, "min_alt") && strlen( buff) < 10)
+      option = 'a';
+   if( !strcmp( field, "sort") && strlen( buff) < 10)
+      option = 's';
+   if( !strcmp( field, "relocate") && strlen( buff) < 60
+                  && strlen( buff) > 10)
+      option = 'r';
+   if( !strcmp( field, "n_steps") && strlen( buff) < 10)
+      option = 'n';
+   if( !strcmp( field, "ang_fmt") && *buff == '1')
+      {
+      option = 'd';
+      *buff = '\0';
+      }
+   if( !strcmp( field, "ang_fmt") && *buff == '2')
+      {
+      option = 'f';
+      *buff = '\0';
+      }
+   if( !strcmp( field, "step") && strlen( buff) < 10)
+      option = 'i';
+   if( !strcmp( field, "obj") && strlen( buff) < 10)
+      option = 'o';
+   if( !strcmp( field, "use_tles"))
+      cargs->use_tles = true;
+   if( !strcmp( field, "distrib"))
+      cargs->distribution_allowed = true;
+   if( !strcmp( field, "cache_stats"))
+      cargs->show_cache_stats = true;
+   if( !strcmp( field, "ast"))
+      {
+      FILE *ofile = fopen( cargs->ast_filename, "wb");
+
+      assert( ofile);
+      fwrite( buff, strlen( buff), 1, ofile);
+      fclose( ofile);
+      strcpy( buff, cargs->ast_filename);
+      cargs->n_args = 1;
+      option = 'f';
+      }
+   if( !strcmp( field, "obscode") && strlen( buff) < 20
+                                  && strlen( buff) > 2)
+      {
+      strcpy( cargs->observatory_code, buff);
+      if( buff[3] == 'v')
+         {
+         option = 'v';
+         cargs->observatory_code[3] = *buff = '\0';
+         }
+      }
+   if( option)
+      add_arg( cargs, option, buff);
+   return( option);
+}
+
+void finish_cgi_args( cgi_args_t *cargs)
+{
+   if( !cargs->use_tles)
+      add_arg( cargs, 't', "1");
+}
+
+void free_cgi_args( cgi_args_t *cargs)
+{
+   while( cargs->n_allocated)
+      free( cargs->allocated[--cargs->n_allocated]);
+   cargs->n_args = 0;
+}
@@ -0,0 +1,35 @@
+/* cgi_args.h: converting CGI form fields to 'list_gps' arguments
+
+Copyright (C) 2017, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.    */
+
+#define MAX_CGI_ARGS 20
+
+typedef struct
+{
+   int n_args, n_allocated;
+   char *args[MAX_CGI_ARGS];
+   char *allocated[MAX_CGI_ARGS];
+   char time_text[100], observatory_code[20];
+   bool use_tles, distribution_allowed, show_cache_stats;
+   const char *ast_filename;
+} cgi_args_t;
+
+void init_cgi_args( cgi_args_t *cargs, const char *ast_filename);
+int add_cgi_field( cgi_args_t *cargs, const char *field, char *buff);
+void finish_cgi_args( cgi_args_t *cargs);
+void free_cgi_args( cgi_args_t *cargs);
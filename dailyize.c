@@ -23,6 +23,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "eop_bin.h"
 
 /* Earth Orientation Parameter (EOP) files are provided as
 'finals.all' (covers the earth's orientation from early 1973
@@ -60,6 +63,11 @@ the remaining lines from 'finals.all' (if any) and output those.
 daily and then runs this program to create the 'finals.mix' file.  The
 various GPS tools then ingest the .mix version.
 
+   After writing 'finals.mix',  we also write 'finals.bin' : the same
+lines,  but with a header and checksums (see 'eop_bin.h') so that
+'list_gps' can pull out just the days it needs.  'dailyize -b' will
+make 'finals.bin' from an existing 'finals.mix' without re-merging.
+
    The various files should,  without question,  be openable.  It
 also should be possible to read 188-byte lines from them.  If it's
 not, we just fail.    */
@@ -112,16 +120,89 @@ static char *format_eop_date( const char *iline, char *buff)
    return( buff);
 }
 
-int main( void)
+/* 'finals.mix' should have one line per day,  with no gaps.  If it
+doesn't,  we say so and don't write the binary version (the tools then
+just use 'finals.mix'). */
+
+static int write_binary_eop_table( const char *ifilename, const char *ofilename)
 {
-   FILE *all = err_fopen( "finals.all", "rb");
-   FILE *daily = err_fopen( "finals.daily", "rb");
+   FILE *ifile = err_fopen( ifilename, "rb");
    FILE *ofile;
+   char *lines;
+   uint32_t *block_crc;
+   eop_bin_header_t header;
+   long file_size;
+   int i;
+
+   fseek( ifile, 0L, SEEK_END);
+   file_size = ftell( ifile);
+   fseek( ifile, 0L, SEEK_SET);
+   memset( &header, 0, sizeof( header));
+   memcpy( header.magic, EOP_BIN_MAGIC, sizeof( header.magic));
+   header.n_records = (int32_t)( file_size / (long)eop_line_len);
+   header.n_blocks = (header.n_records + EOP_BIN_BLOCK_LEN - 1) / EOP_BIN_BLOCK_LEN;
+   lines = (char *)calloc( (size_t)header.n_blocks * EOP_BIN_BLOCK_LEN,
+                               eop_line_len);
+   block_crc = (uint32_t *)calloc( (size_t)header.n_blocks, sizeof( uint32_t));
+   assert( lines && block_crc);
+   for( i = 0; i < header.n_records; i++)
+      {
+      char *tptr = lines + (size_t)i * eop_line_len;
+
+      if( !fread( tptr, eop_line_len, 1, ifile))
+         {
+         perror( "Couldn't read EOP line");
+         exit( -2);
+         }
+      if( !i)
+         header.mjd0 = atoi( tptr + 7);
+      else if( atoi( tptr + 7) != header.mjd0 + i)
+         {
+         fprintf( stderr, "Gap in %s after MJD %d;  %s not written\n",
+                        ifilename, header.mjd0 + i - 1, ofilename);
+         free( lines);
+         free( block_crc);
+         fclose( ifile);
+         return( -1);
+         }
+      if( tptr[16] == 'I')
+         header.file_mjd = header.mjd0 + i;
+      }
+   fclose( ifile);
+   for( i = 0; i < header.n_blocks; i++)
+      {
+      const int n_lines = (i == header.n_blocks - 1 ?
+               header.n_records - i * EOP_BIN_BLOCK_LEN : EOP_BIN_BLOCK_LEN);
+
+      block_crc[i] = eop_bin_crc32( lines + (size_t)i * EOP_BIN_BLOCK_LEN
+                        * eop_line_len, (size_t)n_lines * eop_line_len);
+      }
+   header.header_crc = eop_bin_crc32( &header, offsetof( eop_bin_header_t, header_crc));
+   ofile = err_fopen( ofilename, "wb");
+   fwrite( &header, sizeof( header), 1, ofile);
+   fwrite( block_crc, sizeof( uint32_t), (size_t)header.n_blocks, ofile);
+   fwrite( lines, eop_line_len, (size_t)header.n_records, ofile);
+   fclose( ofile);
+   free( lines);
+   free( block_crc);
+   printf( "%s written : %d days starting at MJD %d\n", ofilename,
+                  (int)header.n_records, (int)header.mjd0);
+   return( 0);
+}
+
+int main( const int argc, const char **argv)
+{
+   FILE *all, *daily, *ofile;
    int mjd1 = 41684, mjd2;
    char buff[200], date_buff[80];
    const char *start_of_finals_dot_all = "73 1 2 41684.00 I  0";
    bool daily_predicts_shown = false, all_predicts_shown = false;
 
+   if( argc > 1 && !strcmp( argv[1], "-b"))
+      return( write_binary_eop_table( "finals.mix", "finals.bin"));
+   all = err_fopen( "finals.all", "rb");
+   daily = err_fopen( "finals.daily", "rb");
+
    err_fgets( buff, sizeof( buff), all);
    printf( "%s : start date for finals.all\n", format_eop_date( buff, date_buff));
    assert( !memcmp( buff, start_of_finals_dot_all, 20));
@@ -162,5 +243,5 @@ int main( void)
    fclose( all);
    fclose( daily);
    fclose( ofile);
-   return( 0);
+   return( write_binary_eop_table( "finals.mix", "finals.bin"));
 }
@@ -0,0 +1,69 @@
+/* eop_bin.h: layout of the binary EOP table written by 'dailyize'
+
+Copyright (C) 2026, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.    */
+
+/* 'finals.bin' holds the same 188-byte lines as 'finals.mix',  but with
+a header saying which MJD the first line is for.  Since there's one line
+per day,  the line for a given MJD is found by simple arithmetic,  and
+a program needing EOPs for a few days can pull out just those lines
+instead of reading the whole file (which goes back to 1973).
+
+   The file is :
+
+   eop_bin_header_t header;
+   uint32_t block_crc[header.n_blocks];
+   char lines[header.n_records][EOP_BIN_RECORD_LEN];
+
+   Each block of EOP_BIN_BLOCK_LEN lines has a CRC-32,  so a reader
+need only check the blocks it uses.  The header has its own CRC-32,
+covering everything in it before 'header_crc'.  Integers are in the
+byte order of the machine that wrote the file;  a reader on a machine
+of differing byte order will find the magic string matches but the
+header CRC doesn't,  and should fall back to 'finals.mix'.  */
+
+#define EOP_BIN_MAGIC         "EOPbin01"
+#define EOP_BIN_RECORD_LEN    188
+#define EOP_BIN_BLOCK_LEN     64
+
+typedef struct
+{
+   char magic[8];
+   int32_t mjd0;           /* MJD of the first line */
+   int32_t n_records, n_blocks;
+   int32_t file_mjd;       /* MJD of the last measured ('I') line */
+   uint32_t header_crc;
+} eop_bin_header_t;
+
+/* Plain bitwise CRC-32 (the zlib/PNG polynomial).  Slow by CRC standards,
+but it's only run over a few blocks at a time. */
+
+static uint32_t eop_bin_crc32( const void *data, size_t n_bytes)
+{
+   const unsigned char *dptr = (const unsigned char *)data;
+   uint32_t crc = 0xffffffffu;
+
+   while( n_bytes--)
+      {
+      int i;
+
+      crc ^= *dptr++;
+      for( i = 0; i < 8; i++)
+         crc = (crc >> 1) ^ (0xedb88320u & (0u - (crc & 1u)));
+      }
+   return( ~crc);
+}
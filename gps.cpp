@@ -4,8 +4,17 @@
 #include <curl/easy.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <assert.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#endif
+#include <sys/stat.h>
+#include <utime.h>
 #include <stdbool.h>
 #include <math.h>
 #include <ctype.h>
@@ -18,6 +27,7 @@ const double pi =
 
 static size_t total_written;
 time_t download_start_time;
+static long remote_file_time;
 int gps_verbose;
 
 /* Somewhat arbitrarily,  if the overall download rate is less than the
@@ -53,9 +63,15 @@ static const char *netrc_filename = "netrc.txt";
 #define FETCH_CURL_PERFORM_FAILED          -3
 #define FETCH_FILESIZE_WRONG               -4
 #define FETCH_CURL_INIT_FAILED             -5
+#define FETCH_NOT_MODIFIED                  1
+
+/* If 'if_modified_since' is non-zero,  the file is fetched only if the
+server's copy is newer than that (FETCH_NOT_MODIFIED is returned if it
+isn't).  The server's time for the file,  if it gave one,  is left in
+'remote_file_time'.  */
 
 static int grab_file( const char *url, const char *outfilename,
-                                    const bool append)
+                     const bool append, const time_t if_modified_since)
 {
     CURL *curl = curl_easy_init();
 
@@ -72,6 +88,12 @@ static int grab_file( const char *url, const char *outfilename,
         curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuff);
         curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 5L);
         curl_easy_setopt(curl, CURLOPT_TIMEOUT, 25L);
+        curl_easy_setopt(curl, CURLOPT_FILETIME, 1L);
+        if( if_modified_since)
+            {
+            curl_easy_setopt(curl, CURLOPT_TIMECONDITION, CURL_TIMECOND_IFMODSINCE);
+            curl_easy_setopt(curl, CURLOPT_TIMEVALUE, (long)if_modified_since);
+            }
         if( have_netrc)
             {
             curl_easy_setopt(curl, CURLOPT_NETRC, CURL_NETRC_OPTIONAL);
@@ -81,6 +103,14 @@ static int grab_file( const char *url, const char *outfilename,
             curl_easy_setopt(curl, CURLOPT_COOKIEJAR, cookie_file_name);
             }
         CURLcode res = curl_easy_perform(curl);
+        long unmet = 0;
+
+        remote_file_time = -1;
+        if( !res)
+            {
+            curl_easy_getinfo(curl, CURLINFO_CONDITION_UNMET, &unmet);
+            curl_easy_getinfo(curl, CURLINFO_FILETIME, &remote_file_time);
+            }
         curl_easy_cleanup(curl);
         fclose(fp);
         if( have_netrc)
@@ -97,6 +127,11 @@ static int grab_file( const char *url, const char *outfilename,
            unlink( outfilename);
            return( FETCH_CURL_PERFORM_FAILED);
            }
+        if( unmet)
+           {
+           unlink( outfilename);
+           return( FETCH_NOT_MODIFIED);
+           }
     } else
         return( FETCH_CURL_INIT_FAILED);
     return 0;
@@ -142,32 +177,125 @@ static int recent_download_failure( const char *url)
    return( rval);
 }
 
-static void try_to_download( const char *url, const char *filename)
+static bool files_are_identical( const char *filename1, const char *filename2)
+{
+   FILE *ifile1 = fopen( filename1, "rb");
+   FILE *ifile2 = fopen( filename2, "rb");
+   bool rval = (ifile1 && ifile2);
+   char buff1[4096], buff2[4096];
+   size_t n_read;
+
+   while( rval && (n_read = fread( buff1, 1, sizeof( buff1), ifile1)) > 0)
+      rval = (fread( buff2, 1, n_read, ifile2) == n_read
+                     && !memcmp( buff1, buff2, n_read));
+   if( rval)
+      rval = (fread( buff2, 1, 1, ifile2) == 0);
+   if( ifile1)
+      fclose( ifile1);
+   if( ifile2)
+      fclose( ifile2);
+   return( rval);
+}
+
+/* Rapid,  ultra-rapid,  and five-day products are reissued under the
+same name,  so we may already have an older copy of the file.  In that
+case,  the download is conditional on the server's copy being newer.
+Files are dated with the server's time for them,  so that the comparison
+is between the server's clock and itself.  Some servers ignore the
+condition and send the file anyway;  if it's the same size and content
+as our copy,  we keep ours (and its date),  so that its index and cached
+positions remain valid.
+
+   Uncompressed files are downloaded to a temporary name,  so that a
+failed download doesn't wipe out the copy we had.  (Compressed files
+are downloaded to their .Z/.gz names,  and only replace our copy when
+decompressed.)   */
+
+static void download_file( const char *url, const char *filename)
 {
+   const bool compressed = (toupper( filename[strlen( filename) - 1]) == 'Z');
+   char local_name[160], temp_name[160];
+   struct stat st;
+   bool have_local;
    int rval;
 
    total_written = 0;
    download_start_time = time( NULL);
    if( recent_download_failure( url))
       return;
-   rval = grab_file( url, filename, false);
+   snprintf( local_name, sizeof( local_name), "%s", filename);
+   if( compressed)
+      {
+      *strrchr( local_name, '.') = '\0';
+      strcpy( temp_name, filename);
+      }
+   else
+      snprintf( temp_name, sizeof( temp_name), "%s.tmp", filename);
+   have_local = !stat( local_name, &st);
+   rval = grab_file( url, temp_name, false, (have_local ? st.st_mtime : 0));
    if( gps_verbose)
       printf( "Download '%s': %d, %ld bytes, %.24s UTC\n", url, rval, total_written,
                      asctime( gmtime( &download_start_time)));
+   if( rval == FETCH_NOT_MODIFIED)
+      {
+      if( gps_verbose)
+         printf( "'%s' is unchanged\n", local_name);
+      return;
+      }
    if( rval || total_written < 22000)      /* just got an error message */
       {
-      unlink( filename);
+      unlink( temp_name);
       add_download_failure( url, rval);
+      return;
       }
-   else if( toupper( filename[strlen( filename) - 1]) == 'Z')
+   if( compressed)
       {
       char command[160];
 
-      snprintf( command, sizeof( command), "gzip -d %s", filename);
+      snprintf( command, sizeof( command), "gzip -df %s", filename);
       rval = system( command);
       if( gps_verbose)
          printf( "'%s': %d\n", command, rval);
       }
+   else if( have_local && (size_t)st.st_size == total_written
+                  && files_are_identical( temp_name, local_name))
+      {
+      if( gps_verbose)
+         printf( "'%s' is unchanged (server sent it anyway)\n", local_name);
+      unlink( temp_name);
+      return;
+      }
+   else
+      {
+      unlink( local_name);
+      rename( temp_name, local_name);
+      }
+   if( remote_file_time > 0)
+      {
+      struct utimbuf times;
+
+      times.actime = times.modtime = (time_t)remote_file_time;
+      utime( local_name, &times);
+      }
+}
+
+/* The download statistics above are globals,  and a background loader
+(see below) may be downloading at the same time,  so downloads are done
+one at a time. */
+
+#ifndef _WIN32
+static pthread_mutex_t download_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void try_to_download( const char *url, const char *filename)
+{
+#ifndef _WIN32
+   pthread_mutex_lock( &download_mutex);
+#endif
+   download_file( url, filename);
+#ifndef _WIN32
+   pthread_mutex_unlock( &download_mutex);
+#endif
 }
 
 /* GPS ephems are provided at fifteen-minute intervals.  We'll call
@@ -195,40 +323,126 @@ are cached.  In the ordinary way of things,  we'll usually use just one
 file,  but sometimes two if we're at the "switchover" point from one
 day's data to the next.  But by caching,  we ensure that even with some
 pretty weird data usage,  the data we need will be available,  almost
-always without having to thrash the disk.   */
+always without having to thrash the disk.
+
+   The cache is limited by memory use rather than by number of glumphs
+(see set_gps_cache_budget( )).  When it goes over budget,  the least
+recently used file's glumphs are evicted,  all of them;  evicting half a
+day would just mean parsing the whole file again to get the other half
+back.  Files used since update_sweep_window( ) started are never evicted,
+nor is the file just loaded,  so the budget can be exceeded if a single
+window needs more than it allows.   */
+
+/* Most products have positions for well under half of the MAX_N_GPS_SATS
+satellites,  so storing all MAX_N_GPS_SATS * 3 doubles for each glumph
+would be mostly zeroes.  Instead,  each cached glumph has a bitmap saying
+which satellites are present,  and the positions for just those,  packed
+in order of satellite index.  The positions are allocated along with the
+rest of the entry,  right after it.
 
-#define N_CACHED 1000
+   (Positions are kept as doubles.  .sp3 positions are given to the
+millimeter,  but 32-bit millimeter offsets from any fixed reference would
+only reach about 2100 km,  less than a navsat moves in one glumph.)
+
+   Entries aren't malloc()ed one by one.  Each file's entries are carved
+out of its own chain of CACHE_BLOCK_SIZE blocks,  and since files are
+evicted whole,  so are the blocks.  They go on a free list and are used
+again for the next file read in.  So once the cache has filled up to its
+budget,  reading and evicting files causes no heap allocation at all
+(see 'n_heap_allocs' in the cache statistics).  */
 
 typedef struct
 {
-   int glumph;
-   double posns[MAX_N_GPS_SATS * 3];
+   int glumph, n_present;
+   int file_idx;           /* index in cached_files[] */
+   uint64_t hash;          /* of the epoch's text;  zero if unknown */
+   uint32_t present[(MAX_N_GPS_SATS + 31) / 32];
+   double *posns;          /* n_present * 3 values */
 } cached_posns_t;
 
-static cached_posns_t *cache[N_CACHED];
+#define IS_PRESENT( entry, idx) (((entry)->present[(idx) >> 5] >> ((idx) & 31)) & 1)
+
+#define CACHE_BLOCK_SIZE 65536
+
+typedef struct cache_block
+{
+   struct cache_block *next;
+   size_t used;            /* bytes used,  not counting this header */
+} cache_block_t;
+
+typedef struct
+{
+   char *filename;
+   int glumph_lo, glumph_hi;     /* range covered by the file */
+   int64_t mtime, size;          /* of the issue that was read */
+   time_t last_checked;          /* when we last looked for a new issue */
+   unsigned last_used;
+   size_t n_bytes;
+   cache_block_t *blocks;
+   int n_loads;
+   bool resident;
+} cached_file_t;
+
+#define DEFAULT_CACHE_BUDGET (16 * 1024 * 1024)
+
+static cached_posns_t **cache;         /* most recently used first */
+static int n_cached, n_cache_alloced;
+static cached_file_t *cached_files;
+static int n_cached_files;
+static size_t cache_bytes, cache_budget = DEFAULT_CACHE_BUDGET;
+static unsigned cache_clock, cache_pin_clock;
+static long cache_hits, cache_misses, cache_evictions, cache_reloads;
+static cache_block_t *free_blocks;
+static long n_heap_allocs, shared_hits, shared_stores, n_background_loads;
+
+#define INTERPOLATION_ORDER 10
+
+/* Positions for the glumphs currently used for interpolation;  see
+update_sweep_window( ). */
+
+typedef struct
+{
+   int iglumph;            /* glumph of the first node in the window */
+   int first;              /* ring slot holding that node */
+   bool valid;
+   time_t last_checked;    /* when its files were last checked for reissue */
+   int n_missing[MAX_N_GPS_SATS];
+   double node[MAX_N_GPS_SATS][3][INTERPOLATION_ORDER * 2];
+} sweep_window_t;
+
+static sweep_window_t *sweep;
 
 static char desigs[MAX_N_GPS_SATS][4];
 char is_from_tle[MAX_N_GPS_SATS];
 
-static int desig_to_index( const char *desig)
+static int find_desig( char (*table)[4], const char *desig)
 {
    int i;
 
-   for( i = 0; desigs[i][0]; i++)
-      if( !memcmp( desigs[i], desig, 3))
+   for( i = 0; i < MAX_N_GPS_SATS && table[i][0]; i++)
+      if( !memcmp( table[i], desig, 3))
          return( i);
    assert( i < MAX_N_GPS_SATS);
-   memcpy( desigs[i], desig, 3);
+   memcpy( table[i], desig, 3);
    return( i);
 }
 
+static int desig_to_index( const char *desig)
+{
+   return( find_desig( desigs, desig));
+}
+
 char *desig_from_index( const int idx)
 {
    assert( idx >= 0 && idx < MAX_N_GPS_SATS);
    return( desigs[idx]);
 }
 
-static int read_posns_for_one_glumph( FILE *ifile, double *locs)
+/* Satellite indices are looked up in 'table',  which is 'desigs' except
+when a background loader is reading a file (see below). */
+
+static int read_posns_for_one_glumph( FILE *ifile, double *locs,
+                                       char (*table)[4])
 {
    char buff[200];
    int i;
@@ -243,7 +457,7 @@ static int read_posns_for_one_glumph( FILE *ifile, double *locs)
          while( fgets( buff, sizeof( buff), ifile) && buff[0] == 'P')
             if( locs)
                {
-               const int i = desig_to_index( buff + 1);
+               const int i = find_desig( table, buff + 1);
                double *tptr = locs + i * 3;
 
                assert( i >= 0);
@@ -277,439 +491,3335 @@ static void insert_data_path( char *filename)
       filename[len - 1] = '/';
 }
 
-static double *fetch_posns_from_cache( const int glumph)
+static const cached_posns_t *fetch_posns_from_cache( const int glumph)
 {
    int i;
 
-   for( i = 0; i < N_CACHED; i++)
-      if( cache[i] && cache[i]->glumph == glumph)
+   for( i = 0; i < n_cached; i++)
+      if( cache[i]->glumph == glumph)
          {
          cached_posns_t *tptr = cache[i];
 
          memmove( cache + 1, cache, i * sizeof( cached_posns_t *));
          cache[0] = tptr;
+         cached_files[tptr->file_idx].last_used = ++cache_clock;
          if( gps_verbose)
-            printf( "Found glumph %d in cache: %p\n", glumph, (void *)cache[0]->posns);
-         return( cache[0]->posns);
+            printf( "Found glumph %d in cache: %d sats\n", glumph,
+                              cache[0]->n_present);
+         return( cache[0]);
          }
    if( gps_verbose)
       printf( "No luck finding glumph %d in cache\n", glumph);
    return( NULL);       /* not found in cache */
 }
 
+static void free_block_chain( cache_block_t *block)
+{
+   while( block)
+      {
+      cache_block_t *next = block->next;
+
+      free( block);
+      block = next;
+      }
+}
+
+static void detach_shared_cache( void);        /* see below */
+static void free_gps_track( void);             /* see below */
+static void free_gps_queries( void);           /* see below */
+static void free_loaded_files( struct loaded_file *tptr);
+static struct loaded_file *loaded_files;
+
 void free_cached_gps_positions( void)
 {
    int i;
 
-   for( i = 0; i < N_CACHED; i++)
-      if( cache[i])
-         {
-         free( cache[i]);
-         cache[i] = NULL;
-         }
+   wait_for_gps_loader( );
+   free_loaded_files( loaded_files);
+   loaded_files = NULL;
+   free_gps_track( );
+   free_gps_queries( );
+   if( sweep)
+      {
+      free( sweep);
+      sweep = NULL;
+      }
+
+   free( cache);
+   cache = NULL;
+   n_cached = n_cache_alloced = 0;
+   cache_bytes = 0;
+   for( i = 0; i < n_cached_files; i++)
+      {
+      free_block_chain( cached_files[i].blocks);
+      free( cached_files[i].filename);
+      }
+   free_block_chain( free_blocks);
+   free_blocks = NULL;
+   detach_shared_cache( );
+   free( cached_files);
+   cached_files = NULL;
+   n_cached_files = 0;
 }
 
-static void add_posns_to_cache( const int glumph, double *loc)
+/* The budget is in bytes.  If it's lowered below what's already cached,
+files are evicted the next time one is loaded. */
+
+void set_gps_cache_budget( const size_t n_bytes)
 {
-   cached_posns_t *tptr = cache[N_CACHED - 1];
+   cache_budget = n_bytes;
+}
 
-   if( !tptr)
-      tptr = (cached_posns_t *)calloc( 1, sizeof( cached_posns_t));
-   assert( tptr);
-   memmove( cache + 1, cache, (N_CACHED - 1) * sizeof( cached_posns_t *));
-   cache[0] = tptr;
-   tptr->glumph = glumph;
-   memcpy( tptr->posns, loc, sizeof( tptr->posns));
+void get_gps_cache_stats( gps_cache_stats_t *stats)
+{
+   int i;
+
+   stats->hits = cache_hits;
+   stats->misses = cache_misses;
+   stats->evictions = cache_evictions;
+   stats->reloads = cache_reloads;
+   stats->n_glumphs = n_cached;
+   stats->n_files = 0;
+   for( i = 0; i < n_cached_files; i++)
+      if( cached_files[i].resident)
+         stats->n_files++;
+   stats->n_bytes = cache_bytes;
+   stats->budget = cache_budget;
+   stats->n_heap_allocs = n_heap_allocs;
+   stats->shared_hits = shared_hits;
+   stats->shared_stores = shared_stores;
+   stats->background_loads = n_background_loads;
 }
 
-/* The GPS timing system starts on Monday, 1980 Jan 7 = MJD 44245 = GPS 00001
-(day 1 of week 0).  The 'real' start is Sunday, 1980 Jan 6 = GPS 00000. */
+static int find_cached_file( const char *filename)
+{
+   int i;
 
-#define GPS_SYSTEM_START 44244.
+   for( i = 0; i < n_cached_files; i++)
+      if( !strcmp( cached_files[i].filename, filename))
+         return( i);
+   return( -1);
+}
 
-static double *get_cached_posns( const char *filename, const int glumph)
+static int add_cached_file( const char *filename)
 {
-   double *rval = fetch_posns_from_cache( glumph);
+   cached_file_t *tptr;
 
-   if( !rval)
+   cached_files = (cached_file_t *)realloc( cached_files,
+                  (n_cached_files + 1) * sizeof( cached_file_t));
+   assert( cached_files);
+   n_heap_allocs += 2;
+   tptr = cached_files + n_cached_files;
+   memset( tptr, 0, sizeof( cached_file_t));
+   tptr->filename = (char *)malloc( strlen( filename) + 1);
+   assert( tptr->filename);
+   strcpy( tptr->filename, filename);
+   return( n_cached_files++);
+}
+
+/* Evicts least recently used files until we're within budget,  or until
+only files that are pinned (see above) are left. */
+
+static void evict_files_over_budget( void)
+{
+   while( cache_bytes > cache_budget)
       {
-      FILE *ifile = fopen( filename, "r");
+      int i, j, lru = -1;
 
-      if( ifile)
+      for( i = 0; i < n_cached_files; i++)
+         if( cached_files[i].resident
+                  && cached_files[i].last_used < cache_pin_clock
+                  && (lru < 0 || cached_files[i].last_used
+                                     < cached_files[lru].last_used))
+            lru = i;
+      if( lru < 0)
+         return;
+      for( i = j = 0; i < n_cached; i++)
+         if( cache[i]->file_idx != lru)
+            cache[j++] = cache[i];
+      n_cached = j;
+      if( gps_verbose)
+         printf( "Evicting '%s' (%lu bytes)\n", cached_files[lru].filename,
+                  (unsigned long)cached_files[lru].n_bytes);
+      cache_bytes -= cached_files[lru].n_bytes;
+      cached_files[lru].n_bytes = 0;
+      while( cached_files[lru].blocks)
          {
-         double locs[MAX_N_GPS_SATS * 3];
-         char buff[200];
-         int i, freq, glumph0;
-
-         for( i = 0; i < 2; i++)
-            if( !fgets( buff, sizeof( buff), ifile))
-               printf( "Error reading line %d\n", i + 1);
-         freq = atoi( buff + 25);
-         glumph0 = (int)( (atof( buff + 39) + atof( buff + 45)
-                        - GPS_SYSTEM_START) * glumphs_per_day + .0001);
-         assert( glumph0 > 0);
-         assert( glumph >= glumph0);
-         assert( freq == 300 || freq == 900);   /* five or 15 minutes */
-         while( read_posns_for_one_glumph( ifile, locs))
-            {
-            bool already_got_it = false;
-            int i;
-
-            for( i = 0; i < N_CACHED && !already_got_it; i++)
-               if( cache[i] && cache[i]->glumph == glumph0)
-                  already_got_it = true;
-            if( !already_got_it)
-               add_posns_to_cache( glumph0, locs);
-            glumph0++;
-            if( freq == 300)        /* skip two glumphs */
-               {
-               read_posns_for_one_glumph( ifile, NULL);
-               read_posns_for_one_glumph( ifile, NULL);
-               }
-            }
-         fclose( ifile);
+         cache_block_t *block = cached_files[lru].blocks;
+
+         cached_files[lru].blocks = block->next;
+         block->next = free_blocks;
+         free_blocks = block;
          }
-      rval = fetch_posns_from_cache( glumph);  /* should be in cache now */
+      cached_files[lru].resident = false;
+      cache_evictions++;
+      }
+}
+
+/* Returns 'n_bytes' of zeroed memory from the file's current block,
+starting a new block (from the free list if possible) if it's full. */
+
+static void *alloc_in_file( cached_file_t *file, size_t n_bytes)
+{
+   const size_t block_capacity = CACHE_BLOCK_SIZE - sizeof( cache_block_t);
+   cache_block_t *block = file->blocks;
+   char *rval;
+
+   n_bytes = (n_bytes + sizeof( double) - 1) & ~(sizeof( double) - 1);
+   assert( n_bytes <= block_capacity);
+   if( !block || block->used + n_bytes > block_capacity)
+      {
+      if( free_blocks)
+         {
+         block = free_blocks;
+         free_blocks = block->next;
+         }
+      else
+         {
+         block = (cache_block_t *)malloc( CACHE_BLOCK_SIZE);
+         assert( block);
+         n_heap_allocs++;
+         }
+      block->next = file->blocks;
+      block->used = 0;
+      file->blocks = block;
+      file->n_bytes += CACHE_BLOCK_SIZE;
+      cache_bytes += CACHE_BLOCK_SIZE;
       }
-   else if( gps_verbose)
-      printf( "Glumph %d found in cache\n", glumph);
+   rval = (char *)( block + 1) + block->used;
+   block->used += n_bytes;
+   memset( rval, 0, n_bytes);
    return( rval);
 }
 
-static void remove_dot_z( char *filename)
+static void add_posns_to_cache( const int glumph, const double *loc,
+                                 const int file_idx)
 {
-   char *tptr = strstr( filename, ".Z");
+   cached_posns_t *tptr;
+   size_t n_bytes;
+   int i, n_present = 0;
 
-   if( !tptr)
-      tptr = strstr( filename, ".gz");
-   assert( tptr);
-   *tptr = '\0';
+   for( i = 0; i < MAX_N_GPS_SATS; i++)
+      if( loc[i * 3] || loc[i * 3 + 1] || loc[i * 3 + 2])
+         n_present++;
+   n_bytes = sizeof( cached_posns_t) + n_present * 3 * sizeof( double);
+   tptr = (cached_posns_t *)alloc_in_file( cached_files + file_idx, n_bytes);
+   if( n_cached == n_cache_alloced)
+      {
+      n_cache_alloced = n_cache_alloced * 2 + 100;
+      cache = (cached_posns_t **)realloc( cache,
+                        n_cache_alloced * sizeof( cached_posns_t *));
+      assert( cache);
+      n_heap_allocs++;
+      }
+   memmove( cache + 1, cache, n_cached * sizeof( cached_posns_t *));
+   cache[0] = tptr;
+   n_cached++;
+   tptr->file_idx = file_idx;
+   tptr->glumph = glumph;
+   tptr->n_present = n_present;
+   tptr->posns = (double *)( tptr + 1);
+   n_present = 0;
+   for( i = 0; i < MAX_N_GPS_SATS; i++, loc += 3)
+      if( loc[0] || loc[1] || loc[2])
+         {
+         tptr->present[i >> 5] |= (uint32_t)1 << (i & 31);
+         memcpy( tptr->posns + n_present * 3, loc, 3 * sizeof( double));
+         n_present++;
+         }
 }
 
-/* Days between (year) Jan 1 and 1980 Jan 7 = MJD 44245,  start of the
-GPS ddddy system.  Should return -6 for year=1980,  360 for year=1981. */
+/* The GPS timing system starts on Monday, 1980 Jan 7 = MJD 44245 = GPS 00001
+(day 1 of week 0).  The 'real' start is Sunday, 1980 Jan 6 = GPS 00000. */
 
-static int start_of_year( const int year)
+/* Several list_gps.cgi processes running at once would each parse the
+same .sp3 files,  and each hold their own copy.  If use_shared_gps_cache( )
+has been called,  parsed files are also put in a POSIX shared memory
+segment,  and on a local cache miss,  we look there before parsing the
+file.  Only the glumphs actually needed are copied into the local cache;
+the interpolation window only uses ten at a time,  so each process holds
+a few dozen kilobytes rather than its own copy of each day.
+
+   The segment is a directory of SHM_N_FILES files,  followed by an
+'arena' holding their glumphs.  Files are written into the arena as a
+ring;  when it wraps around,  the files being overwritten (and,  if the
+directory is full,  the oldest file) are removed from the directory.
+Writers take an flock( ) on the segment,  so there's only one at a time.
+
+   Readers don't lock anything.  Each directory entry has a sequence
+number,  made odd by a writer before it changes the entry or its data and
+even again when done.  A reader notes the sequence number,  copies out
+what it wants,  and checks that the number hasn't changed;  if it has,
+the copy may be torn,  and it's thrown away.  (Offsets and sizes are
+sanity-checked before copying,  since they may be garbage in that case.)
+The header has a layout version;  a process built with a different layout
+won't use a segment made by another. */
+
+#define SHM_LAYOUT_VERSION    2
+#define SHM_MAGIC             0x45535047     /* 'GPSE' */
+#define SHM_N_FILES           64
+#define SHM_FILENAME_LEN      128
+#define SHM_DEFAULT_SIZE      (64 * 1024 * 1024)
+
+typedef struct
 {
-/* return( 365 * (year - 1980) + (year - 1977) / 4 - 6);    */
-   return( 365 * year  + (year - 1) / 4 - 723200);
-}
+   uint32_t seq;              /* odd while being written */
+   uint32_t stamp;            /* order in which files were written */
+   int32_t glumph_lo, n_glumphs;
+   uint32_t offset, n_bytes;  /* location of the file's data in the arena */
+   int64_t mtime, size;       /* issue of the file (see cached_file_t) */
+   char filename[SHM_FILENAME_LEN];
+} shm_file_t;
 
-/* If possible,  we get positions from the MGEX (Multi-GNSS Experiment)
-files:  see http://mgex.igs.org/ for information about this.  MGEX
-conveniently provides data for (as of early 2021) GPS,  GLONASS,  Galileo,
-BeiDou,  and QZSS satellites.  The file naming conventions changed after
-week 1797,  and we try both GBM (from the University of Potsdam) files
-and WUM (Wuhan University) and SHA (Shanghai?) files.  The last two
-actually extend a bit into the future,  meaning you can sometimes know
-where to look for all five constellations at least slightly ahead of
-time.
+typedef struct
+{
+   uint32_t magic, layout_version;
+   uint32_t arena_size, write_offset, n_stores;
+   shm_file_t files[SHM_N_FILES];
+} shm_header_t;
 
-   (Note that,  as of December 2024,  the Potsdam files were unavailable.
-They are shut off for the nonce.)
+/* A file's data in the arena is an array of n_glumphs offsets (relative
+to the start of the data;  zero if the glumph is missing),  padded to a
+multiple of eight bytes,  followed by the glumphs,  each an shm_glumph_t
+followed by n_present shm_sat_ts.  Satellites are given by designation;
+indices (see desig_to_index( )) are assigned separately by each process,
+in the order in which it happens to see them. */
 
-   However,  MGEX provides very limited predictions,  and only goes back
-to early 2012.  Also,  some MGEX files are only available (as best I can
-tell) from the NASA CDDIS site,  which turned off anonymous ftp in early
-2021.  If we can't get an MGEX file,  we use CODE ephems (Center for
-Orbit Determination in Europe),  downloaded from the University of Berne
-in Switzerland.  Unfortunately,  they'll only get you GPS,  GLONASS,  and
-Galileo satellites.  (Though that's usually plenty.)
+typedef struct
+{
+   int32_t glumph, n_present;
+   uint64_t hash;             /* see cached_posns_t */
+} shm_glumph_t;
 
-   And then,  if all else fails,  we go for the IGU ("ultra-rapid") file.
-These give only GPS satellites.  I don't think those will ever actually
-be used.  I think I added them at a time when access to the CODE data
-was sometimes an iffy prospect.
+typedef struct
+{
+   char desig[8];
+   double posn[3];
+} shm_sat_t;
 
-   Note that we can also use TLEs to get approximate positions for
-Galileo,  BeiDou,  and QZSS satellites;  you can then observe those
-objects,  wait for MGEX data to come out,  and then check your results.
-See the get_gps_positions_from_tle( ) function below.
+#define SHM_ALIGN( n) (((n) + 7) & ~(size_t)7)
+#define SHM_ARENA_START SHM_ALIGN( sizeof( shm_header_t))
 
-Base URL for the University of Bern files: */
+static shm_header_t *shm;
+static char shm_name[SHM_FILENAME_LEN];
+static size_t shm_size;
+static int shm_fd = -1;
 
-#define UNIBE_BASE_URL "ftp://ftp.aiub.unibe.ch/CODE/"
+#ifdef _WIN32
+int use_shared_gps_cache( const char *, const size_t)
+{
+   return( -1);         /* no POSIX shared memory here */
+}
 
-bool use_mgex_data = true;
+static void detach_shared_cache( void)
+{
+}
 
-/* As of 2018 Jun 9,  the MGEX data actually started in GPS week 1680
-(2012 March 17) and the IGU ("ultra-rapid") predictive CDDIS data in week
-1080 (2000 Sep 16).  I've backed both up by about a year in case other
-data turns up.  This check could be skipped completely,  but I figure this
-avoids a certain amount of requests for files that almost surely do not
-exist.
+static const cached_posns_t *get_shared_posns( const char *, const int,
+                                 const struct stat *, int *)
+{
+   return( NULL);
+}
 
-In a similar vein,  the CODwwwwd.EPH files only come up within a week or
-so of the present,  and the .EPH_5D files start after that and proceed
-a day or two into the future.  So we compute 'curr_day' and compare
-against that,  with some extra margin because the limits appear to vary.
-We'll sometimes check for files that don't actually exist yet/existed
-and have been removed.        */
+static void put_file_in_shared_cache( const char *, const int)
+{
+}
+#else
 
-#define MGEX_START_WEEK 1689
-#define IGU_START_WEEK 1030
-#define UNIBE_COD_START_WEEK 649
+static void detach_shared_cache( void)
+{
+   if( shm)
+      {
+      munmap( shm, shm_size);
+      close( shm_fd);
+      shm = NULL;
+      shm_fd = -1;
+      *shm_name = '\0';
+      }
+}
 
-static double *get_tabulated_gps_posns( const int glumph, int *err_code,
-            const bool fetch_files)
+/* Attaches to the named segment,  creating it with the given size (or,
+if that's zero,  SHM_DEFAULT_SIZE) if it doesn't exist yet.  If it does
+exist,  its own size is used.  Returns 0 on success. */
+
+int use_shared_gps_cache( const char *name, size_t n_bytes)
 {
-   int day = glumph / glumphs_per_day, i;
-   int day_of_year, week = day / 7;
-   char filename[125], command[200];
-   double *rval;
-   const int curr_day = (int)( time( NULL) / 86400) - 3658;
+   struct stat st;
+   int rval = 0;
 
-   *err_code = 0;
-   rval = get_cached_posns( filename, glumph);
-   if( rval)
+   if( shm && !strcmp( name, shm_name))
+      return( 0);             /* already attached */
+   detach_shared_cache( );
+   if( !n_bytes)
+      n_bytes = SHM_DEFAULT_SIZE;
+   if( n_bytes < 2 * SHM_ARENA_START || n_bytes > 0xffffffffu)
+      return( -1);
+   shm_fd = shm_open( name, O_RDWR | O_CREAT, 0666);
+   if( shm_fd < 0)
+      return( -2);
+   flock( shm_fd, LOCK_EX);
+   if( fstat( shm_fd, &st))
+      rval = -3;
+   else if( !st.st_size)       /* we're creating it */
       {
-      if( gps_verbose)
-         printf( "Already got glumph %d in cache\n", glumph);
-      return( rval);
+      if( ftruncate( shm_fd, (off_t)n_bytes))
+         rval = -4;
       }
-   i = 1980;
-   while( i < 2200 && start_of_year( i + 1) < day)
-      i++;
-   day_of_year = day - start_of_year( i);
-   if( use_mgex_data && day > MGEX_START_WEEK * 7 && day < curr_day + 4)
+   else
+      n_bytes = (size_t)st.st_size;
+   if( !rval)
       {
-      int pass;
-      const char *suffix = (day < curr_day - 28 ? "" : "_IGS20");
-
-      if( week >= 1797)                /* roughly after June 2014 */
+      shm_size = n_bytes;
+      shm = (shm_header_t *)mmap( NULL, shm_size, PROT_READ | PROT_WRITE,
+                                          MAP_SHARED, shm_fd, 0);
+      if( shm == MAP_FAILED)
          {
-         if( week < 2081)
-            snprintf( filename, sizeof( filename), "gbm%04d%d.sp3.Z",
-                                         week, day % 7);
-         else
-            snprintf( filename, sizeof( filename), "GBM0MGXRAP_%d%03d0000_01D_05M_ORB.SP3.gz",
-                           i, day_of_year);
+         shm = NULL;
+         rval = -5;
          }
-      snprintf( command, sizeof( command),
-               "ftp://ftp.gfz-potsdam.de/GNSS/products/mgex/%4d%s/%s",
-               week, suffix, filename);
-      insert_data_path( filename);
-#ifdef GFZ_POTSDAM
-      if( gps_verbose)
-         printf( "MGEX (multi-GNSS) file: '%s', %d %d: '%s'\n", filename, glumph,
-                glumph - day * glumphs_per_day, command);
-      if( fetch_files)
+      else if( !st.st_size)    /* new segment;  ftruncate( ) zeroed it */
+         {
+         shm->arena_size = (uint32_t)( shm_size - SHM_ARENA_START);
+         shm->layout_version = SHM_LAYOUT_VERSION;
+         shm->magic = SHM_MAGIC;
+         }
+      else if( shm->magic != SHM_MAGIC
+               || shm->layout_version != SHM_LAYOUT_VERSION
+               || shm->arena_size != shm_size - SHM_ARENA_START)
+         rval = -6;
+      }
+   flock( shm_fd, LOCK_UN);
+   if( rval)
+      {
+      if( shm)
+         munmap( shm, shm_size);
+      shm = NULL;
+      close( shm_fd);
+      shm_fd = -1;
+      }
+   else
+      snprintf( shm_name, sizeof( shm_name), "%s", name);
+   if( gps_verbose)
+      printf( "Shared cache '%s' (%lu bytes): rval %d\n", name,
+                              (unsigned long)n_bytes, rval);
+   return( rval);
+}
+
+/* Copies the glumph for the given file from the shared segment into the
+local cache,  if it's there and from the same issue of the file as 'st'
+describes.  'file_idx' is the local record for the file (-1 if there
+isn't one yet,  in which case it's created). */
+
+static const cached_posns_t *get_shared_posns( const char *filename,
+                 const int glumph, const struct stat *st, int *file_idx)
+{
+   const char *arena = (const char *)shm + SHM_ARENA_START;
+   int i, attempt;
+
+   if( !shm)
+      return( NULL);
+   for( i = 0; i < SHM_N_FILES; i++)
+      for( attempt = 0; attempt < 3; attempt++)
+         {
+         const shm_file_t *entry = shm->files + i;
+         const uint32_t seq = __atomic_load_n( &entry->seq, __ATOMIC_ACQUIRE);
+         const int32_t glumph_lo = entry->glumph_lo;
+         const int32_t n_glumphs = entry->n_glumphs;
+         const uint32_t offset = entry->offset, n_bytes = entry->n_bytes;
+         shm_sat_t sats[MAX_N_GPS_SATS];
+         double locs[MAX_N_GPS_SATS * 3];
+         shm_glumph_t rec;
+         uint32_t rec_offset;
+         bool got_it = false;
+         int j;
+
+         if( (seq & 1) || !n_bytes
+                  || strncmp( entry->filename, filename, SHM_FILENAME_LEN)
+                  || entry->mtime != (int64_t)st->st_mtime
+                  || entry->size != (int64_t)st->st_size)
+            break;
+         if( glumph < glumph_lo || glumph >= glumph_lo + n_glumphs
+                  || n_glumphs <= 0 || (size_t)offset + n_bytes > shm->arena_size
+                  || (size_t)n_glumphs * sizeof( uint32_t) > n_bytes)
+            break;
+         memcpy( &rec_offset, arena + offset
+                     + (glumph - glumph_lo) * sizeof( uint32_t), sizeof( uint32_t));
+         if( rec_offset && (size_t)rec_offset + sizeof( shm_glumph_t) <= n_bytes)
+            {
+            memcpy( &rec, arena + offset + rec_offset, sizeof( shm_glumph_t));
+            if( rec.glumph == glumph && rec.n_present >= 0
+                   && rec.n_present <= MAX_N_GPS_SATS
+                   && rec_offset + sizeof( shm_glumph_t)
+                         + rec.n_present * sizeof( shm_sat_t) <= n_bytes)
+               {
+               memcpy( sats, arena + offset + rec_offset + sizeof( shm_glumph_t),
+                                 rec.n_present * sizeof( shm_sat_t));
+               got_it = true;
+               }
+            }
+         __atomic_thread_fence( __ATOMIC_ACQUIRE);
+         if( __atomic_load_n( &entry->seq, __ATOMIC_RELAXED) != seq)
+            continue;         /* a writer got in the way;  try again */
+         if( !got_it)
+            return( NULL);    /* file's there,  but lacks this glumph */
+         memset( locs, 0, sizeof( locs));
+         for( j = 0; j < rec.n_present; j++)
+            memcpy( locs + desig_to_index( sats[j].desig) * 3, sats[j].posn,
+                                 3 * sizeof( double));
+         if( *file_idx < 0)
+            *file_idx = add_cached_file( filename);
+         cached_files[*file_idx].glumph_lo = glumph_lo;
+         cached_files[*file_idx].glumph_hi = glumph_lo + n_glumphs - 1;
+         cached_files[*file_idx].mtime = (int64_t)st->st_mtime;
+         cached_files[*file_idx].size = (int64_t)st->st_size;
+         cached_files[*file_idx].last_checked = time( NULL);
+         cached_files[*file_idx].resident = true;
+         cached_files[*file_idx].last_used = ++cache_clock;
+         add_posns_to_cache( glumph, locs, *file_idx);
+         cache[0]->hash = rec.hash;
+         shared_hits++;
+         evict_files_over_budget( );
+         return( fetch_posns_from_cache( glumph));
+         }
+   return( NULL);
+}
+
+static void invalidate_shm_entry( shm_file_t *entry)
+{
+   __atomic_store_n( &entry->seq, entry->seq + 1, __ATOMIC_RELAXED);
+   __atomic_thread_fence( __ATOMIC_RELEASE);
+   entry->n_bytes = 0;
+   *entry->filename = '\0';
+   __atomic_store_n( &entry->seq, entry->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* After a file is parsed,  this copies its glumphs into the shared
+segment,  unless some other process got there first.  (An older issue of
+the file is replaced.)  A glumph in the file's range may be in the local
+cache under another file (see cache_one_glumph( )),  so we take those
+too. */
+
+static void put_file_in_shared_cache( const char *filename, const int file_idx)
+{
+   const cached_file_t *file = cached_files + file_idx;
+   const int n_glumphs = file->glumph_hi - file->glumph_lo + 1;
+   const cached_posns_t **entries;
+   size_t n_bytes = SHM_ALIGN( n_glumphs * sizeof( uint32_t)), offset;
+   char *data;
+   shm_file_t *entry = NULL;
+   int i;
+
+   if( !shm || n_glumphs <= 0 || strlen( filename) >= SHM_FILENAME_LEN)
+      return;
+   entries = (const cached_posns_t **)calloc( n_glumphs, sizeof( cached_posns_t *));
+   assert( entries);
+   n_heap_allocs++;
+   for( i = 0; i < n_cached; i++)
+      {
+      const int idx = cache[i]->glumph - file->glumph_lo;
+
+      if( idx >= 0 && idx < n_glumphs
+               && (!entries[idx] || cache[i]->file_idx == file_idx))
+         entries[idx] = cache[i];
+      }
+   for( i = 0; i < n_glumphs; i++)
+      if( entries[i])
+         n_bytes += sizeof( shm_glumph_t)
+                              + entries[i]->n_present * sizeof( shm_sat_t);
+   flock( shm_fd, LOCK_EX);
+   for( i = 0; i < SHM_N_FILES; i++)
+      if( shm->files[i].n_bytes && !strcmp( shm->files[i].filename, filename))
+         {
+         if( shm->files[i].mtime == file->mtime
+                        && shm->files[i].size == file->size)
+            n_bytes = 0;         /* someone else already put it there */
+         else
+            invalidate_shm_entry( shm->files + i);
+         }
+   if( n_bytes && n_bytes <= shm->arena_size / 4)
+      {
+      offset = shm->write_offset;
+      if( offset + n_bytes > shm->arena_size)
+         offset = 0;             /* wrap around */
+      for( i = 0; i < SHM_N_FILES; i++)
+         {
+         shm_file_t *tptr = shm->files + i;
+
+         if( tptr->n_bytes && tptr->offset < offset + n_bytes
+                           && offset < tptr->offset + tptr->n_bytes)
+            invalidate_shm_entry( tptr);
+         if( !tptr->n_bytes && !entry)
+            entry = tptr;
+         }
+      if( !entry)       /* directory full;  replace the oldest file */
+         {
+         entry = shm->files;
+         for( i = 1; i < SHM_N_FILES; i++)
+            if( shm->files[i].stamp < entry->stamp)
+               entry = shm->files + i;
+         invalidate_shm_entry( entry);
+         }
+      __atomic_store_n( &entry->seq, entry->seq + 1, __ATOMIC_RELAXED);
+      __atomic_thread_fence( __ATOMIC_RELEASE);
+      data = (char *)shm + SHM_ARENA_START + offset;
+      memset( data, 0, n_glumphs * sizeof( uint32_t));
+      n_bytes = SHM_ALIGN( n_glumphs * sizeof( uint32_t));
+      for( i = 0; i < n_glumphs; i++)
+         if( entries[i])
+            {
+            const uint32_t rec_offset = (uint32_t)n_bytes;
+            shm_glumph_t rec;
+            shm_sat_t sat;
+            int j, k;
+
+            rec.glumph = entries[i]->glumph;
+            rec.n_present = entries[i]->n_present;
+            rec.hash = entries[i]->hash;
+            memcpy( data + i * sizeof( uint32_t), &rec_offset, sizeof( uint32_t));
+            memcpy( data + n_bytes, &rec, sizeof( shm_glumph_t));
+            n_bytes += sizeof( shm_glumph_t);
+            memset( &sat, 0, sizeof( sat));
+            for( j = k = 0; j < MAX_N_GPS_SATS; j++)
+               if( IS_PRESENT( entries[i], j))
+                  {
+                  memcpy( sat.desig, desigs[j], 3);
+                  memcpy( sat.posn, entries[i]->posns + 3 * k++, 3 * sizeof( double));
+                  memcpy( data + n_bytes, &sat, sizeof( shm_sat_t));
+                  n_bytes += sizeof( shm_sat_t);
+                  }
+            }
+      snprintf( entry->filename, SHM_FILENAME_LEN, "%s", filename);
+      entry->glumph_lo = file->glumph_lo;
+      entry->n_glumphs = n_glumphs;
+      entry->offset = (uint32_t)offset;
+      entry->n_bytes = (uint32_t)n_bytes;
+      entry->mtime = file->mtime;
+      entry->size = file->size;
+      entry->stamp = ++shm->n_stores;
+      __atomic_store_n( &entry->seq, entry->seq + 1, __ATOMIC_RELEASE);
+      shm->write_offset = (uint32_t)( offset + n_bytes);
+      shared_stores++;
+      }
+   flock( shm_fd, LOCK_UN);
+   free( entries);
+}
+#endif      /* #ifndef _WIN32 */
+
+#define GPS_SYSTEM_START 44244.
+
+/* Reads the first two lines of an .sp3 file,  setting 'freq' to the
+spacing in seconds and returning the glumph of the first positions. */
+
+static int read_sp3_header( FILE *ifile, int *freq)
+{
+   char buff[200];
+   int i, glumph0;
+
+   for( i = 0; i < 2; i++)
+      if( !fgets( buff, sizeof( buff), ifile))
+         printf( "Error reading line %d\n", i + 1);
+   *freq = atoi( buff + 25);
+   glumph0 = (int)( (atof( buff + 39) + atof( buff + 45)
+                        - GPS_SYSTEM_START) * glumphs_per_day + .0001);
+   assert( glumph0 > 0);
+   assert( *freq == 300 || *freq == 900);   /* five or 15 minutes */
+   return( glumph0);
+}
+
+/* A CGI query usually needs one glumph,  and the ten around it for
+interpolation.  Parsing a whole file for that is a waste,  especially
+for the two-day,  five-minute ultra-rapid files (576 epochs).  So the
+first time we read a file,  we note the byte offset of each epoch ('*'
+line) we'd use,  and store those in 'filename.idx' next to the file
+(if we can write there).  After that,  we read only the glumphs within
+SP3_READ_AHEAD of the one wanted.
+
+   The index records the size and modification time of the .sp3 file,
+and is rebuilt if the file has changed (new rapid files do replace old
+ones).  Files indexing more than MAX_INDEXED_GLUMPHS glumphs are just
+read in full.  So are all files when a shared cache is in use (see
+above),  since one process then reads the whole file for everyone. */
+
+#define SP3_INDEX_MAGIC       "SP3idx01"
+#define SP3_READ_AHEAD        INTERPOLATION_ORDER
+#define MAX_INDEXED_GLUMPHS   1000
+
+typedef struct
+{
+   char magic[8];
+   int64_t sp3_size, sp3_mtime;
+   int32_t freq, glumph0, n_glumphs, unused;
+} sp3_index_header_t;
+
+static uint32_t sp3_offsets[MAX_INDEXED_GLUMPHS];
+
+/* Scans the file for epochs,  starting just after the header.  Returns
+the number of glumphs found,  or -1 if there are too many to index. */
+
+static int build_sp3_index( FILE *ifile, const int freq)
+{
+   const int step = 900 / freq;
+   uint32_t offset = (uint32_t)ftell( ifile);
+   int n_epochs = 0, n_glumphs = 0;
+   char buff[200];
+
+   while( fgets( buff, sizeof( buff), ifile))
+      {
+      if( *buff == '*')
+         {
+         if( n_epochs % step == 0)
+            {
+            if( n_glumphs == MAX_INDEXED_GLUMPHS)
+               return( -1);
+            sp3_offsets[n_glumphs++] = offset;
+            }
+         n_epochs++;
+         }
+      offset += (uint32_t)strlen( buff);
+      }
+   return( n_glumphs);
+}
+
+/* Loads the index for the file into sp3_offsets[],  building it (and
+trying to save it) if there isn't a current one.  'ifile' is positioned
+just after the .sp3 header.  Returns the number of glumphs,  or -1 if
+the file can't be indexed. */
+
+static int get_sp3_index( const char *filename, FILE *ifile,
+                        const int freq, const int glumph0)
+{
+   sp3_index_header_t hdr;
+   struct stat st;
+   char idx_filename[140];
+   FILE *idx_file;
+   int n_glumphs = -1;
+
+   if( stat( filename, &st))
+      return( -1);
+   snprintf( idx_filename, sizeof( idx_filename), "%s.idx", filename);
+   idx_file = fopen( idx_filename, "rb");
+   if( idx_file)
+      {
+      if( fread( &hdr, sizeof( hdr), 1, idx_file) == 1
+               && !memcmp( hdr.magic, SP3_INDEX_MAGIC, 8)
+               && hdr.sp3_size == (int64_t)st.st_size
+               && hdr.sp3_mtime == (int64_t)st.st_mtime
+               && hdr.freq == freq && hdr.glumph0 == glumph0
+               && hdr.n_glumphs > 0 && hdr.n_glumphs <= MAX_INDEXED_GLUMPHS
+               && fread( sp3_offsets, sizeof( uint32_t), hdr.n_glumphs,
+                                 idx_file) == (size_t)hdr.n_glumphs)
+         n_glumphs = hdr.n_glumphs;
+      fclose( idx_file);
+      }
+   if( n_glumphs < 0)
+      {
+      n_glumphs = build_sp3_index( ifile, freq);
+      if( n_glumphs > 0 && (idx_file = fopen( idx_filename, "wb")) != NULL)
+         {
+         memset( &hdr, 0, sizeof( hdr));
+         memcpy( hdr.magic, SP3_INDEX_MAGIC, 8);
+         hdr.sp3_size = (int64_t)st.st_size;
+         hdr.sp3_mtime = (int64_t)st.st_mtime;
+         hdr.freq = freq;
+         hdr.glumph0 = glumph0;
+         hdr.n_glumphs = n_glumphs;
+         if( fwrite( &hdr, sizeof( hdr), 1, idx_file) != 1
+                  || fwrite( sp3_offsets, sizeof( uint32_t), n_glumphs,
+                                       idx_file) != (size_t)n_glumphs)
+            n_glumphs = -1;
+         if( fclose( idx_file) || n_glumphs < 0)
+            unlink( idx_filename);
+         if( gps_verbose)
+            printf( "Index for '%s': %d glumphs\n", filename, n_glumphs);
+         }
+      }
+   return( n_glumphs);
+}
+
+/* Unlike fetch_posns_from_cache( ),  this doesn't count as a use. */
+
+static const cached_posns_t *find_cached_glumph( const int glumph)
+{
+   int i;
+
+   for( i = 0; i < n_cached; i++)
+      if( cache[i]->glumph == glumph)
+         return( cache[i]);
+   return( NULL);
+}
+
+/* The ultra-rapid and five-day products are reissued several times a
+day,  and each issue mostly repeats the epochs of the one before.  So
+each cached glumph carries a hash of the text of its epoch (the '*' line
+and the 'P' lines following it).  When a file is read,  each epoch's
+text is hashed first,  and parsed only if that glumph isn't cached with
+the same hash.  A new issue of a file we've already read (noticed by its
+size or time having changed) thus costs a pass over the text,  but only
+the new or revised epochs get parsed.
+
+   If a glumph is already cached from another file,  the one being read
+replaces it only if it's a newer issue of the same product;  otherwise,
+the first file read wins,  as it always has.  Two files are taken to be
+the same product if their names differ only in digits (that is,  in the
+dates in them),  and the newer issue is the one starting later,  or if
+they start at the same time,  the one written later.  The replaced entry
+stays in memory until its file is evicted.  */
+
+static uint64_t hash_text( uint64_t hash, const char *text)
+{
+   while( *text)        /* FNV-1a */
+      hash = (hash ^ (uint64_t)(unsigned char)*text++) * 0x100000001b3ULL;
+   return( hash);
+}
+
+/* Like read_posns_for_one_glumph( ),  except that the text is hashed
+rather than parsed. */
+
+static int hash_one_glumph( FILE *ifile, uint64_t *hash)
+{
+   char buff[200];
+
+   *hash = 0xcbf29ce484222325ULL;
+   while( fgets( buff, sizeof( buff), ifile))
+      if( *buff == '*')
+         {
+         *hash = hash_text( *hash, buff);
+         while( fgets( buff, sizeof( buff), ifile) && buff[0] == 'P')
+            *hash = hash_text( *hash, buff);
+         fseek( ifile, -strlen( buff), SEEK_CUR);
+         return( 1);
+         }
+   return( 0);
+}
+
+static bool same_product( const char *filename1, const char *filename2)
+{
+   for( ;;)
+      {
+      while( isdigit( *filename1))
+         filename1++;
+      while( isdigit( *filename2))
+         filename2++;
+      if( *filename1 != *filename2)
+         return( false);
+      if( !*filename1)
+         return( true);
+      filename1++;
+      filename2++;
+      }
+}
+
+static bool supersedes( const int file_idx, const int old_file_idx)
+{
+   const cached_file_t *file = cached_files + file_idx;
+   const cached_file_t *old_file = cached_files + old_file_idx;
+
+   if( file_idx == old_file_idx)
+      return( true);
+   if( !same_product( file->filename, old_file->filename))
+      return( false);
+   if( file->glumph_lo != old_file->glumph_lo)
+      return( file->glumph_lo > old_file->glumph_lo);
+   return( file->mtime > old_file->mtime);
+}
+
+static void drop_from_cache( const cached_posns_t *entry)
+{
+   int i;
+
+   for( i = 0; i < n_cached; i++)
+      if( cache[i] == entry)
+         {
+         n_cached--;
+         memmove( cache + i, cache + i + 1,
+                           (n_cached - i) * sizeof( cached_posns_t *));
+         break;
+         }
+   if( sweep)                 /* it may be holding the old positions */
+      sweep->valid = false;
+}
+
+/* Reads a glumph's positions from the current spot in the file,  and
+adds them to the cache,  unless they're there already (see above).
+Returns zero at the end of the file. */
+
+static int cache_one_glumph( FILE *ifile, const int glumph, const int file_idx)
+{
+   const long offset = ftell( ifile);
+   const cached_posns_t *prev = find_cached_glumph( glumph);
+   double locs[MAX_N_GPS_SATS * 3];
+   uint64_t hash;
+
+   if( !hash_one_glumph( ifile, &hash))
+      return( 0);
+   if( prev && (prev->hash == hash || !supersedes( file_idx, prev->file_idx)))
+      return( 1);
+   fseek( ifile, offset, SEEK_SET);
+   read_posns_for_one_glumph( ifile, locs, desigs);
+   if( prev)
+      {
+      if( gps_verbose)
+         printf( "Glumph %d replaced from '%s'\n", glumph,
+                              cached_files[file_idx].filename);
+      drop_from_cache( prev);
+      }
+   add_posns_to_cache( glumph, locs, file_idx);
+   cache[0]->hash = hash;
+   return( 1);
+}
+
+/* Returns positions for the glumph,  reading in the given file if need
+be.  If the file is still in the cache and the glumph is outside the range
+it covers,  there's no point in reading it again,  unless a new issue of
+the file has replaced the one we read.  (If it's within that range,  the
+glumph may have come from a neighboring file that has since been evicted,
+and we do re-read it.)  With 'recheck' set,  a glumph that's already
+cached is returned only if the file hasn't been reissued since. */
+
+static const cached_posns_t *get_cached_posns( const char *filename,
+                                 const int glumph, const bool recheck)
+{
+   const cached_posns_t *rval = fetch_posns_from_cache( glumph);
+   int file_idx = find_cached_file( filename);
+   struct stat st;
+   bool reissued = false;
+
+   if( rval && !recheck)
+      {
+      if( gps_verbose)
+         printf( "Glumph %d found in cache\n", glumph);
+      return( rval);
+      }
+   if( stat( filename, &st))
+      return( rval);
+   if( file_idx >= 0 && cached_files[file_idx].resident)
+      reissued = (cached_files[file_idx].mtime != (int64_t)st.st_mtime
+               || cached_files[file_idx].size != (int64_t)st.st_size);
+   if( rval && !reissued)
+      return( rval);
+   if( reissued && gps_verbose)
+      printf( "New issue of '%s'\n", filename);
+   if( !rval && (file_idx < 0 || !cached_files[file_idx].resident || reissued
+                     || (glumph >= cached_files[file_idx].glumph_lo
+                      && glumph <= cached_files[file_idx].glumph_hi)))
+      rval = get_shared_posns( filename, glumph, &st, &file_idx);
+   else           /* the shared copy can't replace what we've got */
+      rval = NULL;
+   if( !rval && (file_idx < 0 || !cached_files[file_idx].resident || reissued
+                     || (glumph >= cached_files[file_idx].glumph_lo
+                      && glumph <= cached_files[file_idx].glumph_hi)))
+      {
+      FILE *ifile = fopen( filename, "rb");
+
+      if( ifile)
+         {
+         int freq, glumph0 = read_sp3_header( ifile, &freq);
+         const int n_indexed = (shm ? -1 :
+                        get_sp3_index( filename, ifile, freq, glumph0));
+
+         assert( glumph >= glumph0);
+         if( file_idx < 0)
+            file_idx = add_cached_file( filename);
+         else if( !cached_files[file_idx].resident)
+            cache_reloads++;
+         cached_files[file_idx].glumph_lo = glumph0;
+         cached_files[file_idx].mtime = (int64_t)st.st_mtime;
+         cached_files[file_idx].size = (int64_t)st.st_size;
+         cached_files[file_idx].last_checked = time( NULL);
+         cached_files[file_idx].resident = true;
+         cached_files[file_idx].n_loads++;
+         cached_files[file_idx].last_used = ++cache_clock;
+         if( n_indexed > 0)      /* just read what's near 'glumph' */
+            {
+            int lo = glumph - glumph0 - SP3_READ_AHEAD;
+            int hi = glumph - glumph0 + SP3_READ_AHEAD, i;
+
+            if( lo < 0)
+               lo = 0;
+            if( hi > n_indexed - 1)
+               hi = n_indexed - 1;
+            cached_files[file_idx].glumph_hi = glumph0 + n_indexed - 1;
+                     /* for a new issue,  also recheck anything we'd */
+                     /* cached from the old one                      */
+            for( i = (reissued ? 0 : lo); i <= (reissued ? n_indexed - 1 : hi); i++)
+               {
+               const cached_posns_t *prev = find_cached_glumph( glumph0 + i);
+
+               if( i >= lo && i <= hi ? (!prev || reissued)
+                                 : (prev && prev->file_idx == file_idx))
+                  {
+                  fseek( ifile, (long)sp3_offsets[i], SEEK_SET);
+                  cache_one_glumph( ifile, glumph0 + i, file_idx);
+                  }
+               }
+            if( gps_verbose)
+               printf( "Read glumphs %d to %d of '%s'\n", glumph0 + lo,
+                                 glumph0 + hi, filename);
+            }
+         else
+            {
+            fseek( ifile, 0L, SEEK_SET);
+            read_sp3_header( ifile, &freq);
+            while( cache_one_glumph( ifile, glumph0, file_idx))
+               {
+               cached_files[file_idx].glumph_hi = glumph0;
+               glumph0++;
+               if( freq == 300)        /* skip two glumphs */
+                  {
+                  read_posns_for_one_glumph( ifile, NULL, NULL);
+                  read_posns_for_one_glumph( ifile, NULL, NULL);
+                  }
+               }
+            }
+         fclose( ifile);
+         if( n_indexed <= 0)
+            put_file_in_shared_cache( filename, file_idx);
+         evict_files_over_budget( );
+         }
+      rval = fetch_posns_from_cache( glumph);  /* should be in cache now */
+      }
+   return( rval);
+}
+
+static void remove_dot_z( char *filename)
+{
+   char *tptr = strstr( filename, ".Z");
+
+   if( !tptr)
+      tptr = strstr( filename, ".gz");
+   assert( tptr);
+   *tptr = '\0';
+}
+
+/* Days between (year) Jan 1 and 1980 Jan 7 = MJD 44245,  start of the
+GPS ddddy system.  Should return -6 for year=1980,  360 for year=1981. */
+
+static int start_of_year( const int year)
+{
+/* return( 365 * (year - 1980) + (year - 1977) / 4 - 6);    */
+   return( 365 * year  + (year - 1) / 4 - 723200);
+}
+
+/* If possible,  we get positions from the MGEX (Multi-GNSS Experiment)
+files:  see http://mgex.igs.org/ for information about this.  MGEX
+conveniently provides data for (as of early 2021) GPS,  GLONASS,  Galileo,
+BeiDou,  and QZSS satellites.  The file naming conventions changed after
+week 1797,  and we try both GBM (from the University of Potsdam) files
+and WUM (Wuhan University) and SHA (Shanghai?) files.  The last two
+actually extend a bit into the future,  meaning you can sometimes know
+where to look for all five constellations at least slightly ahead of
+time.
+
+   (Note that,  as of December 2024,  the Potsdam files were unavailable.
+They are shut off for the nonce.)
+
+   However,  MGEX provides very limited predictions,  and only goes back
+to early 2012.  Also,  some MGEX files are only available (as best I can
+tell) from the NASA CDDIS site,  which turned off anonymous ftp in early
+2021.  If we can't get an MGEX file,  we use CODE ephems (Center for
+Orbit Determination in Europe),  downloaded from the University of Berne
+in Switzerland.  Unfortunately,  they'll only get you GPS,  GLONASS,  and
+Galileo satellites.  (Though that's usually plenty.)
+
+   And then,  if all else fails,  we go for the IGU ("ultra-rapid") file.
+These give only GPS satellites.  I don't think those will ever actually
+be used.  I think I added them at a time when access to the CODE data
+was sometimes an iffy prospect.
+
+   Note that we can also use TLEs to get approximate positions for
+Galileo,  BeiDou,  and QZSS satellites;  you can then observe those
+objects,  wait for MGEX data to come out,  and then check your results.
+See the get_gps_positions_from_tle( ) function below.
+
+Base URL for the University of Bern files: */
+
+#define UNIBE_BASE_URL "ftp://ftp.aiub.unibe.ch/CODE/"
+
+bool use_mgex_data = true;
+
+/* As of 2018 Jun 9,  the MGEX data actually started in GPS week 1680
+(2012 March 17) and the IGU ("ultra-rapid") predictive CDDIS data in week
+1080 (2000 Sep 16).  I've backed both up by about a year in case other
+data turns up.  This check could be skipped completely,  but I figure this
+avoids a certain amount of requests for files that almost surely do not
+exist.
+
+In a similar vein,  the CODwwwwd.EPH files only come up within a week or
+so of the present,  and the .EPH_5D files start after that and proceed
+a day or two into the future.  So we compute 'curr_day' and compare
+against that,  with some extra margin because the limits appear to vary.
+We'll sometimes check for files that don't actually exist yet/existed
+and have been removed.        */
+
+#define MGEX_START_WEEK 1689
+#define IGU_START_WEEK 1030
+#define UNIBE_COD_START_WEEK 649
+
+/* Looks through the products described above for one covering the
+glumph,  calling try_file( ) for each candidate file (downloading it first
+if 'fetch_files' is set).  It returns whatever try_file( ) returns for the
+first file for which that isn't NULL.  Ordinarily,  try_file( ) reads the
+file into the cache;  the background loader (see below) reads files into
+a separate snapshot instead. */
+
+typedef const void *(*sp3_fn_t)( const char *filename, const int glumph,
+                                                      void *context);
+
+/* 'have_netrc' is read by the background loader as well,  so this is
+called before the loader thread starts (see start_gps_loader( )),  and
+the loader itself never sets it. */
+
+static void check_for_netrc( void)
+{
+   if( have_netrc == -1)         /* haven't checked yet for a .netrc */
+      {
+      FILE *netrc_file = fopen( netrc_filename, "rb");
+
+      if( netrc_file)
+         fclose( netrc_file);
+      have_netrc = (netrc_file ? 1 : 0);
+      }
+}
+
+static const void *find_sp3_file( const int glumph, const bool fetch_files,
+                              sp3_fn_t try_file, void *context)
+{
+   int day = glumph / glumphs_per_day, i;
+   int day_of_year, week = day / 7;
+   char filename[125], command[200];
+   const void *rval;
+   const int curr_day = (int)( time( NULL) / 86400) - 3658;
+
+   i = 1980;
+   while( i < 2200 && start_of_year( i + 1) < day)
+      i++;
+   day_of_year = day - start_of_year( i);
+   if( use_mgex_data && day > MGEX_START_WEEK * 7 && day < curr_day + 4)
+      {
+      int pass;
+      const char *suffix = (day < curr_day - 28 ? "" : "_IGS20");
+
+      if( week >= 1797)                /* roughly after June 2014 */
+         {
+         if( week < 2081)
+            snprintf( filename, sizeof( filename), "gbm%04d%d.sp3.Z",
+                                         week, day % 7);
+         else
+            snprintf( filename, sizeof( filename), "GBM0MGXRAP_%d%03d0000_01D_05M_ORB.SP3.gz",
+                           i, day_of_year);
+         }
+      snprintf( command, sizeof( command),
+               "ftp://ftp.gfz-potsdam.de/GNSS/products/mgex/%4d%s/%s",
+               week, suffix, filename);
+      insert_data_path( filename);
+#ifdef GFZ_POTSDAM
+      if( gps_verbose)
+         printf( "MGEX (multi-GNSS) file: '%s', %d %d: '%s'\n", filename, glumph,
+                glumph - day * glumphs_per_day, command);
+      if( fetch_files)
+         try_to_download( command, filename);
+#endif
+      remove_dot_z( filename);
+      rval = try_file( filename, glumph, context);
+      check_for_netrc( );
+      for( pass = (have_netrc ? 0 : 1); !rval && pass < 4; pass++)
+         {           /* try CDDIS,  WUM (Wuhan) & SHA files */
+         if( !pass)
+            {
+            snprintf( filename, sizeof( filename),
+                  "GFZ0OPSULT_%d%d0000_02D_05M_ORB.SP3.gz", i, day_of_year);
+            snprintf( command, sizeof( command),
+                   "https://cddis.nasa.gov/archive/gnss/products/%4d/%s",
+                   week, filename);
+            }
+         else
+            {                 /* WUM (Wuhan) & SHA (Shanghai?) from IGS */
+            const char *paths[3] = { "SHA0MGXULT", "WUM0MGXFIN", "WUM0MGXRAP" };
+
+            snprintf( filename, sizeof( filename), "%s_%d%03d0000_01D_05M_ORB.SP3.gz",
+                     paths[pass - 1], i, day_of_year);
+            snprintf( command, sizeof( command),
+                  "ftp://igs.ign.fr/pub/igs/products/%4d/%s",
+                  week, filename);
+            }
+         insert_data_path( filename);
+         if( gps_verbose)
+            printf( "MGEX (multi-GNSS) file: '%s', %d %d: '%s'\n", filename, glumph,
+                glumph - day * glumphs_per_day, command);
+         if( fetch_files)
+            try_to_download( command, filename);
+         remove_dot_z( filename);
+         rval = try_file( filename, glumph, context);
+         }
+      if( rval)
+         return( rval);
+      }
+
+#ifdef UNIBE_BASE_URL
+   if( week >= UNIBE_COD_START_WEEK && day <= curr_day + 1)
+      {
+      if( i < 2023)
+         snprintf( filename, sizeof( filename), "COD%04d%d.EPH.Z", week, day % 7);
+      else
+         snprintf( filename, sizeof( filename), "COD0OPSFIN_%d%03d0000_01D_05M_ORB.SP3.gz",
+                                    i, day_of_year);
+      snprintf( command, sizeof( command), UNIBE_BASE_URL "%4d/%s", i, filename);
+      insert_data_path( filename);
+      if( gps_verbose)
+         printf( "Final file: '%s', %d %d: '%s'\n", filename, glumph,
+               glumph - day * glumphs_per_day, command);
+      if( fetch_files)
          try_to_download( command, filename);
+      remove_dot_z( filename);
+      rval = try_file( filename, glumph, context);
+      if( rval)
+         return( rval);
+
+      snprintf( filename, sizeof( filename), "COD%04d%d.EPH_R", week, day % 7);
+      snprintf( command, sizeof( command), UNIBE_BASE_URL "%s", filename);
+      insert_data_path( filename);
+      if( gps_verbose)
+         printf( "Rapid file: '%s', %d %d: '%s'\n", filename, glumph,
+               glumph - day * glumphs_per_day, command);
+      if( fetch_files)
+         try_to_download( command, filename);
+      rval = try_file( filename, glumph, context);
+      }
+
+   for( i = 0; !rval && i < 5; i++, day--)
+      if( day > curr_day - 20 && day < curr_day + 3)
+         {
+         snprintf( filename, sizeof( filename), "COD%04d%d.EPH_5D",
+                        day / 7, day % 7);
+         snprintf( command, sizeof( command), UNIBE_BASE_URL "%s", filename);
+         insert_data_path( filename);
+         if( gps_verbose)
+             printf("Five-day file: '%s', %d %d: '%s'\n", filename, glumph,
+               glumph - day * glumphs_per_day, command);
+         if( fetch_files)
+            try_to_download( command, filename);
+         rval = try_file( filename, glumph, context);
+         if( gps_verbose)
+            printf( "try_file: %p\n", rval);
+         }
+#endif         /* #ifdef UNIBE_BASE_URL */
+   return( rval);
+}
+
+/* find_sp3_file( ) works out,  glumph by glumph,  which of the products
+wins,  probing for files as it goes;  and each process does that for
+itself.  write_merged_gps_day( ) (see 'merge_gps.cpp') does it once,  ahead
+of time,  for a whole day.  It tries every file find_sp3_file( ) would
+look at,  in the same order,  and takes each satellite's positions from
+the first file having them.  (So a satellite missing from the MGEX file
+can still be had from the CODE files.)  The result goes to a binary file
+per GPS day,  named for the GPS week and day of the week,  which is used
+in preference to all the others if it exists.  The file is :
+
+   merged_header_t header;
+   char sources[header.n_sources][MERGED_SOURCE_LEN];
+   char desigs[header.n_sats][4];
+   uint8_t source[header.n_glumphs][header.n_sats];
+   (zero padding to a multiple of eight bytes)
+   double posns[header.n_glumphs][header.n_sats][3];
+
+   'sources' are the names of the files used,  in order of precedence,
+and 'source' gives the one each satellite's position came from at each
+glumph,  or MERGED_NO_SOURCE if none had it (in which case the position
+is zeroes).  As with 'finals.bin',  integers and doubles are in the byte
+order of the machine that wrote the file.   */
+
+#define MERGED_MAGIC          "GNSSmrg1"
+#define MERGED_SOURCE_LEN     64
+#define MERGED_NO_SOURCE      255
+
+typedef struct
+{
+   char magic[8];
+   int32_t glumph0, n_glumphs;
+   int32_t n_sats, n_sources;
+} merged_header_t;
+
+static void merged_filename( char *filename, const int day)
+{
+   sprintf( filename, "gnss%04d%d.mrg", day / 7, day % 7);
+   insert_data_path( filename);
+}
+
+/* For reprocessing,  we keep positions going back years,  and as .sp3
+files (even gzipped),  that's a lot of disk and slow to search.  So
+archive_gps_days( ) (see 'merge_gps.cpp') can also put merged days into
+'gnss.arc',  which is read if there's no merged file for the day.  The
+archive is :
+
+   archive_header_t header;
+   int64_t offsets[header.n_days + 1];
+   (blocks)
+
+   Block i,  for day header.day0 + i,  runs from offsets[i] to offsets[i+1]
+(if they're equal,  there's no data for that day).  So the positions for
+any given time are found by reading two offsets and one block.
+
+   A block holds what a merged file does,  compressed.  Positions are
+stored as integer millimeters,  the resolution of the .sp3 files,  so
+they come back exactly as they were read.  Along each satellite's track,
+each coordinate is predicted by a polynomial through the ones before it,
+and just the residual is stored,  as a variable-length integer (see
+put_varint( )).  The degree of the polynomial is chosen for each
+satellite to make the residuals smallest;  for GPS satellites,  with
+glumphs a quarter-hour apart,  they usually take two bytes.  A block is
+
+   varint n_sources;  then for each,  varint length and that many bytes
+   varint n_sats;  then for each satellite :
+      char desig[3];
+      uint8_t order;             (of the predicting polynomial)
+      uint8_t present[(glumphs_per_day + 7) / 8];   (a bitmap)
+      varint n_runs;  then for each,  varint length and varint source
+            (the source for each glumph present,  run-length encoded)
+      for x,  y,  and z,  a zigzag varint residual for each glumph present
+
+   Prediction restarts after each gap in the track,  at first with a
+lower-order polynomial through however many points there are. */
+
+#define ARCHIVE_MAGIC         "GNSSarc1"
+#define ARCHIVE_MAX_ORDER     12
+#define ARCHIVE_MAX_BLOCK     (1024 * 1024)
+
+typedef struct
+{
+   char magic[8];
+   int32_t day0, n_days;         /* days since 1980 Jan 6 */
+} archive_header_t;
+
+static void archive_filename( char *filename)
+{
+   strcpy( filename, "gnss.arc");
+   insert_data_path( filename);
+}
+
+/* Opens the archive and finds where the block for the day is.  Returns
+NULL if there's no archive or it lacks the day. */
+
+static FILE *find_archived_day( const int day, int64_t *offsets)
+{
+   char filename[125];
+   archive_header_t hdr;
+   FILE *ifile;
+
+   archive_filename( filename);
+   ifile = fopen( filename, "rb");
+   if( !ifile)
+      return( NULL);
+   if( fread( &hdr, sizeof( hdr), 1, ifile) == 1
+            && !memcmp( hdr.magic, ARCHIVE_MAGIC, 8)
+            && day >= hdr.day0 && day < hdr.day0 + hdr.n_days
+            && !fseek( ifile, (long)( sizeof( hdr)
+                           + (day - hdr.day0) * sizeof( int64_t)), SEEK_SET)
+            && fread( offsets, sizeof( int64_t), 2, ifile) == 2
+            && offsets[1] > offsets[0]
+            && offsets[1] - offsets[0] <= ARCHIVE_MAX_BLOCK)
+      return( ifile);
+   fclose( ifile);
+   return( NULL);
+}
+
+/* Sets 'key' to the name under which the positions for the day are
+cached if they come from a merged file or the archive:  the merged file,
+if there is one,  else the archive's name followed by '#' and the day.
+Returns false if there's neither. */
+
+static bool merged_day_source( const int day, char *key, struct stat *st)
+{
+   FILE *ifile;
+   int64_t offsets[2];
+
+   merged_filename( key, day);
+   if( !stat( key, st))
+      return( true);
+   ifile = find_archived_day( day, offsets);
+   if( !ifile)
+      return( false);
+   fclose( ifile);
+   archive_filename( key);
+   stat( key, st);
+   sprintf( key + strlen( key), "#%d", day);
+   return( true);
+}
+
+/* Queries for today shouldn't have to wait while tomorrow's file is
+downloaded and parsed.  load_gps_positions_in_background( ) starts a
+thread that finds (and,  if need be,  downloads) the files covering a
+given day,  and parses each into a loaded_file_t 'snapshot' of its own.
+The loader doesn't touch the cache,  the satellite index table,  or
+anything else the querying thread uses;  a snapshot has its own table of
+designations.
+
+   Finished snapshots are pushed onto 'loaded_files' with an atomic
+compare-and-swap.  On a cache miss,  the querying thread takes the whole
+list with an atomic exchange and copies the snapshots into the cache (see
+get_tabulated_gps_posns( )).  A snapshot is never touched by the loader
+after it's pushed,  and it's freed by whoever took it,  so there's no
+question of when memory can be reclaimed.  Neither thread waits for the
+other,  except that downloads are serialized (try_to_download( ) keeps
+its statistics in globals),  and free_cached_gps_positions( ) waits for a
+running loader to finish.  Cache hits never look at the list at all. */
+
+typedef struct loaded_file
+{
+   struct loaded_file *next;
+   char filename[125];
+   int glumph_lo, n_glumphs;
+   int64_t mtime, size;
+   bool wanted;
+   char desigs[MAX_N_GPS_SATS][4];
+   double *posns;             /* n_glumphs * MAX_N_GPS_SATS * 3 */
+} loaded_file_t;
+
+#define LOADER_IDLE        0
+#define LOADER_RUNNING     1
+#define LOADER_DONE        2
+
+static int loader_state = LOADER_IDLE, loader_glumph_lo, loader_glumph_hi;
+
+static loaded_file_t *load_file_snapshot( const char *filename)
+{
+   FILE *ifile = fopen( filename, "r");
+   double locs[MAX_N_GPS_SATS * 3];
+   loaded_file_t *rval;
+   struct stat st;
+   int freq, n_alloced = 0;
+
+   if( !ifile)
+      return( NULL);
+   rval = (loaded_file_t *)calloc( 1, sizeof( loaded_file_t));
+   assert( rval);
+   snprintf( rval->filename, sizeof( rval->filename), "%s", filename);
+   if( !fstat( fileno( ifile), &st))
+      {
+      rval->mtime = (int64_t)st.st_mtime;
+      rval->size = (int64_t)st.st_size;
+      }
+   rval->glumph_lo = read_sp3_header( ifile, &freq);
+   while( read_posns_for_one_glumph( ifile, locs, rval->desigs))
+      {
+      if( rval->n_glumphs == n_alloced)
+         {
+         n_alloced += glumphs_per_day;
+         rval->posns = (double *)realloc( rval->posns, n_alloced * sizeof( locs));
+         assert( rval->posns);
+         }
+      memcpy( rval->posns + rval->n_glumphs * MAX_N_GPS_SATS * 3, locs,
+                                 sizeof( locs));
+      rval->n_glumphs++;
+      if( freq == 300)        /* skip two glumphs */
+         {
+         read_posns_for_one_glumph( ifile, NULL, NULL);
+         read_posns_for_one_glumph( ifile, NULL, NULL);
+         }
+      }
+   fclose( ifile);
+   return( rval);
+}
+
+static void free_loaded_files( loaded_file_t *tptr)
+{
+   while( tptr)
+      {
+      loaded_file_t *next = tptr->next;
+
+      free( tptr->posns);
+      free( tptr);
+      tptr = next;
+      }
+}
+
+/* 'context' is the list of files read so far by this loader run,  so
+each is read only once. */
+
+static const void *try_file_in_background( const char *filename,
+                                  const int glumph, void *context)
+{
+   loaded_file_t **done = (loaded_file_t **)context, *tptr;
+
+   for( tptr = *done; tptr; tptr = tptr->next)
+      if( !strcmp( tptr->filename, filename))
+         break;
+   if( !tptr && (tptr = load_file_snapshot( filename)) != NULL)
+      {
+      tptr->next = *done;
+      *done = tptr;
+      }
+   if( tptr && glumph >= tptr->glumph_lo
+            && glumph < tptr->glumph_lo + tptr->n_glumphs)
+      return( tptr);
+   return( NULL);
+}
+
+#ifndef _WIN32
+static void *background_loader( void *)
+{
+   loaded_file_t *done = NULL;
+   char key[140];
+   struct stat st;
+   bool have_merged = false;
+   int glumph;
+
+   for( glumph = loader_glumph_lo; glumph <= loader_glumph_hi; glumph++)
+      {
+      loaded_file_t *tptr;
+
+      if( glumph == loader_glumph_lo || !(glumph % glumphs_per_day))
+         have_merged = merged_day_source( glumph / glumphs_per_day, key, &st);
+      if( have_merged)        /* quick to load when it's wanted */
+         continue;
+      for( tptr = done; tptr; tptr = tptr->next)
+         if( tptr->wanted && glumph >= tptr->glumph_lo
+                  && glumph < tptr->glumph_lo + tptr->n_glumphs)
+            break;
+      if( !tptr)
+         {
+         tptr = (loaded_file_t *)find_sp3_file( glumph, true,
+                                    try_file_in_background, &done);
+         if( tptr)
+            tptr->wanted = true;
+         }
+      }
+   while( done)
+      {
+      loaded_file_t *next = done->next;
+
+      if( done->wanted)
+         {
+         done->next = __atomic_load_n( &loaded_files, __ATOMIC_RELAXED);
+         while( !__atomic_compare_exchange_n( &loaded_files, &done->next, done,
+                          false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+         }
+      else
+         {
+         done->next = NULL;
+         free_loaded_files( done);
+         }
+      done = next;
+      }
+   __atomic_store_n( &loader_state, LOADER_DONE, __ATOMIC_RELEASE);
+   return( NULL);
+}
+
+static pthread_t loader_thread;
+
+void wait_for_gps_loader( void)
+{
+   if( __atomic_load_n( &loader_state, __ATOMIC_ACQUIRE) != LOADER_IDLE)
+      {
+      pthread_join( loader_thread, NULL);
+      loader_state = LOADER_IDLE;
+      }
+}
+
+/* Starts loading glumphs glumph_lo to glumph_hi in the background.
+Returns 0 if the loader was started,  -1 if it's still busy with earlier
+ones,  -2 if the thread couldn't be started. */
+
+static int start_gps_loader( const int glumph_lo, const int glumph_hi)
+{
+   static bool curl_initialized = false;
+
+   if( __atomic_load_n( &loader_state, __ATOMIC_ACQUIRE) == LOADER_RUNNING)
+      return( -1);
+   wait_for_gps_loader( );
+   if( !curl_initialized)     /* not thread-safe,  so do it here */
+      {
+      curl_global_init( CURL_GLOBAL_DEFAULT);
+      curl_initialized = true;
+      }
+   check_for_netrc( );
+   loader_glumph_lo = glumph_lo;
+   loader_glumph_hi = glumph_hi;
+   loader_state = LOADER_RUNNING;
+   if( pthread_create( &loader_thread, NULL, background_loader, NULL))
+      {
+      loader_state = LOADER_IDLE;
+      return( -2);
+      }
+   return( 0);
+}
+
+/* Starts loading the day containing 'mjd_gps' in the background.
+Returns values as for start_gps_loader( ). */
+
+int load_gps_positions_in_background( const double mjd_gps)
+{
+   const int day = (int)floor( mjd_gps - GPS_SYSTEM_START);
+
+   return( start_gps_loader( day * glumphs_per_day,
+                             day * glumphs_per_day + glumphs_per_day - 1));
+}
+
+bool is_gps_loader_running( void)
+{
+   return( __atomic_load_n( &loader_state, __ATOMIC_ACQUIRE) == LOADER_RUNNING);
+}
+#else
+void wait_for_gps_loader( void)
+{
+}
+
+static int start_gps_loader( const int, const int)
+{
+   return( -2);            /* no threads here (yet) */
+}
+
+int load_gps_positions_in_background( const double)
+{
+   return( -2);
+}
+
+bool is_gps_loader_running( void)
+{
+   return( false);
+}
 #endif
-      remove_dot_z( filename);
-      rval = get_cached_posns( filename, glumph);
-      if( have_netrc == -1)         /* haven't checked yet for a .netrc */
+
+/* Copies any snapshots the loader has finished into the cache,  except
+for files that are already there.  Returns true if anything was added. */
+
+static bool adopt_loaded_files( void)
+{
+   loaded_file_t *list = __atomic_exchange_n( &loaded_files, NULL,
+                                                   __ATOMIC_ACQUIRE);
+   loaded_file_t *tptr;
+   bool rval = false;
+
+   for( tptr = list; tptr; tptr = tptr->next)
+      {
+      int file_idx = find_cached_file( tptr->filename);
+
+      if( file_idx < 0 || !cached_files[file_idx].resident)
+         {
+         double locs[MAX_N_GPS_SATS * 3];
+         int idx[MAX_N_GPS_SATS], n_sats, i, j;
+
+         for( n_sats = 0; n_sats < MAX_N_GPS_SATS && tptr->desigs[n_sats][0];
+                        n_sats++)
+            idx[n_sats] = desig_to_index( tptr->desigs[n_sats]);
+         if( file_idx < 0)
+            file_idx = add_cached_file( tptr->filename);
+         else
+            cache_reloads++;
+         cached_files[file_idx].glumph_lo = tptr->glumph_lo;
+         cached_files[file_idx].glumph_hi = tptr->glumph_lo + tptr->n_glumphs - 1;
+         cached_files[file_idx].mtime = tptr->mtime;
+         cached_files[file_idx].size = tptr->size;
+         cached_files[file_idx].last_checked = time( NULL);
+         cached_files[file_idx].resident = true;
+         cached_files[file_idx].n_loads++;
+         cached_files[file_idx].last_used = ++cache_clock;
+         for( i = 0; i < tptr->n_glumphs; i++)
+            if( !find_cached_glumph( tptr->glumph_lo + i))
+               {
+               const double *posns = tptr->posns + i * MAX_N_GPS_SATS * 3;
+
+               memset( locs, 0, sizeof( locs));
+               for( j = 0; j < n_sats; j++)
+                  memcpy( locs + idx[j] * 3, posns + j * 3, 3 * sizeof( double));
+               add_posns_to_cache( tptr->glumph_lo + i, locs, file_idx);
+               }
+         put_file_in_shared_cache( tptr->filename, file_idx);
+         n_background_loads++;
+         rval = true;
+         }
+      }
+   free_loaded_files( list);
+   if( rval)
+      evict_files_over_budget( );
+   return( rval);
+}
+
+static const void *try_cached_file( const char *filename, const int glumph,
+                                                      void *)
+{
+   return( get_cached_posns( filename, glumph, false));
+}
+
+/* A day's merged positions,  as written to or read from a merged file or
+the archive.  source[][j] and posns[][j] are for satellite desigs[j]. */
+
+typedef struct
+{
+   int glumph0, n_sats, n_sources;
+   char desigs[MAX_N_GPS_SATS][4];
+   char sources[MERGED_NO_SOURCE][MERGED_SOURCE_LEN];
+   uint8_t source[glumphs_per_day][MAX_N_GPS_SATS];
+   double posns[glumphs_per_day][MAX_N_GPS_SATS][3];
+} merged_day_t;
+
+static merged_day_t *alloc_merged_day( void)
+{
+   merged_day_t *rval = (merged_day_t *)calloc( 1, sizeof( merged_day_t));
+
+   assert( rval);
+   n_heap_allocs++;
+   return( rval);
+}
+
+static size_t merged_data_offset( const merged_header_t *hdr)
+{
+   return( SHM_ALIGN( sizeof( merged_header_t)
+               + hdr->n_sources * MERGED_SOURCE_LEN + hdr->n_sats * 4
+               + hdr->n_glumphs * hdr->n_sats));
+}
+
+/* Reads the header,  sources,  designations,  and source table of a
+merged file,  checking that they make sense and that the file is the
+right size for them.  The caller frees '*sources'. */
+
+static FILE *open_merged_file( const char *filename, merged_header_t *hdr,
+                                 char **sources)
+{
+   FILE *ifile = fopen( filename, "rb");
+   size_t n_bytes;
+
+   *sources = NULL;
+   if( !ifile)
+      return( NULL);
+   if( fread( hdr, sizeof( merged_header_t), 1, ifile) == 1
+            && !memcmp( hdr->magic, MERGED_MAGIC, 8)
+            && hdr->n_glumphs == glumphs_per_day
+            && hdr->n_sats > 0 && hdr->n_sats <= MAX_N_GPS_SATS
+            && hdr->n_sources > 0 && hdr->n_sources < MERGED_NO_SOURCE)
+      {
+      n_bytes = merged_data_offset( hdr) - sizeof( merged_header_t);
+      *sources = (char *)malloc( n_bytes);
+      assert( *sources);
+      if( fread( *sources, n_bytes, 1, ifile) == 1
+               && !fseek( ifile, 0L, SEEK_END)
+               && (size_t)ftell( ifile) == merged_data_offset( hdr)
+                     + hdr->n_glumphs * hdr->n_sats * 3 * sizeof( double)
+               && !fseek( ifile, (long)merged_data_offset( hdr), SEEK_SET))
+         return( ifile);
+      free( *sources);
+      *sources = NULL;
+      }
+   fclose( ifile);
+   return( NULL);
+}
+
+static int read_merged_file( const char *filename, merged_day_t *mday)
+{
+   merged_header_t hdr;
+   char *sources;
+   FILE *ifile = open_merged_file( filename, &hdr, &sources);
+   const char *sat_desigs, *source;
+   int i, j, rval = 0;
+
+   if( !ifile)
+      return( -1);
+   sat_desigs = sources + hdr.n_sources * MERGED_SOURCE_LEN;
+   source = sat_desigs + hdr.n_sats * 4;
+   mday->glumph0 = hdr.glumph0;
+   mday->n_sats = hdr.n_sats;
+   mday->n_sources = hdr.n_sources;
+   memcpy( mday->sources, sources, hdr.n_sources * MERGED_SOURCE_LEN);
+   memcpy( mday->desigs, sat_desigs, hdr.n_sats * 4);
+   for( i = 0; i < glumphs_per_day && !rval; i++)
+      {
+      memcpy( mday->source[i], source + i * hdr.n_sats, hdr.n_sats);
+      if( fread( mday->posns[i], 3 * sizeof( double), hdr.n_sats, ifile)
+                        != (size_t)hdr.n_sats)
+         rval = -1;
+      for( j = 0; j < hdr.n_sats; j++)
+         if( mday->source[i][j] >= hdr.n_sources)
+            mday->source[i][j] = MERGED_NO_SOURCE;
+      }
+   fclose( ifile);
+   free( sources);
+   return( rval);
+}
+
+static int write_merged_file( const merged_day_t *mday, const char *filename)
+{
+   const char zeroes[8] = { 0 };
+   char temp_name[130];
+   merged_header_t hdr;
+   FILE *ofile;
+   int i, rval;
+
+   memset( &hdr, 0, sizeof( hdr));
+   memcpy( hdr.magic, MERGED_MAGIC, 8);
+   hdr.glumph0 = mday->glumph0;
+   hdr.n_glumphs = glumphs_per_day;
+   hdr.n_sats = mday->n_sats;
+   hdr.n_sources = mday->n_sources;
+   snprintf( temp_name, sizeof( temp_name), "%s.tmp", filename);
+   ofile = fopen( temp_name, "wb");
+   if( !ofile)
+      return( -2);
+   fwrite( &hdr, sizeof( hdr), 1, ofile);
+   fwrite( mday->sources, MERGED_SOURCE_LEN, mday->n_sources, ofile);
+   fwrite( mday->desigs, 4, mday->n_sats, ofile);
+   for( i = 0; i < glumphs_per_day; i++)
+      fwrite( mday->source[i], 1, mday->n_sats, ofile);
+   fwrite( zeroes, 1, merged_data_offset( &hdr) - (size_t)ftell( ofile), ofile);
+   for( i = 0; i < glumphs_per_day; i++)
+      fwrite( mday->posns[i], 3 * sizeof( double), mday->n_sats, ofile);
+   rval = (fclose( ofile) ? -2 : 0);
+   if( rval)
+      unlink( temp_name);
+   else
+      {
+      unlink( filename);
+      rename( temp_name, filename);
+      }
+   return( rval);
+}
+
+/* Variable-length integers,  seven bits to the byte,  low bits first;
+the high bit is set in all but the last byte.  Signed values are
+'zigzagged' first (0, -1, 1, -2, 2... become 0, 1, 2, 3, 4...),  so that
+small negative values are short too. */
+
+static unsigned char *put_varint( unsigned char *optr, uint64_t ival)
+{
+   while( ival >= 0x80)
+      {
+      *optr++ = (unsigned char)( ival | 0x80);
+      ival >>= 7;
+      }
+   *optr++ = (unsigned char)ival;
+   return( optr);
+}
+
+typedef struct
+{
+   const unsigned char *ptr, *end;
+   bool err;
+} varint_reader_t;
+
+static uint64_t get_varint( varint_reader_t *reader)
+{
+   uint64_t rval = 0;
+   int shift;
+
+   for( shift = 0; reader->ptr < reader->end && shift < 64; shift += 7)
+      {
+      const unsigned char byte = *reader->ptr++;
+
+      rval |= (uint64_t)( byte & 0x7f) << shift;
+      if( !(byte & 0x80))
+         return( rval);
+      }
+   reader->err = true;
+   return( 0);
+}
+
+static uint64_t zigzag( const int64_t ival)
+{
+   return( ((uint64_t)ival << 1) ^ (uint64_t)( ival >> 63));
+}
+
+static int64_t unzigzag( const uint64_t ival)
+{
+   return( (int64_t)( ival >> 1) ^ -(int64_t)( ival & 1));
+}
+
+/* Extrapolates x[0] from x[-1],  x[-2],  ... x[-order] with a polynomial
+of degree order - 1.  (The coefficients are those for the order'th
+difference,  which is zero for such a polynomial.) */
+
+static int64_t predict( const int64_t *x, const int order)
+{
+   int64_t rval = 0, coeff = 1;
+   int j;
+
+   for( j = 1; j <= order; j++)
+      {
+      coeff = coeff * (order - j + 1) / j;
+      rval += (j & 1 ? coeff : -coeff) * x[-j];
+      }
+   return( rval);
+}
+
+static unsigned char *encode_series( unsigned char *optr, const int64_t *x,
+                              const bool *present, const int order)
+{
+   int i, run = 0;
+
+   for( i = 0; i < glumphs_per_day; i++)
+      if( !present[i])
+         run = 0;
+      else
+         {
+         optr = put_varint( optr, zigzag( x[i]
+                              - predict( x + i, (run < order ? run : order))));
+         run++;
+         }
+   return( optr);
+}
+
+static void decode_series( varint_reader_t *reader, int64_t *x,
+                              const bool *present, const int order)
+{
+   int i, run = 0;
+
+   for( i = 0; i < glumphs_per_day; i++)
+      if( !present[i])
+         run = 0;
+      else
+         {
+         x[i] = unzigzag( get_varint( reader))
+                              + predict( x + i, (run < order ? run : order));
+         run++;
+         }
+}
+
+/* Encodes the day as described above,  returning the size of the block. */
+
+static size_t encode_archive_block( unsigned char *block,
+                                          const merged_day_t *mday)
+{
+   unsigned char *optr = put_varint( block, mday->n_sources);
+   int i, j, k;
+
+   for( i = 0; i < mday->n_sources; i++)
+      {
+      const size_t len = strlen( mday->sources[i]);
+
+      optr = put_varint( optr, len);
+      memcpy( optr, mday->sources[i], len);
+      optr += len;
+      }
+   optr = put_varint( optr, mday->n_sats);
+   for( j = 0; j < mday->n_sats; j++)
+      {
+      int64_t x[3][glumphs_per_day];
+      bool present[glumphs_per_day];
+      unsigned char scratch[glumphs_per_day * 3 * 10], *runs_ptr, *order_ptr;
+      size_t best_size = (size_t)-1;
+      int order, best_order = 0, n_runs = 0;
+
+      memcpy( optr, mday->desigs[j], 3);
+      order_ptr = optr + 3;      /* filled in below */
+      optr += 4;
+      memset( optr, 0, (glumphs_per_day + 7) / 8);
+      for( i = 0; i < glumphs_per_day; i++)
+         {
+         present[i] = (mday->source[i][j] != MERGED_NO_SOURCE);
+         if( present[i])
+            optr[i >> 3] |= (unsigned char)( 1 << (i & 7));
+         for( k = 0; k < 3; k++)
+            x[k][i] = (int64_t)floor( mday->posns[i][j][k] * 1e+6 + .5);
+         }
+      optr += (glumphs_per_day + 7) / 8;
+      for( i = 0; i < glumphs_per_day; i++)
+         if( present[i] && (!n_runs
+                     || mday->source[i][j] != mday->source[i - 1][j]))
+            n_runs++;
+      optr = put_varint( optr, n_runs);
+      runs_ptr = optr;
+      for( i = 0; i < glumphs_per_day; i++)
+         if( present[i])
+            {
+            int len = 1;
+
+            while( i + len < glumphs_per_day && present[i + len]
+                     && mday->source[i + len][j] == mday->source[i][j])
+               len++;
+            runs_ptr = put_varint( runs_ptr, len);
+            runs_ptr = put_varint( runs_ptr, mday->source[i][j]);
+            i += len - 1;
+            }
+      optr = runs_ptr;
+      for( order = 0; order <= ARCHIVE_MAX_ORDER; order++)
+         {
+         unsigned char *end = scratch;
+
+         for( k = 0; k < 3; k++)
+            end = encode_series( end, x[k], present, order);
+         if( (size_t)( end - scratch) < best_size)
+            {
+            best_size = (size_t)( end - scratch);
+            best_order = order;
+            }
+         }
+      *order_ptr = (unsigned char)best_order;
+      for( k = 0; k < 3; k++)
+         optr = encode_series( optr, x[k], present, best_order);
+      }
+   return( (size_t)( optr - block));
+}
+
+/* Reads the list of sources at the start of a block into 'sources' (if
+it's non-NULL),  returning how many there are or -1 on error. */
+
+static int decode_archived_sources( varint_reader_t *reader,
+                              char (*sources)[MERGED_SOURCE_LEN])
+{
+   const int n_sources = (int)get_varint( reader);
+   int i;
+
+   if( n_sources <= 0 || n_sources >= MERGED_NO_SOURCE)
+      return( -1);
+   for( i = 0; i < n_sources; i++)
+      {
+      const size_t len = (size_t)get_varint( reader);
+
+      if( reader->err || len >= MERGED_SOURCE_LEN
+                     || len > (size_t)( reader->end - reader->ptr))
+         return( -1);
+      if( sources)
+         {
+         memset( sources[i], 0, MERGED_SOURCE_LEN);
+         memcpy( sources[i], reader->ptr, len);
+         }
+      reader->ptr += len;
+      }
+   return( n_sources);
+}
+
+/* Decodes the next satellite in the block,  setting its designation and
+the source and position for each glumph of the day. */
+
+static int decode_archived_sat( varint_reader_t *reader, const int n_sources,
+               char *desig, uint8_t *source, double (*posns)[3])
+{
+   const size_t bitmap_len = (glumphs_per_day + 7) / 8;
+   int64_t x[3][glumphs_per_day];
+   bool present[glumphs_per_day];
+   int i, k, order, n_runs;
+
+   if( reader->end - reader->ptr < (ptrdiff_t)( 4 + bitmap_len))
+      return( -1);
+   memcpy( desig, reader->ptr, 3);
+   desig[3] = '\0';
+   order = reader->ptr[3];
+   if( order > ARCHIVE_MAX_ORDER)
+      return( -1);
+   for( i = 0; i < glumphs_per_day; i++)
+      {
+      present[i] = ((reader->ptr[4 + (i >> 3)] >> (i & 7)) & 1);
+      source[i] = MERGED_NO_SOURCE;
+      }
+   reader->ptr += 4 + bitmap_len;
+   n_runs = (int)get_varint( reader);
+   for( i = 0; n_runs-- > 0 && !reader->err; )
+      {
+      int len = (int)get_varint( reader);
+      const int src = (int)get_varint( reader);
+
+      if( src >= n_sources)
+         return( -1);
+      while( i < glumphs_per_day && !present[i])
+         i++;
+      while( len-- > 0 && i < glumphs_per_day && present[i])
+         source[i++] = (uint8_t)src;
+      }
+   for( k = 0; k < 3; k++)
+      decode_series( reader, x[k], present, order);
+   for( i = 0; i < glumphs_per_day; i++)
+      for( k = 0; k < 3; k++)
+         posns[i][k] = (present[i] ? (double)x[k][i] / 1e+6 : 0.);
+   return( reader->err ? -1 : 0);
+}
+
+static int decode_archive_block( const unsigned char *block,
+                           const size_t n_bytes, merged_day_t *mday)
+{
+   varint_reader_t reader;
+   int i, j;
+
+   reader.ptr = block;
+   reader.end = block + n_bytes;
+   reader.err = false;
+   mday->n_sources = decode_archived_sources( &reader, mday->sources);
+   if( mday->n_sources < 0)
+      return( -1);
+   mday->n_sats = (int)get_varint( &reader);
+   if( reader.err || mday->n_sats <= 0 || mday->n_sats > MAX_N_GPS_SATS)
+      return( -1);
+   for( j = 0; j < mday->n_sats; j++)
+      {
+      uint8_t source[glumphs_per_day];
+      double posns[glumphs_per_day][3];
+
+      if( decode_archived_sat( &reader, mday->n_sources, mday->desigs[j],
+                                    source, posns))
+         return( -1);
+      for( i = 0; i < glumphs_per_day; i++)
+         {
+         mday->source[i][j] = source[i];
+         memcpy( mday->posns[i][j], posns[i], 3 * sizeof( double));
+         }
+      }
+   return( 0);
+}
+
+/* Reads the archive's block for the day;  the caller frees it.  Returns
+NULL if the archive lacks the day. */
+
+static unsigned char *read_archive_block( const int day, size_t *n_bytes)
+{
+   int64_t offsets[2];
+   FILE *ifile = find_archived_day( day, offsets);
+   unsigned char *block;
+
+   if( !ifile)
+      return( NULL);
+   *n_bytes = (size_t)( offsets[1] - offsets[0]);
+   block = (unsigned char *)malloc( *n_bytes);
+   assert( block);
+   n_heap_allocs++;
+   if( fseek( ifile, (long)offsets[0], SEEK_SET)
+                  || fread( block, 1, *n_bytes, ifile) != *n_bytes)
+      {
+      free( block);
+      block = NULL;
+      }
+   fclose( ifile);
+   return( block);
+}
+
+static int read_archived_day( const int day, merged_day_t *mday)
+{
+   size_t n_bytes;
+   unsigned char *block = read_archive_block( day, &n_bytes);
+   int rval;
+
+   if( !block)
+      return( -1);
+   rval = decode_archive_block( block, n_bytes, mday);
+   free( block);
+   mday->glumph0 = day * glumphs_per_day;
+   return( rval);
+}
+
+/* Gets the day from the merged file if there is one,  else from the
+archive (see merged_day_source( )). */
+
+static int load_merged_day( const int day, merged_day_t *mday)
+{
+   char filename[125];
+
+   merged_filename( filename, day);
+   if( !read_merged_file( filename, mday)
+               && mday->glumph0 == day * glumphs_per_day)
+      return( 0);
+   return( read_archived_day( day, mday));
+}
+
+/* Loads the merged file or archived positions for the glumph's day,  if
+there are any,  into the cache.  Either is small and needs no parsing,
+so the whole day is read at once. */
+
+static const cached_posns_t *get_merged_posns( const int glumph)
+{
+   const int day = glumph / glumphs_per_day;
+   char key[140];
+   merged_day_t *mday;
+   struct stat st;
+   int file_idx, i, j;
+
+   if( !merged_day_source( day, key, &st))
+      return( NULL);
+   file_idx = find_cached_file( key);
+   if( file_idx >= 0 && cached_files[file_idx].resident
+            && cached_files[file_idx].mtime == (int64_t)st.st_mtime
+            && cached_files[file_idx].size == (int64_t)st.st_size)
+      return( NULL);       /* we've got it;  it just lacks this glumph */
+   mday = alloc_merged_day( );
+   if( !load_merged_day( day, mday))
+      {
+      double locs[MAX_N_GPS_SATS * 3];
+      int idx[MAX_N_GPS_SATS];
+
+      for( j = 0; j < mday->n_sats; j++)
+         idx[j] = desig_to_index( mday->desigs[j]);
+      if( file_idx < 0)
+         file_idx = add_cached_file( key);
+      else if( !cached_files[file_idx].resident)
+         cache_reloads++;
+      cached_files[file_idx].glumph_lo = mday->glumph0;
+      cached_files[file_idx].glumph_hi = mday->glumph0 + glumphs_per_day - 1;
+      cached_files[file_idx].mtime = (int64_t)st.st_mtime;
+      cached_files[file_idx].size = (int64_t)st.st_size;
+      cached_files[file_idx].last_checked = time( NULL);
+      cached_files[file_idx].resident = true;
+      cached_files[file_idx].n_loads++;
+      cached_files[file_idx].last_used = ++cache_clock;
+      for( i = 0; i < glumphs_per_day; i++)
+         {
+         const cached_posns_t *prev = find_cached_glumph( mday->glumph0 + i);
+
+         if( prev && prev->file_idx != file_idx)
+            continue;         /* first come,  first served */
+         if( prev)            /* from an earlier version of this file */
+            drop_from_cache( prev);
+         memset( locs, 0, sizeof( locs));
+         for( j = 0; j < mday->n_sats; j++)
+            if( mday->source[i][j] != MERGED_NO_SOURCE)
+               memcpy( locs + idx[j] * 3, mday->posns[i][j], 3 * sizeof( double));
+         add_posns_to_cache( mday->glumph0 + i, locs, file_idx);
+         }
+      if( gps_verbose)
+         printf( "Read merged positions from '%s'\n", key);
+      evict_files_over_budget( );
+      }
+   free( mday);
+   return( fetch_posns_from_cache( glumph));
+}
+
+/* For the glumph nearest 'mjd_gps',  sets sources[i] to the name of the
+file from which satellite i's positions were taken (NULL if it has no
+positions then).  The names are in static storage,  good until the next
+call.  Returns the number of satellites,  or -1 if there's no merged file
+or archived data for that day. */
+
+int get_merged_gps_sources( const double mjd_gps, const char **sources)
+{
+   static char names[MERGED_NO_SOURCE][MERGED_SOURCE_LEN];
+   const int glumph = (int)floor( (mjd_gps - GPS_SYSTEM_START)
+                                  * (double)glumphs_per_day + .5);
+   merged_day_t *mday = alloc_merged_day( );
+   int i, rval = -1;
+
+   for( i = 0; i < MAX_N_GPS_SATS; i++)
+      sources[i] = NULL;
+   if( !load_merged_day( glumph / glumphs_per_day, mday))
+      {
+      memcpy( names, mday->sources, sizeof( names));
+      for( i = 0; i < mday->n_sats; i++)
+         {
+         const uint8_t source = mday->source[glumph - mday->glumph0][i];
+
+         if( source != MERGED_NO_SOURCE)
+            sources[desig_to_index( mday->desigs[i])] = names[source];
+         }
+      rval = mday->n_sats;
+      }
+   free( mday);
+   return( rval);
+}
+
+/* 'context' is the list of files found so far,  in order of precedence.
+Returning NULL makes find_sp3_file( ) go on to the next candidate,  so
+we get all of them. */
+
+static const void *try_file_for_merge( const char *filename, const int,
+                                                   void *context)
+{
+   loaded_file_t **list = (loaded_file_t **)context;
+
+   while( *list && strcmp( (*list)->filename, filename))
+      list = &(*list)->next;
+   if( !*list)
+      *list = load_file_snapshot( filename);
+   return( NULL);
+}
+
+/* Merges the files for the day,  as described above.  If 'fetch_files'
+is set,  files are downloaded as find_sp3_file( ) would download them.
+Returns the number of satellites (zero if no files were found). */
+
+static int merge_gps_day( merged_day_t *mday, const int day,
+                                          const bool fetch_files)
+{
+   const int glumph0 = day * glumphs_per_day;
+   loaded_file_t *files = NULL, *tptr;
+   int i, j;
+
+   find_sp3_file( glumph0, fetch_files, try_file_for_merge, &files);
+   memset( mday, 0, sizeof( merged_day_t));
+   mday->glumph0 = glumph0;
+   for( tptr = files; tptr; tptr = tptr->next)
+      {
+      tptr->wanted = (mday->n_sources < MERGED_NO_SOURCE
+               && tptr->glumph_lo < glumph0 + glumphs_per_day
+               && tptr->glumph_lo + tptr->n_glumphs > glumph0);
+      if( tptr->wanted)
+         {
+         const char *basename = strrchr( tptr->filename, '/');
+         size_t len;
+
+         basename = (basename ? basename + 1 : tptr->filename);
+         len = strlen( basename);
+         if( len > MERGED_SOURCE_LEN - 1)
+            len = MERGED_SOURCE_LEN - 1;
+         memcpy( mday->sources[mday->n_sources++], basename, len);
+         for( i = 0; i < MAX_N_GPS_SATS && tptr->desigs[i][0]; i++)
+            find_desig( mday->desigs, tptr->desigs[i]);
+         }
+      }
+   while( mday->n_sats < MAX_N_GPS_SATS && mday->desigs[mday->n_sats][0])
+      mday->n_sats++;
+   for( i = 0; i < glumphs_per_day; i++)
+      for( j = 0; j < mday->n_sats; j++)
+         {
+         const double *posn = NULL;
+         int source = 0;
+
+         for( tptr = files; tptr && !posn; tptr = tptr->next)
+            if( tptr->wanted)
+               {
+               const int sat = find_desig( tptr->desigs, mday->desigs[j]);
+               const int offset = glumph0 + i - tptr->glumph_lo;
+
+               if( offset >= 0 && offset < tptr->n_glumphs)
+                  {
+                  posn = tptr->posns + (offset * MAX_N_GPS_SATS + sat) * 3;
+                  if( !posn[0] && !posn[1] && !posn[2])
+                     posn = NULL;
+                  }
+               if( !posn)
+                  source++;
+               }
+         mday->source[i][j] = (uint8_t)( posn ? source : MERGED_NO_SOURCE);
+         if( posn)
+            memcpy( mday->posns[i][j], posn, 3 * sizeof( double));
+         }
+   free_loaded_files( files);
+   return( mday->n_sats);
+}
+
+/* Writes the merged file (see above) for the GPS day containing 'mjd_gps'.
+Returns the number of satellites,  or -1 if no files were found for that
+day,  -2 if the output couldn't be written. */
+
+int write_merged_gps_day( const double mjd_gps, const bool fetch_files)
+{
+   const int day = (int)floor( mjd_gps - GPS_SYSTEM_START);
+   merged_day_t *mday = alloc_merged_day( );
+   int rval = merge_gps_day( mday, day, fetch_files);
+
+   if( !rval)
+      rval = -1;
+   else
+      {
+      char filename[125];
+
+      merged_filename( filename, day);
+      if( write_merged_file( mday, filename))
+         rval = -2;
+      if( gps_verbose)
+         printf( "'%s': %d satellites from %d files\n", filename,
+                        mday->n_sats, mday->n_sources);
+      }
+   free( mday);
+   return( rval);
+}
+
+/* Merges each GPS day from 'mjd_start' to 'mjd_end' and puts it in the
+archive,  creating the archive if it doesn't exist and extending it if
+need be.  Days already in the archive are replaced,  except that a day
+for which no files are found is left as it was.  Returns the number of
+days written,  or -2 if the archive couldn't be written. */
+
+int archive_gps_days( const double mjd_start, const double mjd_end,
+                                             const bool fetch_files)
+{
+   const int day_start = (int)floor( mjd_start - GPS_SYSTEM_START);
+   const int day_end = (int)floor( mjd_end - GPS_SYSTEM_START);
+   char filename[125], temp_name[130];
+   archive_header_t hdr, old_hdr;
+   int64_t *offsets, *old_offsets = NULL, offset;
+   merged_day_t *mday = alloc_merged_day( );
+   unsigned char *block = (unsigned char *)malloc( ARCHIVE_MAX_BLOCK);
+   FILE *old_file, *ofile;
+   int i, rval = 0;
+
+   assert( block);
+   archive_filename( filename);
+   old_file = fopen( filename, "rb");
+   if( old_file && (fread( &old_hdr, sizeof( old_hdr), 1, old_file) != 1
+               || memcmp( old_hdr.magic, ARCHIVE_MAGIC, 8)
+               || old_hdr.n_days <= 0))
+      {
+      fclose( old_file);
+      old_file = NULL;
+      }
+   memcpy( hdr.magic, ARCHIVE_MAGIC, 8);
+   hdr.day0 = day_start;
+   hdr.n_days = day_end - day_start + 1;
+   if( old_file)
+      {
+      old_offsets = (int64_t *)malloc( (old_hdr.n_days + 1) * sizeof( int64_t));
+      assert( old_offsets);
+      if( fread( old_offsets, sizeof( int64_t), old_hdr.n_days + 1, old_file)
+                     != (size_t)old_hdr.n_days + 1)
+         memset( old_offsets, 0, (old_hdr.n_days + 1) * sizeof( int64_t));
+      if( hdr.day0 > old_hdr.day0)
+         hdr.day0 = old_hdr.day0;
+      if( day_end < old_hdr.day0 + old_hdr.n_days - 1)
+         hdr.n_days = old_hdr.day0 + old_hdr.n_days - hdr.day0;
+      else
+         hdr.n_days = day_end - hdr.day0 + 1;
+      }
+   offsets = (int64_t *)calloc( hdr.n_days + 1, sizeof( int64_t));
+   assert( offsets);
+   snprintf( temp_name, sizeof( temp_name), "%s.tmp", filename);
+   ofile = fopen( temp_name, "wb");
+   if( !ofile)
+      rval = -2;
+   else
+      {
+      fwrite( &hdr, sizeof( hdr), 1, ofile);
+      fwrite( offsets, sizeof( int64_t), hdr.n_days + 1, ofile);
+      }
+   offset = (int64_t)( sizeof( hdr) + (hdr.n_days + 1) * sizeof( int64_t));
+   for( i = 0; i < hdr.n_days && rval >= 0; i++)
+      {
+      const int day = hdr.day0 + i;
+      size_t n_bytes = 0;
+
+      offsets[i] = offset;
+      if( day >= day_start && day <= day_end
+                     && merge_gps_day( mday, day, fetch_files))
+         {
+         n_bytes = encode_archive_block( block, mday);
+         assert( n_bytes <= ARCHIVE_MAX_BLOCK);
+         rval++;
+         if( gps_verbose)
+            printf( "Day %d: %d satellites,  %lu bytes\n", day, mday->n_sats,
+                                    (unsigned long)n_bytes);
+         }
+      else if( old_file && day >= old_hdr.day0
+                        && day < old_hdr.day0 + old_hdr.n_days)
+         {              /* copy the existing block */
+         const int j = day - old_hdr.day0;
+
+         n_bytes = (size_t)( old_offsets[j + 1] - old_offsets[j]);
+         if( n_bytes > ARCHIVE_MAX_BLOCK
+                  || fseek( old_file, (long)old_offsets[j], SEEK_SET)
+                  || fread( block, 1, n_bytes, old_file) != n_bytes)
+            n_bytes = 0;
+         }
+      if( n_bytes && fwrite( block, 1, n_bytes, ofile) != n_bytes)
+         rval = -2;
+      offset += (int64_t)n_bytes;
+      }
+   offsets[hdr.n_days] = offset;
+   if( old_file)
+      fclose( old_file);
+   if( ofile)
+      {
+      if( fseek( ofile, (long)sizeof( hdr), SEEK_SET)
+               || fwrite( offsets, sizeof( int64_t), hdr.n_days + 1, ofile)
+                              != (size_t)hdr.n_days + 1)
+         rval = -2;
+      if( fclose( ofile))
+         rval = -2;
+      if( rval < 0)
+         unlink( temp_name);
+      else
+         {
+         unlink( filename);
+         rename( temp_name, filename);
+         }
+      }
+   free( offsets);
+   free( old_offsets);
+   free( block);
+   free( mday);
+   return( rval);
+}
+
+/* A long-running process (gps_serv) can keep a glumph cached long after
+a new issue of the file it came from has appeared.  So on a cache hit,  the
+file is stat()ed again,  though not more than once every
+REISSUE_CHECK_SECONDS;  if its size or time has changed,  it's re-read,
+and the new positions replace the old ones just as they would on a miss
+(see cache_one_glumph( ) and get_merged_posns( )). */
+
+#define REISSUE_CHECK_SECONDS    60
+
+static long n_reissues;
+
+static bool file_was_reissued( const int file_idx)
+{
+   cached_file_t *file = cached_files + file_idx;
+   const time_t t = time( NULL);
+   char filename[140], *tptr;
+   struct stat st;
+
+   if( t - file->last_checked < REISSUE_CHECK_SECONDS)
+      return( false);
+   file->last_checked = t;
+   snprintf( filename, sizeof( filename), "%s", file->filename);
+   tptr = strchr( filename, '#');      /* archived day;  see merged_day_source( ) */
+   if( tptr)
+      *tptr = '\0';
+   return( !stat( filename, &st) && (file->mtime != (int64_t)st.st_mtime
+                                  || file->size != (int64_t)st.st_size));
+}
+
+static const cached_posns_t *reload_reissued_file( const int file_idx,
+                                                   const int glumph)
+{
+   char filename[140];
+   size_t len;
+
+   snprintf( filename, sizeof( filename), "%s", cached_files[file_idx].filename);
+   len = strlen( filename);
+   if( gps_verbose)
+      printf( "'%s' has been reissued\n", filename);
+   n_reissues++;
+   if( sweep)                 /* it may be holding the old positions */
+      sweep->valid = false;
+   if( strchr( filename, '#') || (len > 4 && !strcmp( filename + len - 4, ".mrg")))
+      get_merged_posns( glumph);
+   else
+      get_cached_posns( filename, glumph, true);
+   return( fetch_posns_from_cache( glumph));
+}
+
+static const cached_posns_t *get_tabulated_gps_posns( const int glumph,
+            int *err_code, const bool fetch_files)
+{
+   const cached_posns_t *rval;
+
+   *err_code = 0;
+   rval = fetch_posns_from_cache( glumph);
+   if( !rval && adopt_loaded_files( ))
+      rval = fetch_posns_from_cache( glumph);
+   if( rval && file_was_reissued( rval->file_idx))
+      rval = reload_reissued_file( rval->file_idx, glumph);
+   if( rval)
+      {
+      if( gps_verbose)
+         printf( "Already got glumph %d in cache\n", glumph);
+      cache_hits++;
+      return( rval);
+      }
+   cache_misses++;
+   rval = get_merged_posns( glumph);
+   if( !rval)
+      rval = (const cached_posns_t *)find_sp3_file( glumph, fetch_files,
+                                             try_cached_file, NULL);
+   return( rval);
+}
+
+/* If,  as described below,  you observed an object with a light-time lag of
+(say) 0.07 seconds,  then it should be precessed from Earth-fixed inertial
+coordinates to J2000 using the earth's orientation as it was 0.07 seconds
+before you made your observation.  Instead,  it's processed using the
+orientation at the time of observation.
+
+To fix this small difference,  we just spin around the Z axis by the
+amount the earth rotates during those 0.07 seconds. */
+
+static inline void rotate_vect( double *vect, const double angle)
+{
+   const double cos_angle = cos( angle), sin_angle = sin( angle);
+   const double new_y = vect[1] * cos_angle - vect[0] * sin_angle;
+
+   vect[0] = vect[0] * cos_angle + vect[1] * sin_angle;
+   vect[1] = new_y;
+}
+
+/* Lagrange interpolation through n_pts evenly spaced in x,  y[0] = value
+at x=0, y[1] = value at x=1,  etc.  Experimentation with the following
+function shows negligible errors with n_pts = 10 and x "in the middle",
+i.e.,  x > 4 && x < 5,  such that it has five points on either side. */
+
+static double interpolate( const double *y, const double x, const int n_pts)
+{
+   double t = 1., c = 1., rval;
+   int i;
+
+   for( i = 0; i < n_pts; i++)
+      {
+      c *= x - (double)i;
+      if( i)
+         t *= -(double)i;
+      }
+   if( !c)        /* we're on an abscissa */
+      rval = y[(int)( x + .5)];
+   else
+      {
+      rval = y[0] / (t * x);
+      for( i = 1; i < n_pts; i++)
+         {
+         t *= (double)i / (double)( i - n_pts);
+         rval += y[i] / (t * (x - (double)i));
+         }
+      rval *= c;
+      }
+   return( rval);
+}
+
+/* If observer_loc == NULL,  we just compute positions without any light-time
+lag considered.  Otherwise,  we start out assuming a lag of 0.07 seconds,
+about right for most navsats.  That gets us a highly accurate distance,
+and a second iteration gets us as good as we're gonna get.  A more
+thorough implementation would examine how much the light-time lag changed;
+then,  if the observer_loc were near Saturn,  it would do another iteration
+or two until the light-time lag converged near an hour and a half.  But
+this should suffice for ordinary purposes. */
+
+/* Ephemerides,  astrometry files,  and event searches usually step
+through time in one direction,  in steps much smaller than a glumph.  We
+used to look up all INTERPOLATION_ORDER glumphs in the cache,  and copy
+each satellite's positions from them,  for every call.
+
+   Instead,  the positions for the current 'window' of glumphs are kept
+in a ring buffer for each satellite and coordinate.  When time moves by
+a glumph or two,  only the new glumphs are looked up and shifted in;
+within a glumph,  nothing is looked up or copied at all.  Each value is
+stored twice,  INTERPOLATION_ORDER apart,  so the window for any starting
+slot is contiguous and can be handed straight to interpolate( ).  We also
+keep track of how many of the glumphs in the window lack each satellite,
+so we needn't check them all on each call.  A jump of a full window or
+more (in either direction) just reloads all of it.       */
+
+static void set_sweep_node( const int slot, const cached_posns_t *entry)
+{
+   const double *posns = entry->posns;
+   const double zeroes[3] = { 0., 0., 0. };
+   int i, j;
+
+   for( i = 0; i < MAX_N_GPS_SATS; i++)
+      {
+      const bool was_missing = (sweep->node[i][0][slot] == 0.
+                  && sweep->node[i][1][slot] == 0.
+                  && sweep->node[i][2][slot] == 0.);
+      const bool is_missing = !IS_PRESENT( entry, i);
+      const double *posn = (is_missing ? zeroes : posns);
+
+      sweep->n_missing[i] += (int)is_missing - (int)was_missing;
+      for( j = 0; j < 3; j++)
+         sweep->node[i][j][slot] =
+               sweep->node[i][j][slot + INTERPOLATION_ORDER] = posn[j];
+      if( !is_missing)
+         posns += 3;
+      }
+}
+
+/* Sets where the time falls among the glumphs,  returning the first of
+the INTERPOLATION_ORDER glumphs to interpolate through. */
+
+static int first_interpolation_glumph( const double mjd_gps,
+                                       double *interpolation_loc)
+{
+   const double jan_6_1980 = 44244.0;
+   const double glumphs = (mjd_gps - jan_6_1980) * (double)glumphs_per_day;
+   const int iglumph = (int)glumphs + 1 - INTERPOLATION_ORDER / 2;
+
+   *interpolation_loc = glumphs - (double)iglumph;
+   return( iglumph);
+}
+
+/* Repeated queries within one window never get as far as
+get_tabulated_gps_posns( ),  so the window's files are checked for new
+issues here,  no more than every REISSUE_CHECK_SECONDS.  Returns true
+(and invalidates the window) if any had been reissued. */
+
+static bool sweep_files_reissued( void)
+{
+   const time_t t = time( NULL);
+   int i;
+
+   if( t - sweep->last_checked < REISSUE_CHECK_SECONDS)
+      return( false);
+   sweep->last_checked = t;
+   for( i = 0; i < INTERPOLATION_ORDER && sweep->valid; i++)
+      {
+      const int glumph = sweep->iglumph + i;
+      const cached_posns_t *entry = find_cached_glumph( glumph);
+
+      if( entry && file_was_reissued( entry->file_idx))
+         reload_reissued_file( entry->file_idx, glumph);
+      }
+   return( !sweep->valid);
+}
+
+/* Brings the window up to date for the given time,  and sets where the
+time falls within it.  Returns false if some of the needed positions
+couldn't be found,  in which case the window is left as it was.  Missing
+files are downloaded if 'fetch_files' is set. */
+
+static bool update_sweep_window( const double mjd_gps,
+         double *interpolation_loc, int *err_code, const bool fetch_files)
+{
+   const int iglumph = first_interpolation_glumph( mjd_gps, interpolation_loc);
+   const cached_posns_t *posns[INTERPOLATION_ORDER];
+   long reissues_before;
+   int i, shift, n_new, new_glumph;
+
+   *err_code = 0;
+   if( !sweep)
+      {
+      sweep = (sweep_window_t *)calloc( 1, sizeof( sweep_window_t));
+      assert( sweep);
+      n_heap_allocs++;
+      }
+   shift = iglumph - sweep->iglumph;
+   if( sweep->valid && !shift && !sweep_files_reissued( ))
+      return( true);
+   reissues_before = n_reissues;
+   cache_pin_clock = cache_clock + 1;  /* don't evict what we're about to use */
+   if( !sweep->valid || shift >= INTERPOLATION_ORDER
+                     || shift <= -INTERPOLATION_ORDER)
+      {
+      n_new = INTERPOLATION_ORDER;
+      new_glumph = iglumph;
+      }
+   else if( shift > 0)
+      {
+      n_new = shift;
+      new_glumph = sweep->iglumph + INTERPOLATION_ORDER;
+      }
+   else
+      {
+      n_new = -shift;
+      new_glumph = iglumph;
+      }
+   for( i = 0; i < n_new; i++)
+      {
+      posns[i] = get_tabulated_gps_posns( new_glumph + i, err_code, false);
+      if( !posns[i] && fetch_files)    /* maybe we need to download data */
+         posns[i] = get_tabulated_gps_posns( new_glumph + i, err_code, true);
+      if( !posns[i])
+         return( false);
+      }
+   if( n_reissues != reissues_before)     /* nodes we kept,  or got */
+      return( update_sweep_window( mjd_gps,  /* above,  may be stale */
+                     interpolation_loc, err_code, fetch_files));
+   if( n_new == INTERPOLATION_ORDER)
+      {
+      memset( sweep, 0, sizeof( sweep_window_t));
+      for( i = 0; i < MAX_N_GPS_SATS; i++)
+         sweep->n_missing[i] = INTERPOLATION_ORDER;
+      for( i = 0; i < n_new; i++)
+         set_sweep_node( i, posns[i]);
+      sweep->valid = true;
+      sweep->last_checked = time( NULL);
+      }
+   else if( shift > 0)        /* new nodes go where the oldest ones were */
+      for( i = 0; i < n_new; i++)
+         {
+         set_sweep_node( sweep->first, posns[i]);
+         sweep->first = (sweep->first + 1) % INTERPOLATION_ORDER;
+         }
+   else                       /* going backward in time */
+      for( i = n_new - 1; i >= 0; i--)
+         {
+         sweep->first = (sweep->first + INTERPOLATION_ORDER - 1) % INTERPOLATION_ORDER;
+         set_sweep_node( sweep->first, posns[i]);
+         }
+   sweep->iglumph = iglumph;
+   return( true);
+}
+
+/* Interpolates a position from INTERPOLATION_ORDER tabulated x,  y,  and
+z coordinates,  as seen from 'observer_loc'. */
+
+static void interpolate_posn( const double **nodes,
+                  const double interpolation_loc, const double *observer_loc,
+                  double *output)
+{
+   int j, pass;
+   double light_time_lag = 0.07;   /* initial guess */
+
+   for( pass = 0; pass < 2; pass++)
+      {
+      double dist_squared = 0., delta;
+      const double delay = light_time_lag / seconds_per_glumph;
+
+      for( j = 0; j < 3; j++)
+         {
+         output[j] = interpolate( nodes[j],
+                       interpolation_loc - delay, INTERPOLATION_ORDER);
+         if( observer_loc)
+            delta = output[j] - observer_loc[j];
+         else
+            delta = 0.;
+         dist_squared += delta * delta;
+         }
+      light_time_lag = sqrt( dist_squared) / SPEED_OF_LIGHT;
+      rotate_vect( output, 2. * pi * light_time_lag / seconds_per_day);
+      }
+}
+
+/* Interpolates the position of satellite 'idx',  leaving 'output' at
+zero if any of the tabulated positions are missing. */
+
+static void interpolate_one_sat( const int idx,
+                  const double interpolation_loc, const double *observer_loc,
+                  double *output)
+{
+   const double *nodes[3];
+   int j;
+
+   if( sweep->n_missing[idx])
+      return;
+   for( j = 0; j < 3; j++)
+      nodes[j] = sweep->node[idx][j] + sweep->first;
+   interpolate_posn( nodes, interpolation_loc, observer_loc, output);
+}
+
+/* An ephemeris of one satellite over weeks (list_gps -o) would,  through
+the sweep window,  load and cache every satellite's positions for every
+glumph,  only to use one in fifty or so of them;  and a long enough run
+evicts each day's files before it's done with them.  set_gps_track( )
+instead sets up a 'track' for the one satellite:  its x,  y,  and z for
+each glumph,  each in an array of its own running straight through time,
+so the positions to interpolate through are just pointers into them.
+
+   A day is added the first time it's needed.  It comes from the merged
+file or the archive,  if there is one,  reading just that satellite's
+part of it;  otherwise from the .sp3 files,  each glumph from the file
+find_sp3_file( ) would choose,  reading only the satellite's lines.  The
+cache and sweep window are left alone.  get_gps_positions_masked( ) uses
+the track when the mask selects just its satellite,  as does
+get_gps_position( ).  Positions are those the sweep window would have
+used,  so results are identical.  Tracks are allocated a TRACK_CHUNK_DAYS
+at a time,  and one covering more than TRACK_MAX_DAYS starts afresh. */
+
+#define TRACK_CHUNK_DAYS     32
+#define TRACK_MAX_DAYS     3680
+
+typedef struct
+{
+   int idx;                   /* see desig_from_index( ) */
+   int day0, n_days;          /* days since 1980 Jan 6 */
+   bool *day_loaded;
+   double *coord[3];          /* [n_days * glumphs_per_day] each */
+} gps_track_t;
+
+static gps_track_t *track;
+
+/* One satellite's positions from an .sp3 file,  read as
+load_file_snapshot( ) would read them for all satellites. */
+
+typedef struct track_file
+{
+   struct track_file *next;
+   char filename[125];
+   int glumph_lo, n_glumphs;
+   double *posns;             /* n_glumphs * 3 */
+} track_file_t;
+
+typedef struct
+{
+   track_file_t *files;
+   const char *desig;
+} track_files_t;
+
+static track_file_t *load_track_file( const char *filename, const char *desig)
+{
+   FILE *ifile = fopen( filename, "r");
+   track_file_t *rval;
+   char buff[200];
+   int freq, n_epochs = 0, n_alloced = 0;
+   bool in_epoch = false;
+
+   if( !ifile)
+      return( NULL);
+   rval = (track_file_t *)calloc( 1, sizeof( track_file_t));
+   assert( rval);
+   n_heap_allocs++;
+   snprintf( rval->filename, sizeof( rval->filename), "%s", filename);
+   rval->glumph_lo = read_sp3_header( ifile, &freq);
+   while( fgets( buff, sizeof( buff), ifile))
+      if( *buff == '*')
+         {
+         in_epoch = (n_epochs++ % (900 / freq) == 0);
+         if( in_epoch)
+            {
+            if( rval->n_glumphs == n_alloced)
+               {
+               n_alloced += glumphs_per_day;
+               rval->posns = (double *)realloc( rval->posns,
+                                    n_alloced * 3 * sizeof( double));
+               assert( rval->posns);
+               }
+            memset( rval->posns + rval->n_glumphs * 3, 0, 3 * sizeof( double));
+            rval->n_glumphs++;
+            }
+         }
+      else if( *buff != 'P')  /* read_posns_for_one_glumph( ) stops here */
+         in_epoch = false;
+      else if( in_epoch && !memcmp( buff + 1, desig, 3))
+         {
+         double *tptr = rval->posns + (rval->n_glumphs - 1) * 3;
+
+         sscanf( buff + 4, "%lf %lf %lf", tptr, tptr + 1, tptr + 2);
+         }
+   fclose( ifile);
+   return( rval);
+}
+
+static void free_track_files( track_file_t *tptr)
+{
+   while( tptr)
+      {
+      track_file_t *next = tptr->next;
+
+      free( tptr->posns);
+      free( tptr);
+      tptr = next;
+      }
+}
+
+/* 'context' is the list of files read so far for this day,  so each
+is read only once. */
+
+static const void *try_file_for_track( const char *filename,
+                                  const int glumph, void *context)
+{
+   track_files_t *files = (track_files_t *)context;
+   track_file_t *tptr;
+
+   for( tptr = files->files; tptr; tptr = tptr->next)
+      if( !strcmp( tptr->filename, filename))
+         break;
+   if( !tptr && (tptr = load_track_file( filename, files->desig)) != NULL)
+      {
+      tptr->next = files->files;
+      files->files = tptr;
+      }
+   if( tptr && glumph >= tptr->glumph_lo
+            && glumph < tptr->glumph_lo + tptr->n_glumphs)
+      return( tptr);
+   return( NULL);
+}
+
+/* Reads the satellite's positions for the day from its merged file,
+seeking to each one rather than reading the whole file.  Positions are
+left at zero where it has none.  Returns -1 if there's no merged file. */
+
+static int read_merged_sat( const int day, const char *desig,
+                                    double (*posns)[3])
+{
+   char filename[125], *sources;
+   merged_header_t hdr;
+   FILE *ifile;
+   int i, j, rval = -1;
+
+   merged_filename( filename, day);
+   ifile = open_merged_file( filename, &hdr, &sources);
+   if( !ifile)
+      return( -1);
+   memset( posns, 0, glumphs_per_day * 3 * sizeof( double));
+   if( hdr.glumph0 == day * glumphs_per_day)
+      {
+      const char *sat_desigs = sources + hdr.n_sources * MERGED_SOURCE_LEN;
+      const uint8_t *source = (const uint8_t *)sat_desigs + hdr.n_sats * 4;
+
+      for( j = 0; j < hdr.n_sats && memcmp( sat_desigs + j * 4, desig, 3); j++)
+         ;
+      rval = 0;
+      for( i = 0; j < hdr.n_sats && i < glumphs_per_day && !rval; i++)
+         if( source[i * hdr.n_sats + j] < hdr.n_sources)
+            if( fseek( ifile, (long)( merged_data_offset( &hdr)
+                     + (i * hdr.n_sats + j) * 3 * sizeof( double)), SEEK_SET)
+                     || fread( posns[i], 3 * sizeof( double), 1, ifile) != 1)
+               rval = -1;
+      }
+   fclose( ifile);
+   free( sources);
+   return( rval);
+}
+
+/* As above,  from the archive.  Satellites before this one in the block
+still have to be decoded to get past them,  but go no further. */
+
+static int read_archived_sat( const int day, const char *desig,
+                                    double (*posns)[3])
+{
+   size_t n_bytes;
+   unsigned char *block = read_archive_block( day, &n_bytes);
+   varint_reader_t reader;
+   int i, j, n_sources, n_sats, rval = -1;
+
+   if( !block)
+      return( -1);
+   memset( posns, 0, glumphs_per_day * 3 * sizeof( double));
+   reader.ptr = block;
+   reader.end = block + n_bytes;
+   reader.err = false;
+   n_sources = decode_archived_sources( &reader, NULL);
+   n_sats = (n_sources < 0 ? 0 : (int)get_varint( &reader));
+   if( !reader.err && n_sats > 0 && n_sats <= MAX_N_GPS_SATS)
+      for( j = 0, rval = 0; j < n_sats && !rval; j++)
          {
-         FILE *netrc_file = fopen( netrc_filename, "rb");
+         char sat_desig[4];
+         uint8_t source[glumphs_per_day];
+         double sat_posns[glumphs_per_day][3];
 
-         if( netrc_file)
-            fclose( netrc_file);
-         have_netrc = (netrc_file ? 1 : 0);
-         }
-      for( pass = (have_netrc ? 0 : 1); !rval && pass < 4; pass++)
-         {           /* try CDDIS,  WUM (Wuhan) & SHA files */
-         if( !pass)
+         rval = decode_archived_sat( &reader, n_sources, sat_desig,
+                                          source, sat_posns);
+         if( !rval && !memcmp( sat_desig, desig, 3))
             {
-            snprintf( filename, sizeof( filename),
-                  "GFZ0OPSULT_%d%d0000_02D_05M_ORB.SP3.gz", i, day_of_year);
-            snprintf( command, sizeof( command),
-                   "https://cddis.nasa.gov/archive/gnss/products/%4d/%s",
-                   week, filename);
-            }
-         else
-            {                 /* WUM (Wuhan) & SHA (Shanghai?) from IGS */
-            const char *paths[3] = { "SHA0MGXULT", "WUM0MGXFIN", "WUM0MGXRAP" };
-
-            snprintf( filename, sizeof( filename), "%s_%d%03d0000_01D_05M_ORB.SP3.gz",
-                     paths[pass - 1], i, day_of_year);
-            snprintf( command, sizeof( command),
-                  "ftp://igs.ign.fr/pub/igs/products/%4d/%s",
-                  week, filename);
+            for( i = 0; i < glumphs_per_day; i++)
+               if( source[i] != MERGED_NO_SOURCE)
+                  memcpy( posns[i], sat_posns[i], 3 * sizeof( double));
+            break;
             }
-         insert_data_path( filename);
-         if( gps_verbose)
-            printf( "MGEX (multi-GNSS) file: '%s', %d %d: '%s'\n", filename, glumph,
-                glumph - day * glumphs_per_day, command);
-         if( fetch_files)
-            try_to_download( command, filename);
-         remove_dot_z( filename);
-         rval = get_cached_posns( filename, glumph);
          }
-      if( rval)
-         return( rval);
-      }
+   free( block);
+   return( rval);
+}
 
-#ifdef UNIBE_BASE_URL
-   if( week >= UNIBE_COD_START_WEEK && day <= curr_day + 1)
+static void load_track_day( const int day)
+{
+   const char *desig = desig_from_index( track->idx);
+   const int offset = (day - track->day0) * glumphs_per_day;
+   double posns[glumphs_per_day][3];
+   int i, j;
+
+   if( read_merged_sat( day, desig, posns)
+                  && read_archived_sat( day, desig, posns))
       {
-      if( i < 2023)
-         snprintf( filename, sizeof( filename), "COD%04d%d.EPH.Z", week, day % 7);
-      else
-         snprintf( filename, sizeof( filename), "COD0OPSFIN_%d%03d0000_01D_05M_ORB.SP3.gz",
-                                    i, day_of_year);
-      snprintf( command, sizeof( command), UNIBE_BASE_URL "%4d/%s", i, filename);
-      insert_data_path( filename);
-      if( gps_verbose)
-         printf( "Final file: '%s', %d %d: '%s'\n", filename, glumph,
-               glumph - day * glumphs_per_day, command);
-      if( fetch_files)
-         try_to_download( command, filename);
-      remove_dot_z( filename);
-      rval = get_cached_posns( filename, glumph);
-      if( rval)
-         return( rval);
+      track_files_t files;
 
-      snprintf( filename, sizeof( filename), "COD%04d%d.EPH_R", week, day % 7);
-      snprintf( command, sizeof( command), UNIBE_BASE_URL "%s", filename);
-      insert_data_path( filename);
-      if( gps_verbose)
-         printf( "Rapid file: '%s', %d %d: '%s'\n", filename, glumph,
-               glumph - day * glumphs_per_day, command);
-      if( fetch_files)
-         try_to_download( command, filename);
-      rval = get_cached_posns( filename, glumph);
+      files.files = NULL;
+      files.desig = desig;
+      for( i = 0; i < glumphs_per_day; i++)
+         {
+         const int glumph = day * glumphs_per_day + i;
+         const track_file_t *tptr = (const track_file_t *)find_sp3_file(
+                        glumph, false, try_file_for_track, &files);
+
+         if( !tptr)        /* maybe we need to download data */
+            tptr = (const track_file_t *)find_sp3_file(
+                        glumph, true, try_file_for_track, &files);
+         if( tptr)
+            memcpy( posns[i], tptr->posns + (glumph - tptr->glumph_lo) * 3,
+                                    3 * sizeof( double));
+         else
+            posns[i][0] = posns[i][1] = posns[i][2] = 0.;
+         }
+      free_track_files( files.files);
       }
+   for( i = 0; i < glumphs_per_day; i++)
+      for( j = 0; j < 3; j++)
+         track->coord[j][offset + i] = posns[i][j];
+   track->day_loaded[day - track->day0] = true;
+   if( gps_verbose)
+      printf( "Track for %s: loaded day %d\n", desig, day);
+}
 
-   for( i = 0; !rval && i < 5; i++, day--)
-      if( day > curr_day - 20 && day < curr_day + 3)
+/* Makes sure the track has room for days day_lo to day_hi. */
+
+static void extend_track( const int day_lo, const int day_hi)
+{
+   int day0 = day_lo - day_lo % TRACK_CHUNK_DAYS;
+   int day_end = day_hi + TRACK_CHUNK_DAYS - day_hi % TRACK_CHUNK_DAYS;
+   bool keep = (track->n_days > 0), *day_loaded;
+   int j;
+
+   if( keep)
+      {
+      if( day_lo >= track->day0 && day_hi < track->day0 + track->n_days)
+         return;
+      if( day0 > track->day0)
+         day0 = track->day0;
+      if( day_end < track->day0 + track->n_days)
+         day_end = track->day0 + track->n_days;
+      if( day_end - day0 > TRACK_MAX_DAYS)      /* start afresh */
          {
-         snprintf( filename, sizeof( filename), "COD%04d%d.EPH_5D",
-                        day / 7, day % 7);
-         snprintf( command, sizeof( command), UNIBE_BASE_URL "%s", filename);
-         insert_data_path( filename);
-         if( gps_verbose)
-             printf("Five-day file: '%s', %d %d: '%s'\n", filename, glumph,
-               glumph - day * glumphs_per_day, command);
-         if( fetch_files)
-            try_to_download( command, filename);
-         rval = get_cached_posns( filename, glumph);
-         if( gps_verbose)
-            printf( "get_cached_posns: %p\n", (void *)rval);
+         day0 = day_lo - day_lo % TRACK_CHUNK_DAYS;
+         day_end = day_hi + TRACK_CHUNK_DAYS - day_hi % TRACK_CHUNK_DAYS;
+         keep = false;
          }
-#endif         /* #ifdef UNIBE_BASE_URL */
-   return( rval);
-}
+      }
+   day_loaded = (bool *)calloc( day_end - day0, sizeof( bool));
+   assert( day_loaded);
+   n_heap_allocs++;
+   if( keep)
+      memcpy( day_loaded + track->day0 - day0, track->day_loaded,
+                                    track->n_days * sizeof( bool));
+   free( track->day_loaded);
+   track->day_loaded = day_loaded;
+   for( j = 0; j < 3; j++)
+      {
+      double *coord = (double *)calloc( (day_end - day0) * glumphs_per_day,
+                                                   sizeof( double));
 
-/* If,  as described below,  you observed an object with a light-time lag of
-(say) 0.07 seconds,  then it should be precessed from Earth-fixed inertial
-coordinates to J2000 using the earth's orientation as it was 0.07 seconds
-before you made your observation.  Instead,  it's processed using the
-orientation at the time of observation.
+      assert( coord);
+      n_heap_allocs++;
+      if( keep)
+         memcpy( coord + (track->day0 - day0) * glumphs_per_day,
+                  track->coord[j],
+                  track->n_days * glumphs_per_day * sizeof( double));
+      free( track->coord[j]);
+      track->coord[j] = coord;
+      }
+   track->day0 = day0;
+   track->n_days = day_end - day0;
+}
 
-To fix this small difference,  we just spin around the Z axis by the
-amount the earth rotates during those 0.07 seconds. */
+/* As interpolate_one_sat( ),  for the track's satellite. */
 
-static inline void rotate_vect( double *vect, const double angle)
+static void get_track_position( double *output, const double *observer_loc,
+                                    const double mjd_gps)
 {
-   const double cos_angle = cos( angle), sin_angle = sin( angle);
-   const double new_y = vect[1] * cos_angle - vect[0] * sin_angle;
+   double interpolation_loc;
+   const int iglumph = first_interpolation_glumph( mjd_gps,
+                                                   &interpolation_loc);
+   const int day_lo = iglumph / glumphs_per_day;
+   const int day_hi = (iglumph + INTERPOLATION_ORDER - 1) / glumphs_per_day;
+   const double *nodes[3];
+   int i, j, offset;
 
-   vect[0] = vect[0] * cos_angle + vect[1] * sin_angle;
-   vect[1] = new_y;
+   if( iglumph < 0)
+      return;
+   extend_track( day_lo, day_hi);
+   for( i = day_lo; i <= day_hi; i++)
+      if( !track->day_loaded[i - track->day0])
+         load_track_day( i);
+   offset = iglumph - track->day0 * glumphs_per_day;
+   for( i = offset; i < offset + INTERPOLATION_ORDER; i++)
+      if( !track->coord[0][i] && !track->coord[1][i] && !track->coord[2][i])
+         return;
+   for( j = 0; j < 3; j++)
+      nodes[j] = track->coord[j] + offset;
+   interpolate_posn( nodes, interpolation_loc, observer_loc, output);
 }
 
-/* Lagrange interpolation through n_pts evenly spaced in x,  y[0] = value
-at x=0, y[1] = value at x=1,  etc.  Experimentation with the following
-function shows negligible errors with n_pts = 10 and x "in the middle",
-i.e.,  x > 4 && x < 5,  such that it has five points on either side. */
-
-static double interpolate( const double *y, const double x, const int n_pts)
+static void free_gps_track( void)
 {
-   double t = 1., c = 1., rval;
-   int i;
+   int j;
 
-   for( i = 0; i < n_pts; i++)
+   if( track)
       {
-      c *= x - (double)i;
-      if( i)
-         t *= -(double)i;
+      free( track->day_loaded);
+      for( j = 0; j < 3; j++)
+         free( track->coord[j]);
+      free( track);
+      track = NULL;
       }
-   if( !c)        /* we're on an abscissa */
-      rval = y[(int)( x + .5)];
-   else
+}
+
+/* Sets up a track (see above) for the satellite with the given
+designation,  or drops the current one if 'desig' is NULL. */
+
+void set_gps_track( const char *desig)
+{
+   free_gps_track( );
+   if( desig)
       {
-      rval = y[0] / (t * x);
-      for( i = 1; i < n_pts; i++)
-         {
-         t *= (double)i / (double)( i - n_pts);
-         rval += y[i] / (t * (x - (double)i));
-         }
-      rval *= c;
+      track = (gps_track_t *)calloc( 1, sizeof( gps_track_t));
+      assert( track);
+      n_heap_allocs++;
+      track->idx = desig_to_index( desig);
       }
-   return( rval);
 }
 
-#define INTERPOLATION_ORDER 10
+static bool is_track_query( const char *mask)
+{
+   int i;
 
-/* If observer_loc == NULL,  we just compute positions without any light-time
-lag considered.  Otherwise,  we start out assuming a lag of 0.07 seconds,
-about right for most navsats.  That gets us a highly accurate distance,
-and a second iteration gets us as good as we're gonna get.  A more
-thorough implementation would examine how much the light-time lag changed;
-then,  if the observer_loc were near Saturn,  it would do another iteration
-or two until the light-time lag converged near an hour and a half.  But
-this should suffice for ordinary purposes. */
+   if( !track || !mask)
+      return( false);
+   for( i = 0; i < MAX_N_GPS_SATS; i++)
+      if( (mask[i] != 0) != (i == track->idx))
+         return( false);
+   return( true);
+}
 
-int get_gps_positions( double *output_coords, const double *observer_loc,
-                            const double mjd_gps)
+/* As get_gps_positions( ),  but only satellites for which mask[idx] is
+non-zero are computed;  the rest are left at zero.  A NULL mask means
+'all of them'. */
+
+int get_gps_positions_masked( double *output_coords,
+      const double *observer_loc, const double mjd_gps, const char *mask)
 {
-   const double jan_6_1980 = 44244.0;
-   const double glumphs = (mjd_gps - jan_6_1980) * (double)glumphs_per_day;
-   const int iglumph = (int)glumphs + 1 - INTERPOLATION_ORDER / 2;
-   double *posns[INTERPOLATION_ORDER];
-   const double interpolation_loc = glumphs - (double)iglumph;
-   int i, j, err_code;
+   double interpolation_loc;
+   int i, err_code;
 
    memset( is_from_tle, 0, MAX_N_GPS_SATS);
    for( i = 0; i < MAX_N_GPS_SATS * 3; i++)
       output_coords[i] = 0.;
-   for( i = 0; i < INTERPOLATION_ORDER; i++)
+   if( is_track_query( mask))
       {
-      posns[i] = get_tabulated_gps_posns( iglumph + i, &err_code, false);
-      if( !posns[i])       /* maybe we need to download data */
-         posns[i] = get_tabulated_gps_posns( iglumph + i, &err_code, true);
-      if( !posns[i])
-         return( err_code);
+      get_track_position( output_coords + track->idx * 3, observer_loc,
+                                                      mjd_gps);
+      return( 0);
       }
+   if( !update_sweep_window( mjd_gps, &interpolation_loc, &err_code, true))
+      return( err_code);
    for( i = 0; i < MAX_N_GPS_SATS; i++)
+      if( !mask || mask[i])
+         interpolate_one_sat( i, interpolation_loc, observer_loc,
+                                 output_coords + i * 3);
+   return( err_code);
+}
+
+int get_gps_positions( double *output_coords, const double *observer_loc,
+                            const double mjd_gps)
+{
+   return( get_gps_positions_masked( output_coords, observer_loc, mjd_gps,
+                                          NULL));
+}
+
+/* Weights w[i] such that the Lagrange polynomial through y[0...n_pts-1]
+(at x = 0, 1, ... n_pts - 1) is sum( w[i] * y[i]),  and dw[i] and d2w[i]
+such that its first and second derivatives are sum( dw[i] * y[i]) and
+sum( d2w[i] * y[i]).  Unlike interpolate( ),  these are computed without
+dividing by (x - i),  so x can be on an abscissa.  This is O(n_pts^4),
+but is only done once per time. */
+
+static void set_lagrange_weights( const double x, const int n_pts,
+                                    double *w, double *dw, double *d2w)
+{
+   int i, j, k, l;
+
+   for( i = 0; i < n_pts; i++)
       {
-      double tarray[3][INTERPOLATION_ORDER];
-      bool got_data = true;
-      int pass;
-      double light_time_lag = 0.07;   /* initial guess */
+      double denom = 1., prod = 1., dsum = 0., d2sum = 0.;
+
+      for( j = 0; j < n_pts; j++)
+         if( j != i)
+            {
+            double dprod = 1.;
+
+            denom *= (double)( i - j);
+            prod *= x - (double)j;
+            for( k = 0; k < n_pts; k++)
+               if( k != i && k != j)
+                  {
+                  double d2prod = 1.;
+
+                  dprod *= x - (double)k;
+                  for( l = 0; l < n_pts; l++)
+                     if( l != i && l != j && l != k)
+                        d2prod *= x - (double)l;
+                  d2sum += d2prod;
+                  }
+            dsum += dprod;
+            }
+      w[i] = prod / denom;
+      dw[i] = dsum / denom;
+      d2w[i] = d2sum / denom;
+      }
+}
+
+/* Positions of the satellites as seen from each of 'n_sites' observers,
+for (say) a network of stations all wanting listings for the same time.
+Output for satellite 'idx' from site 's' goes to output_coords[(s *
+MAX_N_GPS_SATS + idx) * 3],  and observer_locs[s * 3] gives the site.
+
+   The interpolation window and Lagrange weights are set up once,  and
+each satellite's geocentric position,  velocity,  and acceleration
+computed once.  For each site,  the light-time-lagged position is then
+found from those by a second-order Taylor step,  instead of
+re-interpolating.  Over the ~0.07 second lag,  the neglected terms amount
+to well under a micron.
+Light-time is iterated twice and the earth's rotation removed,  just as in
+interpolate_one_sat( ).  'mask' is as for get_gps_positions_masked( ). */
 
-      for( j = 0; j < INTERPOLATION_ORDER && got_data; j++)
+int get_gps_positions_multi( double *output_coords,
+            const double *observer_locs, const int n_sites,
+            const double mjd_gps, const char *mask)
+{
+   double interpolation_loc;
+   double w[INTERPOLATION_ORDER], dw[INTERPOLATION_ORDER];
+   double d2w[INTERPOLATION_ORDER];
+   int i, j, k, site, pass, err_code;
+
+   memset( is_from_tle, 0, MAX_N_GPS_SATS);
+   for( i = 0; i < n_sites * MAX_N_GPS_SATS * 3; i++)
+      output_coords[i] = 0.;
+   if( !update_sweep_window( mjd_gps, &interpolation_loc, &err_code, true))
+      return( err_code);
+   set_lagrange_weights( interpolation_loc, INTERPOLATION_ORDER, w, dw, d2w);
+   for( i = 0; i < MAX_N_GPS_SATS; i++)
+      if( (!mask || mask[i]) && !sweep->n_missing[i])
          {
-         double *tptr = posns[j] + i * 3;
+         double posn[3], vel[3], accel[3];    /* km,  km/s,  km/s^2 */
 
-         if( tptr[0] == 0. && tptr[1] == 0. && tptr[2] == 0.)
-            got_data = false;
-         tarray[0][j] = tptr[0];
-         tarray[1][j] = tptr[1];
-         tarray[2][j] = tptr[2];
-         }
-      if( got_data)
-         for( pass = 0; pass < 2; pass++)
+         for( j = 0; j < 3; j++)
+            {
+            const double *node = sweep->node[i][j] + sweep->first;
+
+            posn[j] = vel[j] = accel[j] = 0.;
+            for( k = 0; k < INTERPOLATION_ORDER; k++)
+               {
+               posn[j] += w[k] * node[k];
+               vel[j] += dw[k] * node[k];
+               accel[j] += d2w[k] * node[k];
+               }
+            vel[j] /= seconds_per_glumph;
+            accel[j] /= seconds_per_glumph * seconds_per_glumph;
+            }
+         for( site = 0; site < n_sites; site++)
             {
-            double *tptr = output_coords + i * 3;
-            double dist_squared = 0., delta;
-            const double delay = light_time_lag / seconds_per_glumph;
+            double *output = output_coords + (site * MAX_N_GPS_SATS + i) * 3;
+            const double *observer_loc = observer_locs + site * 3;
+            double light_time_lag = 0.07;   /* initial guess */
 
-            for( j = 0; j < 3; j++)
+            for( pass = 0; pass < 2; pass++)
                {
-               tptr[j] = interpolate( tarray[j],
-                                     interpolation_loc - delay,
-                                     INTERPOLATION_ORDER);
-               if( observer_loc)
-                  delta = tptr[j] - observer_loc[j];
-               else
-                  delta = 0.;
-               dist_squared += delta * delta;
+               double dist_squared = 0.;
+
+               for( j = 0; j < 3; j++)
+                  {
+                  const double delta = light_time_lag * (-vel[j]
+                                 + accel[j] * light_time_lag / 2.);
+
+                  output[j] = posn[j] + delta;
+                  dist_squared += (output[j] - observer_loc[j])
+                                * (output[j] - observer_loc[j]);
+                  }
+               light_time_lag = sqrt( dist_squared) / SPEED_OF_LIGHT;
+               rotate_vect( output, 2. * pi * light_time_lag / seconds_per_day);
                }
-            light_time_lag = sqrt( dist_squared) / SPEED_OF_LIGHT;
-            rotate_vect( tptr, 2. * pi * light_time_lag / seconds_per_day);
             }
+         }
+   return( err_code);
+}
+
+/* Rough positions,  for deciding which satellites are worth computing
+in full :  cubic interpolation through the four tabulated positions
+nearest the given time,  with no light-time lag.  With the usual
+fifteen-minute spacing of .sp3 files,  that's good to a few hundred
+meters for navsats,  and costs a fraction of the full computation.
+Positions are left at zero for satellites we've no data for. */
+
+#define ROUGH_INTERPOLATION_ORDER 4
+
+int get_rough_gps_positions( double *output_coords, const double mjd_gps)
+{
+   const int offset = (INTERPOLATION_ORDER - ROUGH_INTERPOLATION_ORDER) / 2;
+   double interpolation_loc;
+   int i, j, err_code;
+
+   for( i = 0; i < MAX_N_GPS_SATS * 3; i++)
+      output_coords[i] = 0.;
+   if( !update_sweep_window( mjd_gps, &interpolation_loc, &err_code, true))
+      return( err_code);
+   for( i = 0; i < MAX_N_GPS_SATS; i++)
+      if( !sweep->n_missing[i])
+         for( j = 0; j < 3; j++)
+            output_coords[i * 3 + j] = interpolate(
+                  sweep->node[i][j] + sweep->first + offset,
+                  interpolation_loc - (double)offset,
+                  ROUGH_INTERPOLATION_ORDER);
+   return( err_code);
+}
+
+/* As above,  but for the single satellite with index 'idx' (see
+desig_from_index( )).  Root-finding,  for example,  may need many
+evaluations for one satellite,  and doing all of them each time would be
+a waste.  The position is left at zero if we've no data for it. */
+
+int get_gps_position( double *output_coord, const double *observer_loc,
+                            const double mjd_gps, const int idx)
+{
+   double interpolation_loc;
+   int err_code;
+
+   output_coord[0] = output_coord[1] = output_coord[2] = 0.;
+   if( track && idx == track->idx)
+      {
+      get_track_position( output_coord, observer_loc, mjd_gps);
+      return( 0);
       }
+   if( update_sweep_window( mjd_gps, &interpolation_loc, &err_code, true)
+                     && idx >= 0 && idx < MAX_N_GPS_SATS)
+      interpolate_one_sat( idx, interpolation_loc, observer_loc,
+                                 output_coord);
    return( err_code);
 }
 
@@ -728,6 +3838,12 @@ char *fgets_trimmed( char *buff, size_t max_bytes, FILE *ifile)
    return( rval);
 }
 
+/* Returns a NULL-terminated array of pointers to the lines of the file,
+with line ends removed (as with fgets_trimmed( )).  The pointers and text
+are all in one block,  so the caller just free()s the return value.  The
+file is read in once,  line feeds counted,  and the block realloc()ed to
+make room for the pointers ahead of the text. */
+
 char **load_file_into_memory( const char *filename, size_t *n_lines)
 {
    FILE *ifile = fopen( filename, "rb");
@@ -735,28 +3851,42 @@ char **load_file_into_memory( const char *filename, size_t *n_lines)
 
    if( ifile)
       {
-      size_t filesize = 0, lines_read = 0;
-      char buff[400];
+      size_t n_bytes, lines_read = 0, i;
+      char *text;
 
-      while( fgets_trimmed( buff, sizeof( buff), ifile))
+      fseek( ifile, 0L, SEEK_END);
+      n_bytes = (size_t)ftell( ifile);
+      fseek( ifile, 0L, SEEK_SET);
+      text = (char *)malloc( n_bytes + 1);
+      n_heap_allocs++;
+      if( text && fread( text, 1, n_bytes, ifile) == n_bytes)
          {
-         lines_read++;
-         filesize += strlen( buff) + 1;
+         for( i = 0; i < n_bytes; i++)
+            if( text[i] == '\n')
+               lines_read++;
+         if( n_bytes && text[n_bytes - 1] != '\n')
+            lines_read++;           /* last line lacks a line feed */
+         rval = (char **)realloc( text,
+                        (lines_read + 1) * sizeof( char *) + n_bytes + 1);
+         n_heap_allocs++;
          }
-      rval = (char **)malloc( filesize + (lines_read + 1) *  sizeof( char *));
-      if( rval &&
-             (rval[0] = (char *)( rval + lines_read + 1)) != NULL)
+      if( rval)
          {
-         fseek( ifile, 0L, SEEK_SET);
-         lines_read = 0;
-         while( fgets_trimmed( buff, sizeof( buff), ifile))
+         text = (char *)( rval + lines_read + 1);
+         memmove( text, rval, n_bytes);
+         text[n_bytes] = '\0';
+         for( i = 0; i < lines_read; i++)
             {
-            strcpy( rval[lines_read], buff);
-            rval[lines_read + 1] = rval[lines_read] + strlen( buff) + 1;
-            lines_read++;
+            char *next_line = text + strcspn( text, "\n") + 1;
+
+            rval[i] = text;
+            text[strcspn( text, "\r\n")] = '\0';
+            text = next_line;
             }
          rval[lines_read] = NULL;
          }
+      else
+         free( text);
       fclose( ifile);
       if( n_lines)
          *n_lines = lines_read;
@@ -937,3 +4067,165 @@ int get_gps_positions_from_tle( const char *tle_filename,
    fclose( ifile);
    return( rval);
 }
+
+/* When there aren't yet precise positions for the time wanted,  a query
+has to download files,  which can take tens of seconds;  a web user
+would rather not wait.  get_gps_positions_async( ) returns at once.  If
+precise positions can be had without downloading,  they're computed just
+as get_gps_positions( ) would compute them,  and GPS_QUERY_DONE is
+returned.  Otherwise,  the background loader (see above) is started on
+the glumphs needed,  and GPS_QUERY_PENDING is returned.  Either way,
+satellites lacking precise positions get positions from TLEs,  flagged
+in is_from_tle[] as usual.
+
+   The precise positions are delivered,  through 'callback',  by
+finish_gps_queries( ).  That's called from the querying thread,  since
+the cache isn't thread-safe;  the loader just reads the files,  and the
+positions are computed where the cache lives.  A server might call it
+with 'wait' = false now and then;  a CGI program would show the TLE
+positions,  flush its output,  and call it with 'wait' = true.  The
+callback gets an err_code of zero if there were precise positions,  -1
+if not (the loader found no files,  so all positions are from TLEs).
+Without threads,  get_gps_positions_async( ) just downloads what's
+needed and returns GPS_QUERY_DONE. */
+
+typedef struct gps_query
+{
+   struct gps_query *next;
+   double mjd_gps, observer_loc[3];
+   bool have_observer, loader_started;
+   char tle_filename[255];
+   gps_query_fn_t callback;
+   void *context;
+} gps_query_t;
+
+static gps_query_t *pending_queries;
+
+/* Precise positions where we have them (downloading files only if
+'fetch_files' is set),  and TLE positions,  if 'tle_filename' is
+non-NULL,  for the rest.  Returns 0 if there were precise positions,
+-1 if not. */
+
+static int get_best_positions( double *output_coords,
+               const double *observer_loc, const double mjd_gps,
+               const char *tle_filename, const bool fetch_files)
+{
+   double interpolation_loc;
+   int i, err_code, rval = -1;
+
+   memset( is_from_tle, 0, MAX_N_GPS_SATS);
+   for( i = 0; i < MAX_N_GPS_SATS * 3; i++)
+      output_coords[i] = 0.;
+   if( update_sweep_window( mjd_gps, &interpolation_loc, &err_code,
+                                                   fetch_files))
+      {
+      for( i = 0; i < MAX_N_GPS_SATS; i++)
+         interpolate_one_sat( i, interpolation_loc, observer_loc,
+                                 output_coords + i * 3);
+      rval = 0;
+      }
+   if( tle_filename)
+      get_gps_positions_from_tle( tle_filename, output_coords, mjd_gps);
+   return( rval);
+}
+
+int get_gps_positions_async( double *output_coords,
+            const double *observer_loc, const double mjd_gps,
+            const char *tle_filename, gps_query_fn_t callback, void *context)
+{
+   double interpolation_loc;
+   const int iglumph = first_interpolation_glumph( mjd_gps,
+                                                &interpolation_loc);
+   gps_query_t *query, **tptr = &pending_queries;
+   int rval;
+
+   if( !get_best_positions( output_coords, observer_loc, mjd_gps,
+                                    tle_filename, false))
+      return( GPS_QUERY_DONE);
+   rval = start_gps_loader( iglumph, iglumph + INTERPOLATION_ORDER - 1);
+   if( rval == -2)         /* no threads;  we'll just have to wait */
+      {
+      get_best_positions( output_coords, observer_loc, mjd_gps,
+                                    tle_filename, true);
+      return( GPS_QUERY_DONE);
+      }
+   query = (gps_query_t *)calloc( 1, sizeof( gps_query_t));
+   assert( query);
+   n_heap_allocs++;
+   query->mjd_gps = mjd_gps;
+   if( observer_loc)
+      {
+      memcpy( query->observer_loc, observer_loc, 3 * sizeof( double));
+      query->have_observer = true;
+      }
+   query->loader_started = !rval;   /* if it's busy,  we'll start it later */
+   if( tle_filename)
+      snprintf( query->tle_filename, sizeof( query->tle_filename), "%s",
+                                    tle_filename);
+   query->callback = callback;
+   query->context = context;
+   while( *tptr)                    /* queries are answered in order */
+      tptr = &(*tptr)->next;
+   *tptr = query;
+   return( GPS_QUERY_PENDING);
+}
+
+/* Calls back with precise positions for pending queries (see above)
+whose files have been loaded,  starting the loader for those still
+needing it.  If 'wait' is set,  this keeps at it until all are done.
+Returns the number of queries still pending. */
+
+int finish_gps_queries( const bool wait)
+{
+   gps_query_t *query;
+   int rval = 0;
+
+   while( (query = pending_queries) != NULL)
+      {
+      const double *observer_loc =
+                  (query->have_observer ? query->observer_loc : NULL);
+      const char *tle_filename =
+                  (*query->tle_filename ? query->tle_filename : NULL);
+      double output_coords[MAX_N_GPS_SATS * 3];
+      int err_code;
+
+      if( is_gps_loader_running( ))
+         {
+         if( !wait)
+            break;
+         wait_for_gps_loader( );
+         }
+      err_code = get_best_positions( output_coords, observer_loc,
+                        query->mjd_gps, tle_filename, false);
+      if( err_code && !query->loader_started)
+         {
+         double interpolation_loc;
+         const int iglumph = first_interpolation_glumph( query->mjd_gps,
+                                                &interpolation_loc);
+
+         if( !start_gps_loader( iglumph, iglumph + INTERPOLATION_ORDER - 1))
+            {
+            query->loader_started = true;
+            continue;
+            }
+         }
+      pending_queries = query->next;
+      query->callback( output_coords, query->mjd_gps, err_code,
+                                             query->context);
+      free( query);
+      }
+   for( query = pending_queries; query; query = query->next)
+      rval++;
+   return( rval);
+}
+
+static void free_gps_queries( void)
+{
+   while( pending_queries)
+      {
+      gps_query_t *next = pending_queries->next;
+
+      free( pending_queries);
+      pending_queries = next;
+      }
+}
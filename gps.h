@@ -1,7 +1,49 @@
 
 void free_cached_gps_positions( void);
+
+typedef struct
+{
+   long hits, misses, evictions, reloads;
+   long n_glumphs, n_files;
+   size_t n_bytes, budget;
+   long n_heap_allocs;
+   long shared_hits, shared_stores;
+   long background_loads;
+} gps_cache_stats_t;
+
+void set_gps_cache_budget( const size_t n_bytes);
+void get_gps_cache_stats( gps_cache_stats_t *stats);
+int use_shared_gps_cache( const char *shm_name, const size_t n_bytes);
+int load_gps_positions_in_background( const double mjd_gps);
+bool is_gps_loader_running( void);
+void wait_for_gps_loader( void);
+int write_merged_gps_day( const double mjd_gps, const bool fetch_files);
+int get_merged_gps_sources( const double mjd_gps, const char **sources);
+int archive_gps_days( const double mjd_start, const double mjd_end,
+                                             const bool fetch_files);
 int get_gps_positions( double *output_coords, const double *observer_loc,
                             const double mjd_gps);
+int get_gps_position( double *output_coord, const double *observer_loc,
+                            const double mjd_gps, const int idx);
+int get_gps_positions_masked( double *output_coords,
+      const double *observer_loc, const double mjd_gps, const char *mask);
+int get_rough_gps_positions( double *output_coords, const double mjd_gps);
+void set_gps_track( const char *desig);
+
+#define GPS_QUERY_DONE        0
+#define GPS_QUERY_PENDING     1
+
+typedef void (*gps_query_fn_t)( const double *output_coords,
+                  const double mjd_gps, const int err_code, void *context);
+
+int get_gps_positions_async( double *output_coords,
+            const double *observer_loc, const double mjd_gps,
+            const char *tle_filename, gps_query_fn_t callback, void *context);
+int finish_gps_queries( const bool wait);
+
+int get_gps_positions_multi( double *output_coords,
+            const double *observer_locs, const int n_sites,
+            const double mjd_gps, const char *mask);
 
 char *desig_from_index( const int idx);
 int get_gps_positions_from_tle( const char *tle_filename,
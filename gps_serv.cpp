@@ -0,0 +1,441 @@
+/* gps_serv.cpp: long-running server version of the GPS satellite tools
+
+Copyright (C) 2026, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.    */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "cgi_args.h"
+#include "rcache.h"
+#include "gps.h"
+
+/* 'list_cgi.cpp' is run as a CGI program,  meaning a fresh process for
+each request.  That process has to load EOPs,  'names.txt',  the
+observatory files,  and the GNSS TLEs,  and then parse .sp3 files into
+an empty cache.  For a single listing,  that startup can take much
+longer than the actual computation.
+
+   This program instead stays running.  It listens for HTTP requests
+on a local TCP port (by default 127.0.0.1:8123;  put it behind a
+'ProxyPass' or similar on the public-facing web server) or on a Unix
+socket.  Requests carry the same fields as those accepted by the CGI
+version ('time',  'obscode',  'obj',  'step',  'n_steps',  'sort',
+'min_alt',  'ast',  etc.;  see 'cgi_args.cpp'),  either in the query
+string of a GET or as a url-encoded or multipart POST.  Each request is
+handed to dummy_main( ) in 'list_gps.cpp',  with 'keep_data_loaded' set
+so that EOPs,  observatory data,  and cached positions stay warm between
+requests.  Output goes straight back over the socket.  As with the CGI
+version,  listings go through the result cache in 'rcache.cpp'.
+
+   Usage is
+
+gps_serv [-p port] [-u socket_path] [-d directory] [-l log_file] [-b MB]
+
+   -d changes to the given directory at startup,  which should contain
+the same files the CGI version expects (finals.mix,  names.txt,  etc.)
+-b sets the most memory (in megabytes) used for cached GNSS positions;
+since the server never frees them,  this is what keeps it from growing
+without limit as requests come in for scattered dates.  */
+
+extern bool keep_data_loaded;                            /* list_gps.cpp */
+
+#define MAX_REQUEST_SIZE 1000000
+
+/* Requests are handled one at a time,  so a client that connects and
+then sends nothing (or sends it a byte at a time) would hold up everyone
+else.  So a client gets REQUEST_TIMEOUT seconds to send the whole
+request,  and each write of the reply may block for at most
+SEND_TIMEOUT seconds;  after that,  the connection is dropped. */
+
+#define REQUEST_TIMEOUT    10.
+#define SEND_TIMEOUT       10
+
+static double current_seconds( void)
+{
+   struct timeval tv;
+
+   gettimeofday( &tv, NULL);
+   return( (double)tv.tv_sec + (double)tv.tv_usec * 1e-6);
+}
+
+/* Reads an HTTP request into 'buff',  up to the end of the body as given
+by 'Content-Length'.  Returns the number of bytes read,  or -1 if the
+client hung up/sent garbage/took more than REQUEST_TIMEOUT seconds.
+'body_offset' gets the byte offset of the body,  just past the blank
+line ending the headers. */
+
+static int read_http_request( const int sock, char *buff, const size_t buffsize,
+                              size_t *body_offset)
+{
+   const double deadline = current_seconds( ) + REQUEST_TIMEOUT;
+   size_t n_read = 0, content_length = 0;
+   char *end_of_headers = NULL;
+
+   *body_offset = 0;
+   while( n_read < buffsize - 1)
+      {
+      const int ms_left = (int)( (deadline - current_seconds( )) * 1000.);
+      struct pollfd pfd;
+      ssize_t n;
+
+      pfd.fd = sock;
+      pfd.events = POLLIN;
+      if( ms_left <= 0 || poll( &pfd, 1, ms_left) <= 0)
+         return( -1);
+      n = read( sock, buff + n_read, buffsize - 1 - n_read);
+      if( n <= 0)
+         return( -1);
+      n_read += (size_t)n;
+      buff[n_read] = '\0';
+      if( !end_of_headers && (end_of_headers = strstr( buff, "\r\n\r\n")) != NULL)
+         {
+         const char *tptr = strstr( buff, "Content-Length:");
+
+         if( !tptr)
+            tptr = strstr( buff, "content-length:");
+         if( tptr && tptr < end_of_headers)
+            content_length = (size_t)atol( tptr + 15);
+         *body_offset = (size_t)( end_of_headers - buff) + 4;
+         }
+      if( end_of_headers && n_read >= *body_offset + content_length)
+         return( (int)n_read);
+      }
+   return( -1);
+}
+
+static int hex_digit( const char c)
+{
+   if( c >= '0' && c <= '9')
+      return( c - '0');
+   if( c >= 'a' && c <= 'f')
+      return( c - 'a' + 10);
+   if( c >= 'A' && c <= 'F')
+      return( c - 'A' + 10);
+   return( 0);
+}
+
+/* In-place decoding of '+' to space and %xx to the corresponding byte. */
+
+static void url_decode( char *buff)
+{
+   char *optr = buff;
+
+   while( *buff)
+      {
+      if( *buff == '+')
+         *optr++ = ' ';
+      else if( *buff == '%' && buff[1] && buff[2])
+         {
+         *optr++ = (char)( hex_digit( buff[1]) * 16 + hex_digit( buff[2]));
+         buff += 2;
+         }
+      else
+         *optr++ = *buff;
+      buff++;
+      }
+   *optr = '\0';
+}
+
+/* Parses 'field=value&field=value...' text,  as found in a GET query
+string or url-encoded POST body.  The text is modified in place. */
+
+static void parse_url_encoded_fields( cgi_args_t *cargs, char *text)
+{
+   while( *text)
+      {
+      char *next = strchr( text, '&'), *value;
+
+      if( next)
+         *next++ = '\0';
+      else
+         next = text + strlen( text);
+      value = strchr( text, '=');
+      if( value)
+         {
+         *value++ = '\0';
+         url_decode( text);
+         url_decode( value);
+         add_cgi_field( cargs, text, value);
+         }
+      text = next;
+      }
+}
+
+/* multipart/form-data is what browsers send for file uploads,  i.e.,
+when astrometry is sent from a file rather than pasted in.  Each part
+starts with the boundary string,  some headers including 'name="field"',
+a blank line,  then the data,  then CR/LF and the next boundary. */
+
+static void parse_multipart_fields( cgi_args_t *cargs, char *body,
+                     const size_t body_len, const char *boundary)
+{
+   char marker[100];
+   size_t marker_len;
+   char *end = body + body_len;
+
+   snprintf( marker, sizeof( marker), "--%s", boundary);
+   marker_len = strlen( marker);
+   body = strstr( body, marker);
+   while( body && body + marker_len < end && body[marker_len] != '-')
+      {
+      char *headers_end = strstr( body, "\r\n\r\n");
+      char *name = strstr( body, "name=\""), *data, *data_end, *name_end;
+
+      if( !headers_end || !name || name > headers_end)
+         return;
+      name += 6;
+      name_end = (char *)memchr( name, '"', headers_end - name);
+      data = headers_end + 4;
+      data_end = strstr( data, marker);
+      if( !data_end)
+         return;
+      body = data_end;
+      if( data_end - 2 >= data && data_end[-2] == '\r')
+         data_end -= 2;
+      *data_end = '\0';
+      if( name_end)        /* skip parts with a malformed name */
+         {
+         *name_end = '\0';
+         add_cgi_field( cargs, name, data);
+         }
+      }
+}
+
+static void parse_request_fields( cgi_args_t *cargs, char *buff,
+                          const size_t n_read, const size_t body_offset)
+{
+   char *body = buff + body_offset;
+   char *content_type = strstr( buff, "Content-Type:");
+
+   if( !content_type)
+      content_type = strstr( buff, "content-type:");
+   if( content_type && content_type > body)
+      content_type = NULL;
+   if( !memcmp( buff, "GET ", 4))
+      {
+      char *query = strchr( buff, '?');
+      char *end_of_url = strchr( buff + 4, ' ');
+
+      if( query && end_of_url && query < end_of_url)
+         {
+         *end_of_url = '\0';
+         parse_url_encoded_fields( cargs, query + 1);
+         }
+      }
+   else if( content_type && strstr( content_type, "multipart/form-data"))
+      {
+      const char *boundary = strstr( content_type, "boundary=");
+      char boundary_text[80];
+
+      if( boundary && sscanf( boundary + 9, "%79[^\r\n;]", boundary_text) == 1)
+         parse_multipart_fields( cargs, body, n_read - body_offset,
+                                          boundary_text);
+      }
+   else
+      parse_url_encoded_fields( cargs, body);
+}
+
+static FILE *log_file;
+
+/* stdout is redirected to the socket while dummy_main( ) runs,  then
+restored.  We flush before each redirection so that nothing buffered for
+one destination winds up in the other. */
+
+static int handle_request( const int sock, char *buff)
+{
+   const double t0 = current_seconds( );
+   size_t body_offset;
+   const int n_read = read_http_request( sock, buff, MAX_REQUEST_SIZE,
+                                     &body_offset);
+   cgi_args_t cargs;
+   char ast_filename[40];
+   int rval = -1, saved_stdout;
+
+   if( n_read <= 0)
+      return( -1);
+   snprintf( ast_filename, sizeof( ast_filename), "temp%d.ast", (int)getpid( ));
+   init_cgi_args( &cargs, ast_filename);
+   parse_request_fields( &cargs, buff, (size_t)n_read, body_offset);
+   finish_cgi_args( &cargs);
+   fflush( stdout);
+   saved_stdout = dup( STDOUT_FILENO);
+   dup2( sock, STDOUT_FILENO);
+   printf( "HTTP/1.0 200 OK\r\n");
+   printf( "Content-type: text/html\r\n\r\n");
+   printf( "<pre>");
+   if( cargs.show_cache_stats)
+      {
+      gps_cache_stats_t stats;
+
+      show_result_cache_stats( "rcache.txt");
+      get_gps_cache_stats( &stats);
+      printf( "GNSS positions: %ld hits, %ld misses, %ld evictions, %ld reloads\n",
+               stats.hits, stats.misses, stats.evictions, stats.reloads);
+      printf( "   %ld glumphs from %ld files,  %lu of %lu bytes,  %ld allocations\n",
+               stats.n_glumphs, stats.n_files, (unsigned long)stats.n_bytes,
+               (unsigned long)stats.budget, stats.n_heap_allocs);
+      printf( "   %ld glumphs from shared memory,  %ld files put there\n",
+               stats.shared_hits, stats.shared_stores);
+      rval = 0;
+      }
+   else
+      rval = cached_dummy_main( cargs.n_args, (const char **)cargs.args,
+                                    "rcache.txt");
+   fflush( stdout);
+   dup2( saved_stdout, STDOUT_FILENO);
+   close( saved_stdout);
+   if( cargs.distribution_allowed)
+      {
+      char new_name[40];
+
+      snprintf( new_name, sizeof( new_name), "ast_%x.txt", (unsigned)time( NULL));
+      rename( ast_filename, new_name);
+      }
+   if( log_file)
+      {
+      const time_t t = time( NULL);
+      int i;
+
+      fprintf( log_file, "%.24s %.3f s rval %d:", asctime( gmtime( &t)),
+                     current_seconds( ) - t0, rval);
+      for( i = 1; i < cargs.n_args; i++)
+         fprintf( log_file, " '%s'", cargs.args[i]);
+      fprintf( log_file, "\n");
+      fflush( log_file);
+      }
+   free_cgi_args( &cargs);
+   return( rval);
+}
+
+static int create_listening_socket( const int port, const char *unix_path)
+{
+   int sock;
+
+   if( unix_path)
+      {
+      struct sockaddr_un addr;
+
+      sock = socket( AF_UNIX, SOCK_STREAM, 0);
+      memset( &addr, 0, sizeof( addr));
+      addr.sun_family = AF_UNIX;
+      strncpy( addr.sun_path, unix_path, sizeof( addr.sun_path) - 1);
+      unlink( unix_path);
+      if( sock < 0 || bind( sock, (struct sockaddr *)&addr, sizeof( addr)))
+         return( -1);
+      }
+   else
+      {
+      struct sockaddr_in addr;
+      const int one = 1;
+
+      sock = socket( AF_INET, SOCK_STREAM, 0);
+      if( sock < 0)
+         return( -1);
+      setsockopt( sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof( one));
+      memset( &addr, 0, sizeof( addr));
+      addr.sin_family = AF_INET;
+      addr.sin_port = htons( (unsigned short)port);
+      addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK);
+      if( bind( sock, (struct sockaddr *)&addr, sizeof( addr)))
+         return( -1);
+      }
+   if( listen( sock, 16))
+      return( -1);
+   return( sock);
+}
+
+int main( const int argc, const char **argv)
+{
+   int i, port = 8123, sock;
+   const char *unix_path = NULL;
+   char *buff = (char *)malloc( MAX_REQUEST_SIZE);
+
+   assert( buff);
+   for( i = 1; i < argc; i++)
+      if( argv[i][0] == '-' && i < argc - 1)
+         {
+         const char *arg = argv[++i];
+
+         switch( argv[i - 1][1])
+            {
+            case 'b':
+               set_gps_cache_budget( (size_t)( atof( arg) * 1024. * 1024.));
+               break;
+            case 'd':
+               if( chdir( arg))
+                  {
+                  perror( arg);
+                  return( -1);
+                  }
+               break;
+            case 'l':
+               log_file = fopen( arg, "a");
+               break;
+            case 'p':
+               port = atoi( arg);
+               break;
+            case 'u':
+               unix_path = arg;
+               break;
+            default:
+               fprintf( stderr, "Option '%s' not understood\n", argv[i - 1]);
+               return( -1);
+            }
+         }
+   sock = create_listening_socket( port, unix_path);
+   if( sock < 0)
+      {
+      perror( "Couldn't set up listening socket");
+      return( -1);
+      }
+   signal( SIGPIPE, SIG_IGN);    /* client hung up;  don't die over it */
+   keep_data_loaded = true;
+   if( unix_path)
+      fprintf( stderr, "Listening on %s\n", unix_path);
+   else
+      fprintf( stderr, "Listening on 127.0.0.1:%d\n", port);
+   for( ;;)
+      {
+      const int client = accept( sock, NULL, NULL);
+
+      if( client >= 0)
+         {
+         struct timeval timeout;
+
+         timeout.tv_sec = SEND_TIMEOUT;
+         timeout.tv_usec = 0;
+         setsockopt( client, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+                                             sizeof( timeout));
+         handle_request( client, buff);
+         close( client);
+         }
+      }
+   free( buff);
+   return( 0);
+}
@@ -38,136 +38,101 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #else
    #include "cgi_func.h"
 #endif
+#include "cgi_args.h"
+#include "admit.h"
+#include "rcache.h"
 
-int dummy_main( const int argc, const char **argv);      /* list_cgi.cpp */
+int dummy_main( const int argc, const char **argv);      /* list_gps.cpp */
+
+static void show_busy_message( void)
+{
+   printf( "<h1> Server is busy.  Try again in a minute or two. </h1>");
+   printf( "<p> Your GPS position request is very important to us! </p>");
+   printf( "<p> (I don't really expect this service to get a lot of "
+           "use.  If you see this error several times in a row, "
+           "something else must be wrong; please contact me.)</p>");
+}
+
+/* Requests are admitted (or queued,  or rejected) by the rules in
+'admit.txt';  see 'admit.cpp'.  Each gets one line in the log with its
+queueing time,  run time,  and arguments.  Listings can then come from
+the result cache set up in 'rcache.txt';  see 'rcache.cpp'.  A request
+with a 'cache_stats' field just gets that cache's statistics. */
 
 int main( void)
 {
    const size_t max_buff_size = 1000000;   /* should be enough for anybody */
    char *buff = (char *)malloc( max_buff_size);
-   char time_text[100], observatory_code[20];
-   char field[30];
-   FILE *lock_file = fopen( "lock.txt", "a");
+   char field[30], details[400];
    int rval, i;
-   const time_t t0 = time( NULL);
-   int n_args = 3;
-   char *args[20];
-   bool use_tles = false;
-   bool distribution_allowed = false;
+   cgi_args_t cargs;
+   admit_t adm;
 
-   printf( "Content-type: text/html\n\n");
-   printf( "<pre>");
-   if( !lock_file)
-      {
-      printf( "<h1> Server is busy.  Try again in a minute or two. </h1>");
-      printf( "<p> Your GPS position request is very important to us! </p>");
-      printf( "<p> (I don't really expect this service to get a lot of "
-              "use.  If you see this error several times in a row, "
-              "something else must be wrong; please contact me.)</p>");
-      return( 0);
-      }
-   setvbuf( lock_file, NULL, _IONBF, 0);
-   fprintf( lock_file, "Current time %.24s UTC\n", asctime( gmtime( &t0)));
-   fprintf( lock_file, "list_cgi ver: %s %s\n", __DATE__, __TIME__);
-   avoid_runaway_process( 300);
-   fprintf( lock_file, "300-second limit set\n");
-   args[0] = NULL;
-   args[1] = time_text;
-   args[2] = observatory_code;
-   strcpy( observatory_code, "XXX");
+   init_cgi_args( &cargs, "temp.ast");
    rval = initialize_cgi_reading( );
    if( rval <= 0)
       {
+      printf( "Content-type: text/html\n\n");
+      printf( "<pre>");
       printf( "<p> <b> CGI data reading failed : error %d </b>", rval);
       printf( "This isn't supposed to happen.</p>\n");
       return( 0);
       }
    while( !get_cgi_data( field, buff, NULL, max_buff_size))
+      add_cgi_field( &cargs, field, buff);
+   finish_cgi_args( &cargs);
+   if( cargs.show_cache_stats)
       {
-      char option = 0;
-
-      fprintf( lock_file, "Field '%s': '%s'\n", field, buff);
-      if( !strcmp( field, "time") && strlen( buff) < 80)
-         strcpy( time_text, buff);
-      if( !strcmp( field, "min_alt") && strlen( buff) < 10)
-         option = 'a';
-      if( !strcmp( field, "sort") && strlen( buff) < 10)
-         option = 's';
-      if( !strcmp( field, "relocate") && strlen( buff) < 60
-                     && strlen( buff) > 10)
-         option = 'r';
-      if( !strcmp( field, "n_steps") && strlen( buff) < 10)
-         option = 'n';
-      if( !strcmp( field, "ang_fmt") && *buff == '1')
-         {
-         option = 'd';
-         *buff = '\0';
-         }
-      if( !strcmp( field, "ang_fmt") && *buff == '2')
+      printf( "Content-type: text/html\n\n");
+      printf( "<pre>");
+      show_result_cache_stats( "rcache.txt");
+      free_cgi_args( &cargs);
+      free( buff);
+      return( 0);
+      }
+   *details = '\0';
+   for( i = 1; i < cargs.n_args; i++)
+      if( strlen( details) + strlen( cargs.args[i]) + 4 < sizeof( details))
          {
-         option = 'f';
-         *buff = '\0';
+         strcat( details, (*details ? " '" : "'"));
+         strcat( details, cargs.args[i]);
+         strcat( details, "'");
          }
-      if( !strcmp( field, "step") && strlen( buff) < 10)
-         option = 'i';
-      if( !strcmp( field, "obj") && strlen( buff) < 10)
-         option = 'o';
-      if( !strcmp( field, "use_tles"))
-         use_tles = true;
-      if( !strcmp( field, "distrib"))
-         distribution_allowed = true;
-      if( !strcmp( field, "ast"))
-         {
-         const char *filename = "temp.ast";
-         FILE *ofile = fopen( filename, "wb");
 
-         assert( ofile);
-         fwrite( buff, strlen( buff), 1, ofile);
-         fclose( ofile);
-         strcpy( buff, filename);
-         n_args = 1;
-         option = 'f';
-         }
-      if( !strcmp( field, "obscode") && strlen( buff) < 20
-                                     && strlen( buff) > 2)
-         {
-         strcpy( observatory_code, buff);
-         if( buff[3] == 'v')
-            {
-            option = 'v';
-            observatory_code[3] = *buff = '\0';
-            }
-         }
-      if( option)
-         {
-         args[n_args] = (char *)malloc( strlen( buff) + 3);
-         args[n_args][0] = '-';
-         args[n_args][1] = option;
-         strcpy( args[n_args] + 2, buff);
-         n_args++;
-         }
-      }
-   if( !use_tles)
+   rval = admit_request( &adm, "admit.txt");
+   if( rval != ADMIT_OK)
       {
-      args[n_args] = (char *)malloc( 4);
-      strcpy( args[n_args], "-t1");
-      n_args++;
+      printf( "Status: 503 Service Unavailable\n");
+      printf( "Retry-After: 60\n");
+      printf( "Content-type: text/html\n\n");
+      printf( "<pre>");
+      show_busy_message( );
+      log_request_timing( &adm, rval, details);
+      free_cgi_args( &cargs);
+      free( buff);
+      return( 0);
       }
-   fprintf( lock_file, "Options read and parsed\n");
-   for( i = 0; i < n_args; i++)
-      fprintf( lock_file, "%d: '%s'\n", i, args[i]);
-   rval = dummy_main( n_args, (const char **)args);
-   if( distribution_allowed)
+   printf( "Content-type: text/html\n\n");
+   printf( "<pre>");
+   avoid_runaway_process( 300);
+   rval = cached_dummy_main( cargs.n_args, (const char **)cargs.args,
+                                    "rcache.txt");
+   if( cargs.distribution_allowed)
       {
       time_t t0 = time( NULL);
 
       sprintf( buff, "ast_%x.txt", (unsigned)t0);
-      fprintf( lock_file, "Renaming to '%s'\n", buff);
       rename( "temp.ast", buff);
+      if( strlen( details) + strlen( buff) + 4 < sizeof( details))
+         {
+         strcat( details, " -> ");
+         strcat( details, buff);
+         }
       }
-   fprintf( lock_file, "Done: rval %d\n", rval);
-   for( i = 3; i < n_args; i++)
-      free( args[i]);
+   fflush( stdout);
+   log_request_timing( &adm, rval, details);
+   release_admission( &adm);
+   free_cgi_args( &cargs);
    free( buff);
-   fclose( lock_file);
+   return( 0);
 }
@@ -24,6 +24,16 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include <assert.h>
 #include <math.h>
 #include <time.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/wait.h>
+#endif
 #ifdef __has_include
    #if __has_include(<watdefs.h>)
        #include "watdefs.h"
@@ -45,8 +55,10 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include "lunar.h"         /* for obliquity( ) prototype */
 #include "mpc_func.h"
 #include "gps.h"
+#include "eop_bin.h"
 
 const char *get_name_data( const char *search_str, const int mjd); /* gps.c */
+char **load_file_into_memory( const char *filename, size_t *n_lines); /* gps.c */
 static char *fgets_trimmed( char *buff, const size_t max_bytes, FILE *ifile);
 
 #define EARTH_SEMIMAJOR_AXIS 6378.137
@@ -91,21 +103,40 @@ int snprintf_append( char *string, const size_t max_len,      /* ephem0.cpp */
    return( rval);
 }
 
+/* The observatory files are read into memory once.  For a one-shot run,
+that costs about the same as scanning them.  But in server mode (see
+'gps_serv.cpp'),  they stay loaded from one request to the next,  as do
+the EOPs and cached GNSS positions;  see 'keep_data_loaded' below. */
+
+bool keep_data_loaded = false;
+
+static const char *obs_filenames[3] = { "rovers.txt", "ObsCodes.htm",
+                                                    "ObsCodes.html" };
+static char **obs_lines[3];
+static bool obs_files_loaded = false;
+static bool imprecision_warning_shown, relocation_message_shown;
+
+static void free_observatory_data( void)
+{
+   int i;
+
+   for( i = 0; i < 3; i++)
+      if( obs_lines[i])
+         {
+         free( obs_lines[i]);
+         obs_lines[i] = NULL;
+         }
+   obs_files_loaded = false;
+}
+
 static int get_observer_loc( mpc_code_t *cdata, const char *code)
 {
    int rval = -1, i;
-   static bool imprecision_warning_shown = false;
    static mpc_code_t cached_cdata;
+   static char cached_code[20], cached_name[100];
 
-   if( !strcmp( cached_cdata.code, code))
-      {
-      *cdata = cached_cdata;
-      return( 0);
-      }
    if( relocation[0])
       {
-      static bool relocation_message_shown = false;
-
       rval = get_lat_lon_info( cdata, relocation);
       if( !relocation_message_shown)
          {
@@ -121,26 +152,33 @@ static int get_observer_loc( mpc_code_t *cdata, const char *code)
       relocation_message_shown = true;
       return( rval);
       }
-
-   for( i = 0; i < 3 && rval; i++)
+   if( !strcmp( cached_code, code))
       {
-      const char *filenames[3] = { "rovers.txt", "ObsCodes.htm",
-                                                 "ObsCodes.html" };
-      FILE *ifile = fopen( filenames[i], "rb");
+      *cdata = cached_cdata;
+      return( 0);
+      }
 
-      if( ifile)
+   if( !obs_files_loaded)
+      {
+      for( i = 0; i < 3; i++)
+         obs_lines[i] = load_file_into_memory( obs_filenames[i], NULL);
+      obs_files_loaded = true;
+      }
+   for( i = 0; i < 3 && rval; i++)
+      if( obs_lines[i])
          {
-         char buff[200], *obs_name;
+         char **lines = obs_lines[i];
          const char end_char = (code[3] ? code[3] : ' ');
 
-         while( rval && fgets_trimmed( buff, sizeof( buff), ifile))
-            if( !memcmp( buff, code, 3) && buff[3] == end_char
-                     && get_mpc_code_info( cdata, buff) == 3)
+         for( ; rval && *lines; lines++)
+            if( !memcmp( *lines, code, 3) && (*lines)[3] == end_char
+                     && get_mpc_code_info( cdata, *lines) == 3)
                {
+               const char *buff = *lines;
+
                rval = 0;         /* we got it */
-               obs_name = (char *)malloc( strlen( cdata->name) + 1);
-               strcpy( obs_name, cdata->name);
-               cdata->name = obs_name;
+               snprintf( cached_name, sizeof( cached_name), "%s", cdata->name);
+               cdata->name = cached_name;
                if( buff[4] != '!' && !imprecision_warning_shown)
                   if( buff[12] == ' ' || buff[20] == ' ' || buff[29] == ' ')
                      {
@@ -172,10 +210,9 @@ static int get_observer_loc( mpc_code_t *cdata, const char *code)
                   printf( "Location for (%s) %s found in 'rovers' file\n",
                           cdata->code, cdata->name);
                cached_cdata = *cdata;
+               strncpy( cached_code, code, sizeof( cached_code) - 1);
                }
-         fclose( ifile);
          }
-      }
    return( rval);
 }
 
@@ -241,8 +278,10 @@ typedef struct
    double topo_r;
    double ra, dec, alt, az, elong;
    double motion, posn_ang;
+   double j2000_topo_vel[3];     /* change in j2000_topo over one second */
    bool in_shadow, is_from_tle;
    int norad;
+   int sat_idx;                  /* see desig_from_index( ) */
 } gps_ephem_t;
 
 static void set_ra_dec( gps_ephem_t *loc, const double year)
@@ -269,6 +308,181 @@ static void get_unit_vector_to_sun( const double year, double *vect)
       vect[i] = tvect[i] / tvect[5];
 }
 
+/* Setting up the precession/nutation matrix (which includes the earth's
+rotation and polar motion,  so it takes J2000 vectors to earth-fixed ones)
+and the vector to the sun means evaluating long nutation and VSOP-type
+series,  and we'd do it twice per listing (the second time to get
+motions) and twice per line of astrometry or ephemeris step.
+
+   Instead,  we compute both at 'nodes' spaced 'frame_node_spacing' apart
+(default ten minutes;  set with -c(seconds),  with -c0 meaning 'always
+compute directly') and interpolate.  The matrix is dominated by the
+earth's rotation,  so each node's matrix is first rotated about the z-axis
+by the sidereal rate times the time since the node;  the two results are
+then blended linearly.  What's left to interpolate is precession,
+nutation,  and a daily wobble due to polar motion (of order 0.3") not
+commuting with the earth's rotation.  The last dominates the error,  at
+about 0.3" * (omega * h)^2 / 8,  i.e.,  under 0.1 milliarcsecond for ten-
+minute spacing (it scales as h^2;  an hour gives about 3 mas).  In practice,
+differences from the direct computation are around 0.5 mas,  because a JD
+stored as a double is only good to about 40 microseconds,  during which
+the earth turns about 0.6 mas;  the direct computation has the same
+limitation.  The sun vector is interpolated linearly and renormalized;
+the error is negligible for elongation and shadowing.
+
+   If the two nodes disagree by more than FRAME_MAX_DISCREPANCY radians
+(a leap second,  or a jump in the EOPs),  we fall back to computing
+things directly.  The cache is cleared whenever EOPs are reloaded. */
+
+#define N_FRAME_NODES               32
+#define FRAME_MAX_DISCREPANCY     1e-6
+#define SIDEREAL_RATE (2. * PI * 1.00273781191135448)     /* radians/day */
+
+typedef struct
+{
+   long node;
+   double precess_matrix[9], sun_vect[3];
+} frame_node_t;
+
+static frame_node_t frame_nodes[N_FRAME_NODES];
+static double frame_node_spacing = 600. / seconds_per_day;
+static double frame_cache_spacing;     /* spacing used for cached nodes */
+static bool frame_nodes_valid = false;
+
+static void clear_frame_cache( void)
+{
+   frame_nodes_valid = false;
+}
+
+/* Returns a pointer to the node,  computing it if needed,  or NULL if
+precession couldn't be set up for that time.  */
+
+static const frame_node_t *get_frame_node( const long node)
+{
+   frame_node_t *rval = frame_nodes + ((node % N_FRAME_NODES) + N_FRAME_NODES) % N_FRAME_NODES;
+
+   if( !frame_nodes_valid || frame_cache_spacing != frame_node_spacing)
+      {
+      int i;
+
+      for( i = 0; i < N_FRAME_NODES; i++)
+         frame_nodes[i].node = LONG_MIN;
+      frame_cache_spacing = frame_node_spacing;
+      frame_nodes_valid = true;
+      }
+   if( rval->node != node)
+      {
+      const double year = ((double)node * frame_node_spacing - 2451545.) / 365.25;
+
+      rval->node = LONG_MIN;
+      if( setup_precession_with_nutation_eops( rval->precess_matrix, 2000. + year))
+         return( NULL);
+      get_unit_vector_to_sun( year, rval->sun_vect);
+      rval->node = node;
+      }
+   return( rval);
+}
+
+/* Applies the earth's rotation over 'dt' days to a J2000-to-earth-fixed
+matrix.  Only the first two rows (the equatorial x and y axes) change. */
+
+static void rotate_frame( const double *matrix, const double dt, double *result)
+{
+   const double cos_ang = cos( SIDEREAL_RATE * dt);
+   const double sin_ang = sin( SIDEREAL_RATE * dt);
+   int i;
+
+   for( i = 0; i < 3; i++)
+      {
+      result[i]     =  cos_ang * matrix[i] + sin_ang * matrix[i + 3];
+      result[i + 3] = -sin_ang * matrix[i] + cos_ang * matrix[i + 3];
+      result[i + 6] = matrix[i + 6];
+      }
+}
+
+/* Sets the J2000-to-earth-fixed matrix and unit vector to the sun for
+the given TDT.  Returns the error code from precession setup (zero if
+all went well). */
+
+static int get_earth_frame( const double tdt, double *precess_matrix,
+                                                double *sun_vect)
+{
+   const double year = (tdt - 2451545.) / 365.25;
+
+   if( frame_node_spacing > 0.)
+      {
+      const double t_node = tdt / frame_node_spacing;
+      const long node = (long)floor( t_node);
+      const double dt = tdt - (double)node * frame_node_spacing;
+      const double fraction = dt / frame_node_spacing;
+      const frame_node_t *node0 = get_frame_node( node);
+      const frame_node_t *node1 = get_frame_node( node + 1);
+
+      if( node0 && node1)
+         {
+         double matrix0[9], matrix1[9], discrepancy = 0., r2 = 0.;
+         int i;
+
+         rotate_frame( node0->precess_matrix, dt, matrix0);
+         rotate_frame( node1->precess_matrix, dt - frame_node_spacing, matrix1);
+         for( i = 0; i < 9; i++)
+            {
+            const double diff = fabs( matrix1[i] - matrix0[i]);
+
+            if( discrepancy < diff)
+               discrepancy = diff;
+            precess_matrix[i] = matrix0[i] + fraction * (matrix1[i] - matrix0[i]);
+            }
+         if( discrepancy < FRAME_MAX_DISCREPANCY)
+            {
+            for( i = 0; i < 3; i++)
+               {
+               sun_vect[i] = node0->sun_vect[i]
+                     + fraction * (node1->sun_vect[i] - node0->sun_vect[i]);
+               r2 += sun_vect[i] * sun_vect[i];
+               }
+            r2 = sqrt( r2);
+            for( i = 0; i < 3; i++)
+               sun_vect[i] /= r2;
+            return( 0);
+            }
+         }
+      }
+   get_unit_vector_to_sun( year, sun_vect);
+   return( setup_precession_with_nutation_eops( precess_matrix, 2000. + year));
+}
+
+static void set_alt_az_matrix( double *alt_az_matrix, const mpc_code_t *cdata)
+{
+   const double lat = cdata->lat, lon = cdata->lon;
+
+   alt_az_matrix[0] = -cos( lon) * sin( lat);
+   alt_az_matrix[1] = -sin( lon) * sin( lat);
+   alt_az_matrix[2] =              cos( lat);
+   alt_az_matrix[3] = -sin( lon);
+   alt_az_matrix[4] = cos( lon);
+   alt_az_matrix[5] = 0.;
+   alt_az_matrix[6] = cos( lon) * cos( lat);
+   alt_az_matrix[7] = sin( lon) * cos( lat);
+   alt_az_matrix[8] =             sin( lat);
+}
+
+/* The alt/az matrix depends only on the observer's lat/lon,  which
+rarely changes from one call to the next. */
+
+static const double *get_alt_az_matrix( const mpc_code_t *cdata)
+{
+   static double alt_az_matrix[9], lat = -99., lon = -99.;
+
+   if( lat != cdata->lat || lon != cdata->lon)
+      {
+      lat = cdata->lat;
+      lon = cdata->lon;
+      set_alt_az_matrix( alt_az_matrix, cdata);
+      }
+   return( alt_az_matrix);
+}
+
 static double minimum_altitude = 0.;   /* only show objs above the horizon */
 
 static char *fgets_trimmed( char *buff, const size_t max_bytes, FILE *ifile)
@@ -324,16 +538,134 @@ static void set_designations( const size_t n_sats, gps_ephem_t *loc,
 int tle_usage = USE_TLES_AND_SP3;
 
 #ifdef CGI_VERSION
-const char *tle_path =    "../../tles/all_tle.txt";
+#define DEFAULT_TLE_PATH  "../../tles/all_tle.txt"
 #else
-const char *tle_path =    "../tles/all_tle.txt";
+#define DEFAULT_TLE_PATH  "../tles/all_tle.txt"
 #endif
+
+const char *tle_path = DEFAULT_TLE_PATH;
         /* Above paths are defaults for my ISP's server and my own desktop,
            respectively.  Alter to suit file paths on your machine. */
 
 
+/* Given a satellite's geocentric position in the earth-fixed frame,
+fills in the J2000 geocentric and topocentric vectors,  RA/dec,  alt/az,
+elongation,  and whether it's in the earth's shadow.  'posn' gets the
+observer's location subtracted from it. */
+
+static void set_loc_geometry( gps_ephem_t *loc, double *posn,
+         const double *observer_loc, const double *precess_matrix,
+         const double *alt_az_matrix, const double *sun_vect, const double year)
+{
+   int j;
+   double alt_az_vect[3];
+   double dot_prod, geocentric_dist_2;
+
+   deprecess_vector( precess_matrix, posn, loc->j2000_geo);
+   for( j = 0; j < 3; j++)
+      posn[j] -= observer_loc[j];
+   deprecess_vector( precess_matrix, posn, loc->j2000_topo);
+   precess_vector( alt_az_matrix, posn, alt_az_vect);
+   cartesian_to_polar( alt_az_vect, &loc->az, &loc->alt);
+   set_ra_dec( loc, year);
+   dot_prod = dot_product( loc->j2000_geo, sun_vect);
+   geocentric_dist_2 = dot_product( loc->j2000_geo, loc->j2000_geo);
+   loc->elong = acos( -dot_product( loc->j2000_topo, sun_vect) / loc->topo_r);
+   if( loc->az < 0.)
+      loc->az += PI + PI;
+   loc->in_shadow = ( dot_prod > 0. && geocentric_dist_2 <
+        dot_prod * dot_prod + EARTH_SEMIMAJOR_AXIS * EARTH_SEMIMAJOR_AXIS);
+}
+
+static void get_observer_vector( const mpc_code_t *cdata, double *observer_loc)
+{
+   observer_loc[0] = cos( cdata->lon) * cdata->rho_cos_phi * EARTH_SEMIMAJOR_AXIS;
+   observer_loc[1] = sin( cdata->lon) * cdata->rho_cos_phi * EARTH_SEMIMAJOR_AXIS;
+   observer_loc[2] =                    cdata->rho_sin_phi * EARTH_SEMIMAJOR_AXIS;
+}
+
+/* Listings show only satellites above 'minimum_altitude' and out of the
+earth's shadow,  and astrometry only cares about those near the target.
+Computing the rest in full (ten-point interpolation,  light-time lag,
+aberration,  all done twice to get the motion) is mostly wasted effort.
+
+   A 'cull_t' says which satellites we care about.  set_cull_mask( ) looks
+at rough positions for all satellites (see get_rough_gps_positions( ) in
+'gps.cpp',  good to a kilometer or so) and drops those well outside the
+limits.  The margins are far larger than the errors in rough positions,
+light-time,  aberration,  and a second of motion put together,  so
+nothing that would pass the limits gets dropped.  Satellites with no
+rough position are kept,  since they may yet come from TLEs.  A cull
+with a 'target' needs no rough positions at all;  only that satellite is
+computed,  from its own track (see set_gps_track( ) in 'gps.cpp').  */
+
+typedef struct
+{
+   double min_alt;         /* drop satellites well below this altitude, */
+   bool skip_shadowed;     /* or well within the earth's shadow, */
+   double ra, dec, radius; /* or well away from (ra, dec),  if radius > 0 */
+   const char *target;     /* if non-NULL,  keep only this satellite */
+} cull_t;
+
+#define CULL_ANGLE_MARGIN     (PI / 180.)
+#define CULL_SHADOW_MARGIN    500.           /* km */
+
+static void set_cull_mask( char *mask, const cull_t *cull,
+         const double *rough, const double *observer_loc,
+         const double *precess_matrix, const double *alt_az_matrix,
+         const double *sun_vect)
+{
+   double target_vect[3];
+   const double shadow_radius = EARTH_SEMIMAJOR_AXIS - CULL_SHADOW_MARGIN;
+   int i, j;
+
+   memset( mask, 1, MAX_N_GPS_SATS);
+   target_vect[0] = cos( cull->ra) * cos( cull->dec);
+   target_vect[1] = sin( cull->ra) * cos( cull->dec);
+   target_vect[2] = sin( cull->dec);
+   for( i = 0; i < MAX_N_GPS_SATS; i++)
+      {
+      const double *posn = rough + i * 3;
+      double topo[3], vect[3], az, alt, dot_prod, r;
+
+      if( !posn[0] && !posn[1] && !posn[2])
+         continue;
+      for( j = 0; j < 3; j++)
+         topo[j] = posn[j] - observer_loc[j];
+      precess_vector( alt_az_matrix, topo, vect);
+      cartesian_to_polar( vect, &az, &alt);
+      if( alt < cull->min_alt - CULL_ANGLE_MARGIN)
+         mask[i] = 0;
+      if( cull->skip_shadowed)
+         {
+         deprecess_vector( precess_matrix, posn, vect);
+         dot_prod = dot_product( vect, sun_vect);
+         if( dot_prod > 0. && dot_product( vect, vect) <
+                  dot_prod * dot_prod + shadow_radius * shadow_radius)
+            mask[i] = 0;
+         }
+      if( cull->radius > 0.)
+         {
+         deprecess_vector( precess_matrix, topo, vect);
+         r = sqrt( dot_product( vect, vect));
+         if( dot_product( vect, target_vect) <
+                        r * cos( cull->radius + CULL_ANGLE_MARGIN))
+            mask[i] = 0;
+         }
+      }
+}
+
+/* If 'cull' is non-NULL,  'mask' is set as described above,  and only
+satellites passing it are computed.  Otherwise,  'mask' (if non-NULL)
+is used as-is;  that's how the second pass in the following function
+gets exactly the same satellites as the first.  If 'n_found' is non-NULL,
+it's set to the number of satellites having positions,  including those
+culled;  if that's zero,  we've no data for the time,  as opposed to no
+satellites meeting the limits. */
+
 static int compute_gps_satellite_locations_minus_motion( gps_ephem_t *locs,
-         const double jd_utc, const mpc_code_t *cdata)
+         const double jd_utc, const mpc_code_t *cdata, const cull_t *cull,
+         char *mask, int *n_found)
 {
    const double tdt = jd_utc + td_minus_utc( jd_utc) / seconds_per_day;
    const double tdt_minus_gps = 51.184;
@@ -342,15 +674,16 @@ static int compute_gps_satellite_locations_minus_motion( gps_ephem_t *locs,
    int i, rval = 0;
    double sat_locs[MAX_N_GPS_SATS * 3];
    double *tptr = sat_locs, observer_loc[3], sun_vect[3];
-   double precess_matrix[9], alt_az_matrix[9];
+   double precess_matrix[9];
+   const double *alt_az_matrix = get_alt_az_matrix( cdata);
    const double j2000 = 2451545.;
    const double year = (tdt - j2000) / 365.25;
+   int n_culled = 0;
 
-   observer_loc[0] = cos( cdata->lon) * cdata->rho_cos_phi * EARTH_SEMIMAJOR_AXIS;
-   observer_loc[1] = sin( cdata->lon) * cdata->rho_cos_phi * EARTH_SEMIMAJOR_AXIS;
-   observer_loc[2] =                    cdata->rho_sin_phi * EARTH_SEMIMAJOR_AXIS;
-   err_code = setup_precession_with_nutation_eops( precess_matrix,
-                                  2000. + year);
+   if( n_found)
+      *n_found = 0;
+   get_observer_vector( cdata, observer_loc);
+   err_code = get_earth_frame( tdt, precess_matrix, sun_vect);
    if( err_code)
       {
       printf( "Precession failed: err code %d\n", err_code);
@@ -359,18 +692,24 @@ static int compute_gps_satellite_locations_minus_motion( gps_ephem_t *locs,
       return( -1);
       }
 
-   alt_az_matrix[0] = -cos( cdata->lon) * sin( cdata->lat);
-   alt_az_matrix[1] = -sin( cdata->lon) * sin( cdata->lat);
-   alt_az_matrix[2] =                     cos( cdata->lat);
-   alt_az_matrix[3] = -sin( cdata->lon);
-   alt_az_matrix[4] = cos( cdata->lon);
-   alt_az_matrix[5] = 0.;
-   alt_az_matrix[6] = cos( cdata->lon) * cos( cdata->lat);
-   alt_az_matrix[7] = sin( cdata->lon) * cos( cdata->lat);
-   alt_az_matrix[8] =                    sin( cdata->lat);
-
    if( tle_usage != USE_TLES_ONLY)
-      err_code = get_gps_positions( sat_locs, observer_loc, gps_time - 2400000.5);
+      {
+      double rough[MAX_N_GPS_SATS * 3];
+
+      if( cull && cull->target)     /* no need for rough positions */
+         for( i = 0; i < MAX_N_GPS_SATS; i++)
+            mask[i] = !memcmp( desig_from_index( i), cull->target, 3);
+      else if( cull && !get_rough_gps_positions( rough, gps_time - 2400000.5))
+         {
+         set_cull_mask( mask, cull, rough, observer_loc,
+                        precess_matrix, alt_az_matrix, sun_vect);
+         for( i = 0; i < MAX_N_GPS_SATS; i++)
+            if( !mask[i])        /* only those with positions get culled */
+               n_culled++;
+         }
+      err_code = get_gps_positions_masked( sat_locs, observer_loc,
+                        gps_time - 2400000.5, mask);
+      }
    else
       for( i = 0; i < MAX_N_GPS_SATS * 3; i++)
          tptr[i] = 0.;
@@ -390,59 +729,49 @@ static int compute_gps_satellite_locations_minus_motion( gps_ephem_t *locs,
 /*    if( curr_jd( ) < jd_utc + 3. || tle_usage == USE_TLES_ONLY)    */
          get_gps_positions_from_tle( tle_path, sat_locs,
                      gps_time - 2400000.5);
-   get_unit_vector_to_sun( year, sun_vect);
 
    for( i = 0; i < MAX_N_GPS_SATS; i++, tptr += 3)
-      if( tptr[0] || tptr[1] || tptr[2])
+      if( (tptr[0] || tptr[1] || tptr[2]) && (!mask || mask[i]))
          {
-         int j;
-         double alt_az_vect[3];
          extern char is_from_tle[];
 
-         deprecess_vector( precess_matrix, tptr, locs->j2000_geo);
-         for( j = 0; j < 3; j++)
-            tptr[j] -= observer_loc[j];
-         deprecess_vector( precess_matrix, tptr, locs->j2000_topo);
-         precess_vector( alt_az_matrix, tptr, alt_az_vect);
-         cartesian_to_polar( alt_az_vect, &locs->az, &locs->alt);
+         set_loc_geometry( locs, tptr, observer_loc, precess_matrix,
+                              alt_az_matrix, sun_vect, year);
          strcpy( locs->obj_desig, desig_from_index( i));
-         set_ra_dec( locs, year);
-/*       if( locs->alt > minimum_altitude)      */
-            {
-            const double dot_prod = dot_product( locs->j2000_geo, sun_vect);
-            const double geocentric_dist_2 = dot_product( locs->j2000_geo,
-                                                          locs->j2000_geo);
-            const double cos_elong = -dot_product( locs->j2000_topo, sun_vect) / locs->topo_r;
-
-            locs->elong = acos( cos_elong);
-            if( locs->az < 0.)
-               locs->az += PI + PI;
-            locs->in_shadow = ( dot_prod > 0. && geocentric_dist_2 <
-                 dot_prod * dot_prod + EARTH_SEMIMAJOR_AXIS * EARTH_SEMIMAJOR_AXIS);
-            locs->is_from_tle = is_from_tle[i];
-            locs++;
-            rval++;
-            }
+         locs->sat_idx = i;
+         locs->is_from_tle = is_from_tle[i];
+         locs++;
+         rval++;
          }
+   if( n_found)
+      *n_found = rval + n_culled;
    return( rval);
 }
 
 /* To compute apparent motion of the satellites,  compute their positions at
 two closely spaced times (a second apart) and look at how far they moved.
-Resulting motion is therefore in radians/second. */
+Resulting motion is therefore in radians/second.  'cull' may be NULL,
+in which case all satellites are computed.  'n_found' is as described
+above,  and may be NULL. */
 
 static int compute_gps_satellite_locations( gps_ephem_t *locs,
-         const double jd_utc, const mpc_code_t *cdata)
+         const double jd_utc, const mpc_code_t *cdata, const cull_t *cull,
+         int *n_found)
 {
-   const int n_sats = compute_gps_satellite_locations_minus_motion(
-                        locs, jd_utc, cdata);
+   char mask[MAX_N_GPS_SATS];
+   int n_sats;
+
+   memset( mask, 1, MAX_N_GPS_SATS);
+   n_sats = compute_gps_satellite_locations_minus_motion( locs, jd_utc,
+                        cdata, cull, (cull ? mask : NULL), n_found);
 
    if( n_sats > 0)
       {
       gps_ephem_t locs2[MAX_N_GPS_SATS];
       int i;
       const int n_sats2 = compute_gps_satellite_locations_minus_motion(
-                        locs2, jd_utc + 1. / seconds_per_day, cdata);
+                        locs2, jd_utc + 1. / seconds_per_day, cdata,
+                        NULL, (cull ? mask : NULL), NULL);
 
       if( n_sats != n_sats2)
          {
@@ -450,7 +779,13 @@ static int compute_gps_satellite_locations( gps_ephem_t *locs,
          return( 0);
          }
       for( i = 0; i < n_sats; i++)
+         {
+         int j;
+
          calc_dist_and_posn_ang( &locs[i].ra, &locs2[i].ra, &locs[i].motion, &locs[i].posn_ang);
+         for( j = 0; j < 3; j++)
+            locs[i].j2000_topo_vel[j] = locs2[i].j2000_topo[j] - locs[i].j2000_topo[j];
+         }
       set_designations( n_sats, locs, (int)( jd_utc - 2400000.5));
       }
    return( n_sats);
@@ -553,6 +888,276 @@ static void sort_sat_info( const int n_sats, gps_ephem_t *locs, const int criter
          }
 }
 
+/* Event search (-e option) :  finds when each satellite rises above or
+sets below 'minimum_altitude',  and when it enters or leaves the earth's
+shadow,  over the given number of hours.  (Shadow events are only shown
+when the satellite is above 'minimum_altitude',  since nobody cares when
+an object below the horizon goes into shadow.  For the geocenter,  all
+shadow events are shown.)
+
+   All satellites are computed at EVENT_COARSE_STEP intervals,  looking
+for sign changes in altitude minus 'minimum_altitude' and in a 'shadow
+function' which is negative in the earth's (cylindrical) shadow,  i.e.,
+the test used for 'in_shadow'.  Each bracketed event is then refined with
+the Illinois variant of regula falsi,  evaluating only that satellite
+(see get_gps_position( ) in 'gps.cpp'),  to EVENT_TOLERANCE.  A satellite
+that crossed twice within one coarse step would be missed;  navsats are
+above the horizon for hours,  and graze the shadow for more than two
+minutes except in rare cases. */
+
+#define EVENT_COARSE_STEP      (120. / seconds_per_day)
+#define EVENT_TOLERANCE        (.001 / seconds_per_day)
+#define EVENT_MAX_HOURS        240.
+#define MAX_EVENTS             20000
+
+typedef struct
+{
+   double alt, az;
+   double shadow;       /* < 0 if in the earth's shadow */
+   double j2000_topo[3];
+   bool valid;
+} event_fn_t;
+
+typedef struct
+{
+   double jd;
+   int sat_idx;
+   char event_type;     /* 'r' = rise,  's' = set,  'e' = enter shadow,  'x' = exit */
+} gps_event_t;
+
+static void set_event_functions( event_fn_t *efn, const double *sat_loc,
+            const double *observer_loc, const double *precess_matrix,
+            const double *alt_az_matrix, const double *sun_vect)
+{
+   double j2000_geo[3], topo[3], alt_az_vect[3], dot_prod;
+   int i;
+
+   efn->valid = (sat_loc[0] || sat_loc[1] || sat_loc[2]);
+   if( !efn->valid)
+      return;
+   for( i = 0; i < 3; i++)
+      topo[i] = sat_loc[i] - observer_loc[i];
+   precess_vector( alt_az_matrix, topo, alt_az_vect);
+   deprecess_vector( precess_matrix, topo, efn->j2000_topo);
+   cartesian_to_polar( alt_az_vect, &efn->az, &efn->alt);
+   if( efn->az < 0.)
+      efn->az += PI + PI;
+   deprecess_vector( precess_matrix, sat_loc, j2000_geo);
+   dot_prod = dot_product( j2000_geo, sun_vect);
+   if( dot_prod < 0.)         /* on the sunward side of the earth */
+      dot_prod = 0.;
+   efn->shadow = dot_product( j2000_geo, j2000_geo) - dot_prod * dot_prod
+                  - EARTH_SEMIMAJOR_AXIS * EARTH_SEMIMAJOR_AXIS;
+}
+
+/* Computes event functions for all satellites (sat_idx < 0,  'efn' then
+being an array of MAX_N_GPS_SATS) or just one.  Returns zero if all went
+well. */
+
+static int compute_event_functions( event_fn_t *efn, const double jd_utc,
+                        const mpc_code_t *cdata, const int sat_idx)
+{
+   const double tdt = jd_utc + td_minus_utc( jd_utc) / seconds_per_day;
+   const double tdt_minus_gps = 51.184;
+   const double mjd_gps = tdt - tdt_minus_gps / seconds_per_day - 2400000.5;
+   const int n_sats = (sat_idx < 0 ? MAX_N_GPS_SATS : 1);
+   const double *alt_az_matrix = get_alt_az_matrix( cdata);
+   double sat_locs[MAX_N_GPS_SATS * 3], observer_loc[3];
+   double precess_matrix[9], sun_vect[3];
+   int i, err_code = 0;
+
+   observer_loc[0] = cos( cdata->lon) * cdata->rho_cos_phi * EARTH_SEMIMAJOR_AXIS;
+   observer_loc[1] = sin( cdata->lon) * cdata->rho_cos_phi * EARTH_SEMIMAJOR_AXIS;
+   observer_loc[2] =                    cdata->rho_sin_phi * EARTH_SEMIMAJOR_AXIS;
+   if( get_earth_frame( tdt, precess_matrix, sun_vect))
+      return( -1);
+   for( i = 0; i < n_sats * 3; i++)
+      sat_locs[i] = 0.;
+   if( tle_usage != USE_TLES_ONLY)
+      {
+      if( sat_idx < 0)
+         err_code = get_gps_positions( sat_locs, observer_loc, mjd_gps);
+      else
+         err_code = get_gps_position( sat_locs, observer_loc, mjd_gps, sat_idx);
+      }
+   if( tle_usage != USE_SP3_ONLY)
+      {
+      if( sat_idx < 0)
+         get_gps_positions_from_tle( tle_path, sat_locs, mjd_gps);
+      else if( !sat_locs[0] && !sat_locs[1] && !sat_locs[2])
+         {           /* TLEs are only computed for the whole set at once */
+         double tle_locs[MAX_N_GPS_SATS * 3];
+
+         for( i = 0; i < MAX_N_GPS_SATS * 3; i++)
+            tle_locs[i] = 0.;
+         get_gps_positions_from_tle( tle_path, tle_locs, mjd_gps);
+         memcpy( sat_locs, tle_locs + sat_idx * 3, 3 * sizeof( double));
+         }
+      }
+   for( i = 0; i < n_sats; i++)
+      set_event_functions( efn + i, sat_locs + i * 3, observer_loc,
+                        precess_matrix, alt_az_matrix, sun_vect);
+   return( err_code);
+}
+
+static double event_function_value( const event_fn_t *efn, const char event_type)
+{
+   return( (event_type == 'r' || event_type == 's') ?
+                     efn->alt - minimum_altitude : efn->shadow);
+}
+
+/* Illinois method:  regula falsi,  except that if the same end of the
+bracket is kept twice running,  its function value is halved.  That
+avoids regula falsi's habit of creeping up on a root from one side. */
+
+static double refine_event( const gps_event_t *event, const mpc_code_t *cdata,
+                     double t0, double f0, double t1, double f1)
+{
+   int side = 0, iter;
+   double t = t0;
+
+   for( iter = 0; iter < 60 && t1 - t0 > EVENT_TOLERANCE; iter++)
+      {
+      event_fn_t efn;
+      double f;
+
+      t = (t0 * f1 - t1 * f0) / (f1 - f0);
+      compute_event_functions( &efn, t, cdata, event->sat_idx);
+      if( !efn.valid)
+         break;
+      f = event_function_value( &efn, event->event_type);
+      if( f * f1 > 0.)
+         {
+         t1 = t;
+         f1 = f;
+         if( side == -1)
+            f0 /= 2.;
+         side = -1;
+         }
+      else if( f * f0 > 0.)
+         {
+         t0 = t;
+         f0 = f;
+         if( side == 1)
+            f1 /= 2.;
+         side = 1;
+         }
+      else           /* landed exactly on the root */
+         break;
+      }
+   return( t);
+}
+
+static void show_event( const gps_event_t *event, const mpc_code_t *cdata)
+{
+   const char *event_text = (event->event_type == 'r' ? "rises" :
+                            (event->event_type == 's' ? "sets" :
+                            (event->event_type == 'e' ? "enters shadow" :
+                                                        "leaves shadow")));
+   event_fn_t efn;
+   char tbuff[80], obuff[200];
+
+   full_ctime( tbuff, event->jd, FULL_CTIME_YMD | FULL_CTIME_LEADING_ZEROES
+                     | FULL_CTIME_MONTHS_AS_DIGITS | FULL_CTIME_MILLISECS
+                     | FULL_CTIME_ROUNDING);
+   compute_event_functions( &efn, event->jd, cdata, event->sat_idx);
+   snprintf( obuff, sizeof( obuff), (is_topocentric ? "%-23s  %s  %-14s" :
+                     "%-23s  %s  %s"), tbuff,
+                     desig_from_index( event->sat_idx), event_text);
+   if( is_topocentric)
+      {
+      double alt = efn.alt * 180. / PI;
+
+      if( alt < 0. && alt > -.05)      /* avoid showing '-0.0' */
+         alt = 0.;
+      snprintf_append( obuff, sizeof( obuff), " %6.1f %6.1f",
+                     alt, efn.az * 180. / PI);
+      }
+   strcat( obuff, "\n");
+   printf( "%s", obuff);
+   if( log_file)
+      fprintf( log_file, "%s", obuff);
+}
+
+static int compare_events( const void *a, const void *b)
+{
+   const double t1 = ((const gps_event_t *)a)->jd;
+   const double t2 = ((const gps_event_t *)b)->jd;
+
+   return( t1 > t2 ? 1 : (t1 < t2 ? -1 : 0));
+}
+
+static int find_events( const double jd_start, const double hours,
+                        const mpc_code_t *cdata)
+{
+   const int n_steps = (int)ceil( hours / 24. / EVENT_COARSE_STEP);
+   event_fn_t *prev = (event_fn_t *)calloc( 2 * MAX_N_GPS_SATS, sizeof( event_fn_t));
+   event_fn_t *curr = prev + MAX_N_GPS_SATS;
+   gps_event_t *events = (gps_event_t *)malloc( MAX_EVENTS * sizeof( gps_event_t));
+   int step, i, n_events = 0, err_code = 0;
+   char tbuff[80];
+
+   assert( prev);
+   assert( events);
+   full_ctime( tbuff, jd_start + hours / 24., FULL_CTIME_YMD);
+   printf( "Events through %s UTC (minimum altitude %.1f)\n", tbuff,
+                     minimum_altitude * 180. / PI);
+   printf( "UTC date/time            Sat  Event%s\n",
+                     (is_topocentric ? "             Alt    Azim" : ""));
+   for( step = 0; step <= n_steps && !err_code; step++)
+      {
+      const double jd = jd_start + (double)step * EVENT_COARSE_STEP;
+
+      err_code = compute_event_functions( curr, jd, cdata, -1);
+      if( step)
+         for( i = 0; i < MAX_N_GPS_SATS; i++)
+            if( prev[i].valid && curr[i].valid)
+               {
+               char event_types[2];
+               int j;
+
+               event_types[0] = event_types[1] = '\0';
+               if( is_topocentric && (prev[i].alt > minimum_altitude)
+                                  != (curr[i].alt > minimum_altitude))
+                  event_types[0] = (curr[i].alt > minimum_altitude ? 'r' : 's');
+               if( (prev[i].shadow < 0.) != (curr[i].shadow < 0.))
+                  event_types[1] = (curr[i].shadow < 0. ? 'e' : 'x');
+               for( j = 0; j < 2; j++)
+                  if( event_types[j] && n_events < MAX_EVENTS)
+                     {
+                     gps_event_t *event = events + n_events;
+                     const double t0 = jd - EVENT_COARSE_STEP;
+
+                     event->sat_idx = i;
+                     event->event_type = event_types[j];
+                     event->jd = refine_event( event, cdata,
+                           t0, event_function_value( prev + i, event->event_type),
+                           jd, event_function_value( curr + i, event->event_type));
+                     if( j == 1 && is_topocentric)
+                        {        /* only keep shadow events above the horizon */
+                        event_fn_t efn;
+
+                        compute_event_functions( &efn, event->jd, cdata, i);
+                        if( efn.alt < minimum_altitude)
+                           continue;
+                        }
+                     n_events++;
+                     }
+               }
+      memcpy( prev, curr, MAX_N_GPS_SATS * sizeof( event_fn_t));
+      }
+   if( err_code)
+      printf( "Couldn't get satellite positions : %d\n", err_code);
+   qsort( events, n_events, sizeof( gps_event_t), compare_events);
+   for( i = 0; i < n_events; i++)
+      show_event( events + i, cdata);
+   if( !n_events)
+      printf( "No events found\n");
+   free( prev);
+   free( events);
+   return( err_code);
+}
+
 int sort_order = 1;          /* default = sort by elongation */
 
 #define ERR_CODE_TOO_FAR_IN_FUTURE        -903
@@ -675,88 +1280,800 @@ static void get_field_size( double *width, double *height, const double jd,
 }
 
 /* Searching to see if a long trail may have crossed an image can be a little
-problematic.  We assume that the endpoints are at (x0, y0),  (x1, y1),
-expressed in units of the image width and height.  The segment can be
-described parametrically as x = x0 + t(x1 - x0), y = y0 + t(y1 - y0), with
-0 <= t <= 1. We're interested in finding if any t in that range runs
-through the unit square from -1 < x < 1 and similarly for y,  i.e.,  does
-the segment run through the image?
+problematic.  We used to take the positions at the start and end of the
+exposure,  project them onto the image,  and clip the straight segment
+between them against the image.  If it crossed,  all satellite positions
+were recomputed at the middle of the crossing to get that one satellite's
+position.  For long exposures,  the trail can be noticeably curved,  too.
+
+   Instead,  we now fit a cubic Hermite polynomial to the satellite's
+topocentric J2000 vector over the exposure,  using the positions and
+velocities at each end.  (The velocities are one-second differences,
+i.e.,  really the velocities half a second later;  we correct for that
+using the mean acceleration over the exposure.)  The error goes as the
+fourth power of the exposure time:  for a GNSS satellite,  it's well under
+a millimeter for a 30-second exposure and about four meters (0.02") for
+a ten-minute one.
+
+   The nice thing about this is that the gnomonic projection of a vector
+P onto an image centered on unit vector c,  with 'east' and 'north' unit
+vectors e and n,  is just xi = P.e / P.c,  eta = P.n / P.c.  So the
+satellite crossing,  say,  xi = width is where P.(e - width * c) = 0,
+a cubic in t.  Tilting the image just means tilting e and n.  We find
+where the trail crosses all four edges,  check which pieces between
+the crossings are on the image,  and return the 't' (0=start of exposure,
+1=end) for the middle of the longest such piece,  or -1 if the trail
+never touches the image.                                        */
+
+static double eval_cubic( const double *coeffs, const double t)
+{
+   return( coeffs[0] + t * (coeffs[1] + t * (coeffs[2] + t * coeffs[3])));
+}
+
+/* Coefficients of the cubic going from y0 to y1 over 0 <= t <= 1,  with
+derivatives (with respect to t) dy0 and dy1 at either end. */
+
+static void set_hermite_coeffs( double *coeffs, const double y0,
+                  const double dy0, const double y1, const double dy1)
+{
+   coeffs[0] = y0;
+   coeffs[1] = dy0;
+   coeffs[2] = 3. * (y1 - y0) - 2. * dy0 - dy1;
+   coeffs[3] = 2. * (y0 - y1) + dy0 + dy1;
+}
 
-I did this by clipping against _one_ edge (the x=-1 one) and rotating 90
-degrees four times.  At any of those four,  the line segment may be totally
-clipped (in which case we return t=-1),  or partly clipped (compute the
-intersection point and replace one endpoint and its t),  or nothing may
-happen (for example,  if both points are on the image,  we'll just rotate
-the endpoints four times,  do nothing to them,  and return 0.5.)       */
+/* Finds roots of a cubic between t=0 and t=1 by splitting that range at
+the turning points (so that the cubic is monotonic within each piece) and
+bisecting pieces where the cubic changes sign.  Returns the number of
+roots found. */
 
-static double trail_within_image( double x0, double y0, double x1, double y1)
+static int cubic_roots_in_unit_interval( const double *coeffs, double *roots)
 {
-   int loop;
-   double t0 = 0., t1 = 1.;
+   double breaks[4], tval[2];
+   const double a = 3. * coeffs[3], b = 2. * coeffs[2], c = coeffs[1];
+   int n_breaks = 0, n_turns = 0, i, n_roots = 0;
 
-   for( loop = 4; loop; loop--)
+   if( a != 0.)
       {
-      double new_y, new_t;
+      const double discr = b * b - 4. * a * c;
 
-      if( x0 < -1. && x1 < -1.)
-         return( -1.);
-      else if( x0 < -1. || x1 < -1.)
+      if( discr > 0.)
          {
-         new_t = (t0 * (x1 + 1.) - t1 * (x0 + 1.)) / (x1 - x0);
-         new_y = (y0 * (x1 + 1.) - y1 * (x0 + 1.)) / (x1 - x0);
-         if( x0 < -1.)         /* First point is clipped */
-            {
-            x0 = -1.;
-            y0 = new_y;
-            t0 = new_t;
-            }
-         else              /* ...or second endpoint is clipped */
+         const double q = -.5 * (b + (b > 0. ? sqrt( discr) : -sqrt( discr)));
+
+         tval[n_turns++] = q / a;
+         if( q != 0.)
+            tval[n_turns++] = c / q;
+         }
+      }
+   else if( b != 0.)
+      tval[n_turns++] = -c / b;
+   if( n_turns == 2 && tval[0] > tval[1])
+      {
+      const double swap = tval[0];
+
+      tval[0] = tval[1];
+      tval[1] = swap;
+      }
+   breaks[n_breaks++] = 0.;
+   for( i = 0; i < n_turns; i++)
+      if( tval[i] > 0. && tval[i] < 1.)
+         breaks[n_breaks++] = tval[i];
+   breaks[n_breaks++] = 1.;
+   for( i = 0; i < n_breaks - 1; i++)
+      {
+      double t0 = breaks[i], t1 = breaks[i + 1];
+      double y0 = eval_cubic( coeffs, t0);
+      const double y1 = eval_cubic( coeffs, t1);
+
+      if( (y0 < 0. && y1 > 0.) || (y0 > 0. && y1 < 0.))
+         {
+         int iter;
+
+         for( iter = 0; iter < 45; iter++)
             {
-            x1 = -1.;
-            y1 = new_y;
-            t1 = new_t;
+            const double tmid = (t0 + t1) / 2.;
+            const double ymid = eval_cubic( coeffs, tmid);
+
+            if( (ymid < 0.) == (y0 < 0.))
+               {
+               t0 = tmid;
+               y0 = ymid;
+               }
+            else
+               t1 = tmid;
             }
+         roots[n_roots++] = (t0 + t1) / 2.;
          }
-      new_y = -x0;        /* Rotate both endpoints 90 degrees around origin */
-      x0 = y0;
-      y0 = new_y;
-      new_y = -x1;
-      x1 = y1;
-      y1 = new_y;
       }
-                     /* At least part of the line segment goes through the */
-                     /* unit square.  Return the 't' for the midpoint.     */
-   return( (t0 + t1) / 2.);
+   return( n_roots);
 }
 
-/* Computes tangent plane coords,  in radians,  gnomonic projection.  Returns
-0 if the result is 'OK' and the specified point really is on the tangent plane
-(i.e.,  within 90 degrees of the projection point).  Returns -1 otherwise. */
+/* Sets up the cubic for each component of a vector going from p0 to p1
+over 'dt' seconds.  v0 and v1 are one-second forward differences. */
 
-static int compute_tangent_plane_coords( const double dec, const double dec0,
-                     const double delta_ra, double *xi, double *eta)
+static void set_vector_polynomial( double coeffs[3][4], const double *p0,
+            const double *v0, const double *p1, const double *v1,
+            const double dt)
 {
-   const double x = sin( delta_ra) * cos( dec);
-   const double y = cos( delta_ra) * cos( dec);
-   const double z = sin( dec);
-   const double d = cos( dec0) * y + sin( dec0) * z;
+   int i;
 
-   *xi = x / d;
-   *eta = (-sin( dec0) * y + cos( dec0) * z) / d;
-   return( d > 0. ? 0 : -1);
+   for( i = 0; i < 3; i++)
+      {
+      const double accel = (v1[i] - v0[i]) / dt;
+
+      set_hermite_coeffs( coeffs[i], p0[i], (v0[i] - accel * .5) * dt,
+                                     p1[i], (v1[i] - accel * .5) * dt);
+      }
 }
 
-#define ASTROMETRY 1
-#define FIELD_DATA 2
+static void set_trail_polynomial( double coeffs[3][4],
+            const gps_ephem_t *loc0, const gps_ephem_t *loc1, const double dt)
+{
+   set_vector_polynomial( coeffs, loc0->j2000_topo, loc0->j2000_topo_vel,
+                     loc1->j2000_topo, loc1->j2000_topo_vel, dt);
+}
 
-const char *google_map_url =
-   "<a title='Click for map' href='http://maps.google.com/maps?q=%+.5f,%+.5f'>";
+static void eval_trail_polynomial( double coeffs[3][4], const double t,
+                                    double *vect)
+{
+   int i;
+
+   for( i = 0; i < 3; i++)
+      vect[i] = eval_cubic( coeffs[i], t);
+}
+
+/* An image centered at (ra, dec),  2*width by 2*height (all in radians),
+tilted by 'tilt',  is described by the unit vector to its center and one
+vector per edge,  such that a vector P is off the image if P.edge > 0 for
+edges 0 and 2,  or P.edge < 0 for edges 1 and 3. */
+
+typedef struct
+{
+   double center[3], edge[4][3];
+} field_edges_t;
+
+static void set_field_edges( field_edges_t *field, const double ra,
+            const double dec, const double width, const double height,
+            const double tilt)
+{
+   const double east[3] = { -sin( ra), cos( ra), 0. };
+   const double north[3] = { -cos( ra) * sin( dec), -sin( ra) * sin( dec),
+                              cos( dec) };
+   int i;
+
+   field->center[0] = cos( ra) * cos( dec);
+   field->center[1] = sin( ra) * cos( dec);
+   field->center[2] = sin( dec);
+   for( i = 0; i < 3; i++)       /* see test_astrometry() for the tilt */
+      {
+      const double x_axis = cos( tilt) * east[i] - sin( tilt) * north[i];
+      const double y_axis = cos( tilt) * north[i] - sin( tilt) * east[i];
+
+      field->edge[0][i] = x_axis - width * field->center[i];
+      field->edge[1][i] = x_axis + width * field->center[i];
+      field->edge[2][i] = y_axis - height * field->center[i];
+      field->edge[3][i] = y_axis + height * field->center[i];
+      }
+}
+
+static bool is_on_field( const field_edges_t *field, const double *vect)
+{
+   int i;
+
+   if( dot_product( vect, field->center) <= 0.)
+      return( false);
+   for( i = 0; i < 4; i++)
+      if( (dot_product( vect, field->edge[i]) > 0.) == !(i & 1))
+         return( false);
+   return( true);
+}
+
+/* Finds the parts of the trail (0 <= t <= 1) that are on the field,  as
+(start, end) pairs in 'runs'.  Returns the number of such runs;  there
+can't be more than seven. */
+
+static int find_runs_on_field( double coeffs[3][4],
+                  const field_edges_t *field, double *runs)
+{
+   double breaks[14], run_start = -1.;
+   int i, j, n_breaks = 0, n_runs = 0;
+
+   breaks[n_breaks++] = 0.;
+   for( i = 0; i < 4; i++)
+      {
+      double edge_coeffs[4];
+
+      for( j = 0; j < 4; j++)
+         edge_coeffs[j] = field->edge[i][0] * coeffs[0][j]
+                        + field->edge[i][1] * coeffs[1][j]
+                        + field->edge[i][2] * coeffs[2][j];
+      n_breaks += cubic_roots_in_unit_interval( edge_coeffs, breaks + n_breaks);
+      }
+   breaks[n_breaks++] = 1.;
+   for( i = 1; i < n_breaks; i++)      /* insertion sort;  n_breaks <= 14 */
+      for( j = i; j > 0 && breaks[j - 1] > breaks[j]; j--)
+         {
+         const double swap = breaks[j];
+
+         breaks[j] = breaks[j - 1];
+         breaks[j - 1] = swap;
+         }
+   for( i = 0; i < n_breaks - 1; i++)
+      {
+      double vect[3];
+      bool on_image;
+
+      eval_trail_polynomial( coeffs, (breaks[i] + breaks[i + 1]) / 2., vect);
+      on_image = is_on_field( field, vect);
+      if( on_image && run_start < 0.)
+         run_start = breaks[i];
+      if( run_start >= 0. && (!on_image || i == n_breaks - 2))
+         {
+         runs[n_runs * 2] = run_start;
+         runs[n_runs * 2 + 1] = (on_image ? breaks[i + 1] : breaks[i]);
+         n_runs++;
+         run_start = -1.;
+         }
+      }
+   return( n_runs);
+}
+
+/* The RA/decs in 'loc0' and 'loc1' have had aberration applied;  the
+vectors haven't.  So the image center is shifted by the aberration at the
+start of the exposure.  (Aberration changes by about 20" times the
+distance from the image center in radians,  which isn't enough to
+matter.)   */
+
+static double trail_within_image( const gps_ephem_t *loc0,
+            const gps_ephem_t *loc1, const double dt, double ra, double dec,
+            const double width, const double height, const double tilt)
+{
+   double coeffs[3][4], raw_ra, raw_dec, runs[14], rval = -1., longest = 0.;
+   field_edges_t field;
+   int i, n_runs;
+
+   set_trail_polynomial( coeffs, loc0, loc1, dt);
+   cartesian_to_polar( loc0->j2000_topo, &raw_ra, &raw_dec);
+   ra += raw_ra - loc0->ra;
+   dec += raw_dec - loc0->dec;
+   set_field_edges( &field, ra, dec, width, height, tilt);
+   n_runs = find_runs_on_field( coeffs, &field, runs);
+   for( i = 0; i < n_runs; i++)
+      if( runs[i * 2 + 1] - runs[i * 2] > longest || rval < 0.)
+         {
+         longest = runs[i * 2 + 1] - runs[i * 2];
+         rval = (runs[i * 2] + runs[i * 2 + 1]) / 2.;
+         }
+   return( rval);
+}
+
+/* Sets 'loc' to the position at fraction 't' of the way through the
+exposure,  from the above polynomial,  without recomputing positions for
+all the satellites.  'loc' should start out as a copy of 'loc0' or 'loc1'
+(designations and such are kept).  Returns non-zero if the earth
+orientation couldn't be found.  */
+
+static int set_trail_position( gps_ephem_t *loc, const gps_ephem_t *loc0,
+            const gps_ephem_t *loc1, const double dt, const double t,
+            const double jd_utc, const mpc_code_t *cdata)
+{
+   const double tdt = jd_utc + td_minus_utc( jd_utc) / seconds_per_day;
+   const double year = (tdt - 2451545.) / 365.25;
+   double coeffs[3][4], topo[3], posn[3], observer_loc[3], sun_vect[3];
+   double precess_matrix[9];
+   gps_ephem_t one_sec_later;
+   int i;
+
+   if( get_earth_frame( tdt, precess_matrix, sun_vect))
+      return( -1);
+   set_trail_polynomial( coeffs, loc0, loc1, dt);
+   eval_trail_polynomial( coeffs, t, topo);
+   get_observer_vector( cdata, observer_loc);
+   precess_vector( precess_matrix, topo, posn);
+   for( i = 0; i < 3; i++)
+      posn[i] += observer_loc[i];
+   set_loc_geometry( loc, posn, observer_loc, precess_matrix,
+                        get_alt_az_matrix( cdata), sun_vect, year);
+   eval_trail_polynomial( coeffs, t + 1. / dt, one_sec_later.j2000_topo);
+   set_ra_dec( &one_sec_later, year);
+   calc_dist_and_posn_ang( &loc->ra, &one_sec_later.ra, &loc->motion,
+                                          &loc->posn_ang);
+   for( i = 0; i < 3; i++)
+      loc->j2000_topo_vel[i] = one_sec_later.j2000_topo[i] - loc->j2000_topo[i];
+   return( 0);
+}
+
+/* Field crossing search (-F option,  with -e setting the number of hours):
+lists every satellite that passes through a given field,  with the times
+at which it enters and leaves,  for scheduling calibration frames.
+
+   All satellites are computed at EVENT_COARSE_STEP intervals,  and again
+a second later to get their motions.  A satellite moving at no more than
+'rate' radians/second can't get closer to the field center during a step
+than (d0 + d1 - rate * step) / 2,  where d0 and d1 are its distances from
+it at either end;  if that's outside the circle around the field,  the
+step is skipped.  (The rate is the faster of the two ends' rates,  plus
+20%;  a navsat's apparent rate changes far less than that in two
+minutes.)  Otherwise,  we fit the same cubic used for trails over the
+step and find where it crosses the field edges,  as above.   */
+
+#define MAX_FIELD_CROSSINGS      5000
+
+typedef struct
+{
+   double jd_in, jd_out;
+   int sat_idx;
+} field_crossing_t;
+
+static double angular_dist( const double *a, const double *b)
+{
+   double cos_dist = dot_product( a, b)
+                  / sqrt( dot_product( a, a) * dot_product( b, b));
+
+   if( cos_dist > 1.)
+      cos_dist = 1.;
+   if( cos_dist < -1.)
+      cos_dist = -1.;
+   return( acos( cos_dist));
+}
+
+static int compare_crossings( const void *a, const void *b)
+{
+   const double t1 = ((const field_crossing_t *)a)->jd_in;
+   const double t2 = ((const field_crossing_t *)b)->jd_in;
+
+   return( t1 > t2 ? 1 : (t1 < t2 ? -1 : 0));
+}
+
+/* Returns false (and shows nothing) if the satellite is below the
+minimum altitude at the middle of the crossing;  that only happens if
+the field itself is low or below the horizon. */
+
+static bool show_field_crossing( const field_crossing_t *crossing,
+                  const mpc_code_t *cdata)
+{
+   const int time_format = FULL_CTIME_YMD | FULL_CTIME_LEADING_ZEROES
+                     | FULL_CTIME_MONTHS_AS_DIGITS | FULL_CTIME_MILLISECS
+                     | FULL_CTIME_ROUNDING;
+   event_fn_t efn;
+   char time_in[80], time_out[80], obuff[200];
+
+   full_ctime( time_in, crossing->jd_in, time_format);
+   full_ctime( time_out, crossing->jd_out, time_format);
+   compute_event_functions( &efn, (crossing->jd_in + crossing->jd_out) / 2.,
+                        cdata, crossing->sat_idx);
+   if( is_topocentric && efn.alt < minimum_altitude)
+      return( false);
+   snprintf( obuff, sizeof( obuff), "%s  %s  %s %9.3f",
+               desig_from_index( crossing->sat_idx), time_in, time_out,
+               (crossing->jd_out - crossing->jd_in) * seconds_per_day);
+   if( is_topocentric)
+      snprintf_append( obuff, sizeof( obuff), " %6.1f %6.1f",
+                     efn.alt * 180. / PI, efn.az * 180. / PI);
+   if( efn.shadow < 0.)
+      strcat( obuff, " Sha");
+   strcat( obuff, "\n");
+   printf( "%s", obuff);
+   if( log_file)
+      fprintf( log_file, "%s", obuff);
+   return( true);
+}
+
+/* (ra, dec) is the field center;  'width',  'height',  and 'tilt' are
+the full field size and tilt,  all in radians. */
+
+static int find_field_crossings( const double jd_start, const double hours,
+            const mpc_code_t *cdata, double ra, double dec,
+            const double width, const double height, const double tilt)
+{
+   const int n_steps = (int)ceil( hours / 24. / EVENT_COARSE_STEP);
+   const double dt = EVENT_COARSE_STEP * seconds_per_day;
+   const double radius = atan( sqrt( width * width + height * height) / 2.);
+   const double tdt = jd_start + td_minus_utc( jd_start) / seconds_per_day;
+   const double year = (tdt - 2451545.) / 365.25;
+   event_fn_t *prev = (event_fn_t *)calloc( 4 * MAX_N_GPS_SATS, sizeof( event_fn_t));
+   event_fn_t *prev2 = prev + MAX_N_GPS_SATS;
+   event_fn_t *curr = prev + 2 * MAX_N_GPS_SATS;
+   event_fn_t *curr2 = prev + 3 * MAX_N_GPS_SATS;
+   field_crossing_t *crossings = (field_crossing_t *)malloc(
+                     MAX_FIELD_CROSSINGS * sizeof( field_crossing_t));
+   double entry_jd[MAX_N_GPS_SATS], aberrated_ra = ra, aberrated_dec = dec;
+   field_edges_t field;
+   int step, i, j, n_crossings = 0, n_shown = 0, err_code = 0;
+   bool cut_off = false;
+   char tbuff[80];
+
+   assert( prev);
+   assert( crossings);
+                  /* Satellite vectors don't include aberration;  so we */
+                  /* shift the field center by the aberration there.    */
+   compute_aberration( year / 100., &aberrated_ra, &aberrated_dec);
+   set_field_edges( &field, ra + ra - aberrated_ra, dec + dec - aberrated_dec,
+                     width / 2., height / 2., tilt);
+   for( i = 0; i < MAX_N_GPS_SATS; i++)
+      entry_jd[i] = 0.;
+   full_ctime( tbuff, jd_start + hours / 24., FULL_CTIME_YMD);
+   printf( "Field crossings through %s UTC\n", tbuff);
+   printf( "Field center %.5f %+.5f,  %.3f x %.3f degrees,  tilt %.1f\n",
+               ra * 180. / PI, dec * 180. / PI,
+               width * 180. / PI, height * 180. / PI, tilt * 180. / PI);
+   printf( "Sat  Enters field             Leaves field              Dur(s)%s\n",
+                     (is_topocentric ? "    Alt   Azim" : ""));
+   for( step = 0; step <= n_steps && !err_code; step++)
+      {
+      const double jd = jd_start + (double)step * EVENT_COARSE_STEP;
+
+      err_code = compute_event_functions( curr, jd, cdata, -1);
+      if( !err_code)
+         err_code = compute_event_functions( curr2, jd + 1. / seconds_per_day,
+                                                cdata, -1);
+      if( step)
+         for( i = 0; i < MAX_N_GPS_SATS; i++)
+            if( prev[i].valid && curr[i].valid && prev2[i].valid && curr2[i].valid)
+               {
+               const double rate0 = angular_dist( prev[i].j2000_topo,
+                                                   prev2[i].j2000_topo);
+               const double rate1 = angular_dist( curr[i].j2000_topo,
+                                                   curr2[i].j2000_topo);
+               const double rate = 1.2 * (rate0 > rate1 ? rate0 : rate1);
+               const double closest =
+                     (angular_dist( prev[i].j2000_topo, field.center)
+                    + angular_dist( curr[i].j2000_topo, field.center)
+                    - rate * dt) / 2.;
+               double coeffs[3][4], vel0[3], vel1[3], runs[14];
+               int n_runs;
+
+               if( closest > radius)
+                  continue;
+               for( j = 0; j < 3; j++)
+                  {
+                  vel0[j] = prev2[i].j2000_topo[j] - prev[i].j2000_topo[j];
+                  vel1[j] = curr2[i].j2000_topo[j] - curr[i].j2000_topo[j];
+                  }
+               set_vector_polynomial( coeffs, prev[i].j2000_topo, vel0,
+                                    curr[i].j2000_topo, vel1, dt);
+               n_runs = find_runs_on_field( coeffs, &field, runs);
+               for( j = 0; j < n_runs; j++)
+                  {
+                  const double jd_in = jd + (runs[j * 2] - 1.) * EVENT_COARSE_STEP;
+                  const double jd_out = jd + (runs[j * 2 + 1] - 1.) * EVENT_COARSE_STEP;
+
+                  if( !entry_jd[i])
+                     entry_jd[i] = jd_in;
+                  if( runs[j * 2 + 1] < 1. || step == n_steps)
+                     {
+                     if( entry_jd[i] == jd_start || runs[j * 2 + 1] == 1.)
+                        cut_off = true;
+                     if( n_crossings < MAX_FIELD_CROSSINGS)
+                        {
+                        crossings[n_crossings].jd_in = entry_jd[i];
+                        crossings[n_crossings].jd_out = jd_out;
+                        crossings[n_crossings].sat_idx = i;
+                        n_crossings++;
+                        }
+                     entry_jd[i] = 0.;
+                     }
+                  }
+               }
+      memcpy( prev, curr, 2 * MAX_N_GPS_SATS * sizeof( event_fn_t));
+      }
+   if( err_code)
+      printf( "Couldn't get satellite positions : %d\n", err_code);
+   qsort( crossings, n_crossings, sizeof( field_crossing_t), compare_crossings);
+   for( i = 0; i < n_crossings; i++)
+      if( show_field_crossing( crossings + i, cdata))
+         n_shown++;
+   if( !n_shown)
+      printf( "No satellites cross the field\n");
+   else if( cut_off)
+      printf( "Crossings under way at the start or end are cut off there.\n");
+   free( prev);
+   free( crossings);
+   return( err_code);
+}
+
+/* Computes tangent plane coords,  in radians,  gnomonic projection.  Returns
+0 if the result is 'OK' and the specified point really is on the tangent plane
+(i.e.,  within 90 degrees of the projection point).  Returns -1 otherwise. */
+
+static int compute_tangent_plane_coords( const double dec, const double dec0,
+                     const double delta_ra, double *xi, double *eta)
+{
+   const double x = sin( delta_ra) * cos( dec);
+   const double y = cos( delta_ra) * cos( dec);
+   const double z = sin( dec);
+   const double d = cos( dec0) * y + sin( dec0) * z;
+
+   *xi = x / d;
+   *eta = (-sin( dec0) * y + cos( dec0) * z) / d;
+   return( d > 0. ? 0 : -1);
+}
+
+/* Position of the field center relative to the satellite,  in arcseconds,
+with the field's tilt applied.  Usually the projection is centered on the
+satellite.  For a satellite found by trail_within_image( ),  it's centered
+on the field,  so that the field's edges run along its own east-west and
+north-south lines,  as they did when the crossing was found.  If the
+projection fails (the satellite is more than 90 degrees from the field),
+we return a position far outside any field. */
+
+static void get_field_coords( const double ra, const double dec,
+            const gps_ephem_t *loc, const double tilt,
+            const bool centered_on_field, double *xi, double *eta)
+{
+   const double radians_to_arcsec = 3600. * 180. / PI;
+   const double BAD_PROJECTION = 99999.;
+   int err_code;
+
+   if( centered_on_field)
+      {
+      err_code = compute_tangent_plane_coords( loc->dec, dec, loc->ra - ra,
+                                                xi, eta);
+      *xi = -*xi;
+      *eta = -*eta;
+      }
+   else
+      err_code = compute_tangent_plane_coords( dec, loc->dec, ra - loc->ra,
+                                                xi, eta);
+   if( err_code)
+      *xi = BAD_PROJECTION;     /* place safely outside of contention */
+   *xi  *= radians_to_arcsec;
+   *eta *= radians_to_arcsec;
+   if( tilt)
+      {
+      const double tval = cos( tilt) * *xi - sin( tilt) * *eta;
+
+      *eta = cos( tilt) * *eta - sin( tilt) * *xi;
+      *xi = tval;
+      }
+}
+
+#define ASTROMETRY 1
+#define FIELD_DATA 2
+
+/* Survey pointing logs can have thousands of fields per night,  often
+with several fields (one per detector,  say) sharing an exposure time and
+site.  Checking each field against every satellite with the above
+projection meant (fields * satellites) work.  Instead,  the positions for
+an epoch are computed once and kept,  along with an 'index' of the
+satellites sorted by declination.  A field then only examines satellites
+within a declination band around it,  then only those within a given
+angular distance of its center.  For a field 'width' by 'height' (half-
+sizes),  a satellite can only match if it's within sqrt( width^2 +
+height^2) of the center;  if it can trail across the field during the
+exposure,  we add the fastest satellite's motion over the exposure.  The
+candidates are kept in their original order,  so the output is as it
+would be if we'd checked all satellites. */
+
+#define N_CACHED_EPOCHS       4
+#define SKY_INDEX_MARGIN      (PI / 180.)
+
+typedef struct
+{
+   double jd, lat, lon, rho_cos_phi, rho_sin_phi;
+   cull_t cull;
+   int n_sats;
+   gps_ephem_t loc[MAX_N_GPS_SATS];
+   int sorted_idx[MAX_N_GPS_SATS];     /* satellites sorted by dec */
+   double max_motion;                  /* fastest motion,  radians/second */
+   unsigned last_used;
+} sky_epoch_t;
+
+static sky_epoch_t *sky_epochs;
+static int n_sky_epochs_used;
+
+static void free_sky_epochs( void)
+{
+   if( sky_epochs)
+      free( sky_epochs);
+   sky_epochs = NULL;
+   n_sky_epochs_used = 0;
+}
+
+/* Cached GNSS positions are looked up by time alone.  In server mode,
+they're kept from one request to the next,  and a request that turns off
+MGEX data (with 'COM MGEX' or an MPC code ending in " m"),  or looks for
+files in a different 'ephem_data_path',  mustn't get positions loaded for
+a request that didn't.  So we remember what the cached positions were
+loaded with,  and drop them if that changes. */
+
+static void check_gps_data_settings( void)
+{
+   extern bool use_mgex_data;
+   extern const char *ephem_data_path;
+   static bool loaded_with_mgex = true;
+   static char loaded_with_path[256];
+
+   if( loaded_with_mgex != use_mgex_data
+                  || strcmp( loaded_with_path, ephem_data_path))
+      {
+      free_cached_gps_positions( );
+      free_sky_epochs( );
+      loaded_with_mgex = use_mgex_data;
+      snprintf( loaded_with_path, sizeof( loaded_with_path), "%s",
+                                                ephem_data_path);
+      }
+}
+
+static const gps_ephem_t *dec_sort_locs;
+
+static int compare_decs( const void *a, const void *b)
+{
+   const double dec1 = dec_sort_locs[*(const int *)a].dec;
+   const double dec2 = dec_sort_locs[*(const int *)b].dec;
+
+   return( dec1 > dec2 ? 1 : (dec1 < dec2 ? -1 : 0));
+}
+
+static bool is_same_cull( const cull_t *cull1, const cull_t *cull2)
+{
+   return( cull1->min_alt == cull2->min_alt
+            && cull1->skip_shadowed == cull2->skip_shadowed
+            && cull1->radius == cull2->radius
+            && (!cull1->radius || (cull1->ra == cull2->ra
+                                && cull1->dec == cull2->dec)));
+}
+
+/* Returns satellite positions for the given time and site,  from the
+cache if we've already computed them (with the same culling;  see
+'cull_t').  The least recently used epoch is overwritten;  so the one
+used for the start of an exposure is still there after we get the one
+for the end. */
+
+static const sky_epoch_t *get_sky_epoch( const double jd, const mpc_code_t *cdata,
+                                    const cull_t *cull)
+{
+   sky_epoch_t *rval = NULL;
+   static unsigned usage_count;
+   int i;
+
+   if( !sky_epochs)
+      {
+      sky_epochs = (sky_epoch_t *)calloc( N_CACHED_EPOCHS, sizeof( sky_epoch_t));
+      assert( sky_epochs);
+      }
+   usage_count++;
+   for( i = 0; i < n_sky_epochs_used; i++)
+      {
+      rval = sky_epochs + i;
+      if( rval->jd == jd && rval->lat == cdata->lat && rval->lon == cdata->lon
+                  && rval->rho_cos_phi == cdata->rho_cos_phi
+                  && rval->rho_sin_phi == cdata->rho_sin_phi
+                  && is_same_cull( &rval->cull, cull))
+         {
+         rval->last_used = usage_count;
+         return( rval);
+         }
+      }
+   if( n_sky_epochs_used < N_CACHED_EPOCHS)
+      rval = sky_epochs + n_sky_epochs_used++;
+   else
+      for( rval = sky_epochs, i = 1; i < N_CACHED_EPOCHS; i++)
+         if( rval->last_used > sky_epochs[i].last_used)
+            rval = sky_epochs + i;
+   rval->last_used = usage_count;
+   rval->jd = jd;
+   rval->lat = cdata->lat;
+   rval->lon = cdata->lon;
+   rval->rho_cos_phi = cdata->rho_cos_phi;
+   rval->rho_sin_phi = cdata->rho_sin_phi;
+   rval->cull = *cull;
+   rval->n_sats = compute_gps_satellite_locations( rval->loc, jd, cdata, cull,
+                                                            NULL);
+   rval->max_motion = 0.;
+   for( i = 0; i < rval->n_sats; i++)
+      {
+      rval->sorted_idx[i] = i;
+      if( rval->max_motion < rval->loc[i].motion)
+         rval->max_motion = rval->loc[i].motion;
+      }
+   dec_sort_locs = rval->loc;
+   if( rval->n_sats > 0)
+      qsort( rval->sorted_idx, rval->n_sats, sizeof( int), compare_decs);
+   return( rval);
+}
+
+/* Returns the index of the given satellite at 'epoch',  or -1 if it's not
+there.  Satellites are always in the same order,  so unless one was
+culled at one epoch but not at another,  it'll be at index 'guess'. */
+
+static int find_in_epoch( const sky_epoch_t *epoch, const char *obj_desig,
+                                    const int guess)
+{
+   int i;
+
+   if( guess < epoch->n_sats && !strcmp( epoch->loc[guess].obj_desig, obj_desig))
+      return( guess);
+   for( i = 0; i < epoch->n_sats; i++)
+      if( !strcmp( epoch->loc[i].obj_desig, obj_desig))
+         return( i);
+   return( -1);
+}
+
+/* Sets is_near[i] for satellites within 'radius' of (ra, dec). */
+
+static void find_nearby_sats( const sky_epoch_t *epoch, const double ra,
+                  const double dec, const double radius, bool *is_near)
+{
+   const double cos_radius = cos( radius);
+   int lo = 0, hi = epoch->n_sats, i;
+
+   if( radius > PI / 2.)       /* huge field;  check everything */
+      {
+      for( i = 0; i < epoch->n_sats; i++)
+         is_near[i] = true;
+      return;
+      }
+   while( lo < hi)            /* find first sat with dec >= dec - radius */
+      {
+      const int mid = (lo + hi) / 2;
+
+      if( epoch->loc[epoch->sorted_idx[mid]].dec < dec - radius)
+         lo = mid + 1;
+      else
+         hi = mid;
+      }
+   for( i = lo; i < epoch->n_sats; i++)
+      {
+      const int idx = epoch->sorted_idx[i];
+      const gps_ephem_t *loc = epoch->loc + idx;
+
+      if( loc->dec > dec + radius)
+         break;
+      if( sin( dec) * sin( loc->dec) + cos( dec) * cos( loc->dec)
+                        * cos( ra - loc->ra) >= cos_radius)
+         is_near[idx] = true;
+      }
+}
+
+
+const char *google_map_url =
+   "<a title='Click for map' href='http://maps.google.com/maps?q=%+.5f,%+.5f'>";
 
 const double start_gps_jd = 2448793.500000;           /* 1992 Jun 20  0:00:00 UTC */
 double min_jd = start_gps_jd, max_jd = start_gps_jd + 365. * 100.;
             /* In 2092,  somebody may have to revise this */
 
 static bool show_sats_in_shadow = true;
+static bool roving_observer_shown;
+
+/* Survey pointing logs often have several records in a row (one per
+CCD or per camera on a mount) with the same time,  site,  and exposure.
+The observer location,  field size,  and satellite positions for such a
+'group' are worked out for its first record and reused for the rest.
+Roving observers (XXX,  247,  270) don't get grouped,  since each of
+their records brings its own location.  Nor do astrometric records for
+which we only computed satellites near the reported position (see below).
+
+   Satellites more than five degrees below the horizon are culled (see
+'cull_t');  even from a mountaintop,  with refraction,  nothing that low
+can show up in an image.  (A geocentric 'observer' has no horizon,  so
+nothing is culled for altitude there.)  For astrometry,  we also cull satellites far
+from the reported position,  unless an exposure time was given (the
+satellite could then have come from anywhere during the exposure).  */
+
+#define CULL_MIN_ALT    (-5. * PI / 180.)
+
+typedef struct
+{
+   double jd, exposure, altitude_adjustment, override_field_size;
+   double width, height;
+   int data_type, n_passes;
+   char mpc_code[4];
+   mpc_code_t cdata;
+   const sky_epoch_t *epochs[2];
+} field_group_t;
+
+static bool is_same_group( const field_group_t *group, const double jd,
+            const char *mpc_code, const int data_type, const double exposure,
+            const double altitude_adjustment, const double override_field_size)
+{
+   return( group->jd == jd && !strcmp( group->mpc_code, mpc_code)
+            && group->data_type == data_type && group->exposure == exposure
+            && group->altitude_adjustment == altitude_adjustment
+            && group->override_field_size == override_field_size);
+}
 
 static void test_astrometry( const char *ifilename)
 {
@@ -770,10 +2087,12 @@ static void test_astrometry( const char *ifilename)
    void *ades_context = init_ades2mpc( );
    unsigned n_five_digit_times = 0, n_one_second_times = 0;
    mpc_code_t rover_data;
+   field_group_t group;
 
    assert( ifile);
    assert( ades_context);
    memset( &rover_data, 0, sizeof( rover_data));
+   memset( &group, 0, sizeof( group));
    while( fgets_with_ades_xlation( buff, sizeof( buff), ades_context, ifile))
       {
       double ra, dec, jd = 0.;
@@ -810,6 +2129,8 @@ static void test_astrometry( const char *ifilename)
 
          use_mgex_data = false;
          printf( "Not using MGEX data\n");
+         check_gps_data_settings( );
+         group.jd = 0.;       /* its epochs may have just been freed */
          }
       for( i = 0; buff[i]; i++)
          if( buff[i] == ',')
@@ -836,259 +2157,1138 @@ static void test_astrometry( const char *ifilename)
             }
          buff[80] = removed_char;
          }
-      if( data_type != ASTROMETRY && sscanf( buff, "%lf %lf %23s %3s%n",
-                    &ra, &dec, time_str, mpc_code, &addenda_start) == 4)
+      if( data_type != ASTROMETRY && sscanf( buff, "%lf %lf %23s %3s%n",
+                    &ra, &dec, time_str, mpc_code, &addenda_start) == 4)
+         {
+         jd = get_time_from_string( 0, time_str, FULL_CTIME_YMD, NULL);
+         data_type = FIELD_DATA;
+         ra *= PI / 180.;
+         dec *= PI / 180.;
+//       jd -= exposure / 2.;
+         count++;
+         }
+      if( jd > min_jd && jd < max_jd)
+         {
+         mpc_code_t cdata;
+         const sky_epoch_t *epochs[2];
+         gps_ephem_t sat_loc;
+         bool is_near[MAX_N_GPS_SATS];
+         cull_t cull;
+         int i, i0, n_sats, pass, n_passes, err_code = 0;
+         const double earth_radius = 6378140.;  /* equatorial, in meters */
+         const double TOL = 600.;                /* ten arcmin */
+         double width, height;
+         const double radians_to_arcsec = 3600. * 180. / PI;
+         bool match_found = false;
+         const bool same_group = is_same_group( &group, jd, mpc_code,
+                        data_type, exposure, altitude_adjustment,
+                        override_field_size);
+
+         if( same_group)
+            {
+            width = group.width;
+            height = group.height;
+            }
+         else if( data_type == ASTROMETRY)
+            height = width = TOL;
+         else
+            {
+            if( override_field_size)
+               width = height = override_field_size;
+            else
+               get_field_size( &width, &height, jd, mpc_code);
+#ifdef CURRENTLY_UNUSED_DEBUGGING_STATEMENTS
+            if( count < 10)
+               printf( "%f x %f deg FOV\n", width * 180. / PI, height * 180. / PI);
+#endif
+            height *= radians_to_arcsec / 2.;
+            width *= radians_to_arcsec / 2.;
+            }
+
+         if( same_group)
+            cdata = group.cdata;
+         else if( !strcmp( mpc_code, "XXX"))
+            {
+            err_code = (strcmp( rover_data.code, "XXX") ? -1 : 0);
+            if( err_code)
+#ifdef CGI_VERSION
+               printf( "<b>No position found for code (XXX)."
+                       "<a href='https://www.projectpluto.com/xxx.htm'> Click here for information\n"
+                       "on how to specify a <tt>COD Long.</tt> line in your astrometry file.</a></b>\n");
+#else
+               printf( "No position found for code (XXX).  See\n"
+                       "https://www.projectpluto.com/xxx.htm for information\n"
+                       "on how to specify one in your astrometry file.\n");
+#endif
+            else
+               cdata = rover_data;
+            }
+         else if( !strcmp( mpc_code, "247") || !strcmp( mpc_code, "270"))
+            {
+            char loc_buff[100];
+
+            if( fgets_with_ades_xlation( loc_buff, sizeof( loc_buff), ades_context, ifile))
+               {
+               if( 3 != get_mpc_code_info( &cdata, loc_buff))
+                  printf( "ERROR : didn't parse the location line for a roving observer correctly\n");
+               else if( !roving_observer_shown)
+                  {
+                  if( cdata.lon > PI)
+                     cdata.lon -= PI + PI;
+                  roving_observer_shown = true;
+                  printf( "Roving observer found at:\n");
+                  printf( "   Lat %c %f\n", (cdata.lat > 0. ? 'N' : 'S'),
+                                    fabs( cdata.lat * 180. / PI));
+                  printf( "   Lon %c %f\n", (cdata.lon > 0. ? 'E' : 'W'),
+                                    fabs( cdata.lon * 180. / PI));
+                  printf( "   Alt %.3f meters\n", cdata.alt);
+#ifdef CGI_VERSION
+                  printf( google_map_url, cdata.lat * (180. / PI), cdata.lon * (180. / PI));
+                  printf( "Click here for a Google Map for this site.</a>  If you have doubts\n");
+                  printf( "about your roving observer coordinates,  this is a good sanity check.\n");
+#endif
+                  }
+               }
+            else
+               printf( "ERROR : didn't get a location line for a roving observer\n");
+            err_code = -1;       /* i.e.,  don't start a group with this */
+            }
+         else
+            {
+            err_code = get_observer_loc( &cdata, mpc_code);
+            if( err_code)
+               printf( "\nCouldn't find observer '%s': err %d\n", mpc_code,
+                                       err_code);
+            }
+         if( data_type == ASTROMETRY)
+            printf( "%s", buff);
+         if( same_group)
+            {
+            n_passes = group.n_passes;
+            for( pass = 0; pass < n_passes; pass++)
+               epochs[pass] = group.epochs[pass];
+            }
+         else
+            {
+            cdata.rho_cos_phi *= 1. + altitude_adjustment / earth_radius;
+            cdata.rho_sin_phi *= 1. + altitude_adjustment / earth_radius;
+            n_passes = (exposure ? 2 : 1);
+            memset( &cull, 0, sizeof( cull));
+            cull.min_alt = (cdata.rho_cos_phi || cdata.rho_sin_phi ?
+                                    CULL_MIN_ALT : -PI);
+            if( data_type == ASTROMETRY && !exposure)
+               {
+               cull.ra = ra;
+               cull.dec = dec;
+               cull.radius = sqrt( width * width + height * height) * 1.1
+                              / radians_to_arcsec + SKY_INDEX_MARGIN;
+               }
+            for( pass = 0; pass < n_passes; pass++)
+               epochs[pass] = get_sky_epoch( jd + ((double)pass - 0.5) * exposure,
+                                                &cdata, &cull);
+            group.jd = 0.;       /* invalid until shown to be otherwise */
+            if( !err_code && strcmp( mpc_code, "XXX") && !cull.radius)
+               {
+               group.jd = jd;
+               group.exposure = exposure;
+               group.altitude_adjustment = altitude_adjustment;
+               group.override_field_size = override_field_size;
+               group.width = width;
+               group.height = height;
+               group.data_type = data_type;
+               group.n_passes = n_passes;
+               strcpy( group.mpc_code, mpc_code);
+               group.cdata = cdata;
+               for( pass = 0; pass < n_passes; pass++)
+                  group.epochs[pass] = epochs[pass];
+               }
+            }
+         memset( is_near, 0, sizeof( is_near));
+         for( pass = 0; pass < n_passes; pass++)
+            {
+            const double radius = (sqrt( width * width + height * height)
+                  + epochs[pass]->max_motion * radians_to_arcsec
+                     * exposure * seconds_per_day) * 1.1 / radians_to_arcsec
+                  + SKY_INDEX_MARGIN;
+
+            find_nearby_sats( epochs[pass], ra, dec, radius, is_near);
+            }
+         for( pass = 0; pass < n_passes; pass++)
+            {
+            const double jd_new = jd + ((double)pass - 0.5) * exposure;
+
+            n_sats = epochs[pass]->n_sats;
+            for( i = 0; i < n_sats; i++)
+               {
+               double xi, eta, jd_to_show = jd_new;
+               bool is_a_match = false;
+               gps_ephem_t *loc = &sat_loc;
+
+               if( !is_near[i])
+                  continue;
+               sat_loc = epochs[pass]->loc[i];
+
+               get_field_coords( ra, dec, loc, tilt, false, &xi, &eta);
+               if( fabs( xi) < width && fabs( eta) < height)
+                  is_a_match = true;
+               if( pass && data_type != ASTROMETRY && !is_a_match
+                      && (i0 = find_in_epoch( epochs[0], loc->obj_desig, i)) >= 0)
+                  {
+                  const double dt = exposure * seconds_per_day;
+                  const double t = trail_within_image( epochs[0]->loc + i0,
+                           epochs[1]->loc + i, dt, ra, dec,
+                           width / radians_to_arcsec, height / radians_to_arcsec,
+                           tilt);
+
+                  if( t >= 0.)      /* part of the trail does cross the image */
+                     {
+                     jd_to_show = jd + (t - 0.5) * exposure;
+                     if( !set_trail_position( loc, epochs[0]->loc + i0,
+                                 epochs[1]->loc + i, dt, t, jd_to_show, &cdata))
+                        {
+                        is_a_match = true;
+                        get_field_coords( ra, dec, loc, tilt, true, &xi, &eta);
+                        }
+                     }
+                  }
+               if( is_a_match)
+                  {
+                  const double motion = loc->motion * radians_to_arcsec;
+                  const double sin_ang = sin( loc->posn_ang);
+                  const double cos_ang = cos( loc->posn_ang);
+                  const double cross_res = cos_ang * xi + sin_ang * eta;
+                  double along_res = cos_ang * eta - sin_ang * xi;
+
+                  along_res /= motion;
+                  if( data_type == ASTROMETRY)
+                     {
+                     printf( "  %c xresid %10.6f\"  along %11.7fs  ",
+                                    (loc->is_from_tle ? '*' : ' '),
+                                    cross_res, along_res);
+                     printf( "%s %s\n", loc->obj_desig, loc->international_desig);
+                     if( loc->is_from_tle)
+                        asterisk_has_been_shown = true;
+                     }
+                  else if( !loc->in_shadow || show_sats_in_shadow)
+                     {
+                     full_ctime( time_str, jd_to_show, FULL_CTIME_YMD
+                                 | FULL_CTIME_MONTHS_AS_DIGITS
+                                 | FULL_CTIME_LEADING_ZEROES);
+                     printf( "%s %s ", mpc_code, time_str);
+                     if( log_file)
+                        fprintf( log_file, "%s %s ", mpc_code, time_str);
+                     display_satellite_info( loc, true);
+                     printf( "%s %s\n", mpc_code, buff + addenda_start);
+                     if( log_file)
+                        fprintf( log_file, "%s %s\n", mpc_code, buff + addenda_start);
+                     }
+                  n_found++;
+                  match_found = true;
+                  sum_along += along_res;
+                  sum_along2 += along_res * along_res;
+                  sum_cross += cross_res;
+                  sum_cross2 += cross_res * cross_res;
+                  }
+               }
+            }
+         if( data_type == ASTROMETRY && !match_found)
+            printf( "   (no matching satellite found)\n");
+         }
+      }
+   free_ades2mpc_context( ades_context);
+   free_sky_epochs( );
+   if( n_found > 1 && data_type == ASTROMETRY)
+      {
+      printf( "\n%d observations found\n\n", n_found);
+      sum_along /= (double)n_found;
+      sum_along2 /= (double)n_found;
+      sum_cross /= (double)n_found;
+      sum_cross2 /= (double)n_found;
+      printf( "Avg cross-track : %10.6f +/- %.6f\"\n",
+               sum_cross, sqrt( sum_cross2 - sum_cross * sum_cross));
+      printf( "Avg along-track (timing): %11.7f +/- %.7f seconds\n",
+               sum_along, sqrt( sum_along2 - sum_along * sum_along));
+      if( sum_along > 0.)
+         printf( "Positive along-track errors mean your clock was 'behind' the actual time;\n"
+              "i.e.,  the times reported in the astrometry are earlier than the positions\n"
+              "of the GPS satellites would indicate.\n");
+      else
+         printf( "Negative along-track errors mean your clock was 'ahead' of the actual time;\n"
+              "i.e.,  the times reported in the astrometry are later than the positions\n"
+              "of the GPS satellites would indicate.\n");
+      }
+   if( !data_type)
+      printf( "Didn't find any astrometry in the input data.  Check the data\n"
+#ifdef CGI_VERSION
+            "to be sure it is in <a href='astromet.htm'>either MPC80 or ADES"
+            "format</a>"
+#else
+            "to be sure it is in either MPC80 or ADES format"
+#endif
+            " and try again.\n");
+   if( n_five_digit_times)
+      printf( "\nWARNING : %u of your observations had times given to five digits.\n"
+              "This isn't terrible,  but it does limit those times to have a precision\n"
+              "of 0.864 seconds.  Record a sixth digit to get 86.4 millisecond precision.\n"
+              "Or (preferred solution) use the ADES format.\n", n_five_digit_times);
+
+   if( n_one_second_times)
+      printf( "\nWARNING : %u of your observations had times given to a precision of\n"
+              "one second.  This isn't terrible,  but it would be better to provide at\n"
+              "least 0.1-second precision.\n", n_one_second_times);
+
+   if( n_five_digit_times || n_one_second_times)
+      printf(
+#ifdef CGI_VERSION
+              "<a href='https://www.projectpluto.com/gps_ast.htm#tips'>"
+              "Click here for information about increasing the reported precision.</a>\n"
+#else
+              "Visit https://www.projectpluto.com/gps_ast.htm#tips for information\n"
+              "about increasing the reported timing precision.\n"
+#endif
+              );
+
+   fclose( ifile);
+}
+
+/* Multi-site listings.  A network of stations wanting listings for the
+same time can give their MPC codes as a comma-separated list,  or as
+'@(filename)' for a file with one code per line :
+
+list_gps 2024-03-10T03:00 G96,703,I11
+list_gps 2024-03-10T03:00 @stations.txt
+
+   Instead of each site getting the full treatment,  the interpolation
+window,  geocentric positions and velocities,  earth orientation,  TLE
+positions,  and designations are worked out once.  Only the light-time
+lag,  alt/az,  aberration and so on are done per site (see
+get_gps_positions_multi( ) in 'gps.cpp').  Culling (see 'cull_t') is
+done per site,  and a satellite is computed for all sites if any of
+them need it;  that way,  all sites get the same satellites,  in the
+same order,  and the designations can be copied across.   */
+
+#define MAX_N_SITES     100
+
+typedef struct
+{
+   char code[20], name[80];
+   mpc_code_t cdata;
+   double observer_loc[3], alt_az_matrix[9];
+   cull_t cull;
+   bool is_topocentric;
+} site_t;
+
+static bool add_site( site_t *site, const char *code)
+{
+   const int err_code = get_observer_loc( &site->cdata, code);
+
+   if( err_code)
+      {
+      printf( "Couldn't find observer '%s': err %d\n", code, err_code);
+      return( false);
+      }
+   strcpy( site->code, code);
+            /* get_observer_loc( ) overwrites the name on the next lookup */
+   snprintf( site->name, sizeof( site->name), "%s", site->cdata.name);
+   site->cdata.name = site->name;
+   if( site->cdata.lon > PI)
+      site->cdata.lon -= PI + PI;
+   get_observer_vector( &site->cdata, site->observer_loc);
+   set_alt_az_matrix( site->alt_az_matrix, &site->cdata);
+   site->is_topocentric = (site->cdata.rho_cos_phi || site->cdata.rho_sin_phi);
+   memset( &site->cull, 0, sizeof( cull_t));
+   site->cull.min_alt = (site->is_topocentric ? minimum_altitude : -PI);
+   site->cull.skip_shadowed = true;
+   return( true);
+}
+
+static int load_site_list( site_t *sites, const char *site_list)
+{
+   int n_sites = 0;
+   char code[20];
+
+   if( *site_list == '@')
+      {
+      FILE *ifile = fopen( site_list + 1, "rb");
+      char buff[200];
+
+      if( !ifile)
+         {
+         printf( "Couldn't open site list '%s'\n", site_list + 1);
+         return( 0);
+         }
+      while( fgets_trimmed( buff, sizeof( buff), ifile))
+         if( *buff != '#' && sscanf( buff, "%19s", code) == 1
+                          && n_sites < MAX_N_SITES)
+            n_sites += add_site( sites + n_sites, code);
+      fclose( ifile);
+      }
+   else
+      while( *site_list)
+         {
+         const size_t len = strcspn( site_list, ",");
+
+         if( len && len < sizeof( code) && n_sites < MAX_N_SITES)
+            {
+            memcpy( code, site_list, len);
+            code[len] = '\0';
+            n_sites += add_site( sites + n_sites, code);
+            }
+         site_list += len;
+         if( *site_list == ',')
+            site_list++;
+         }
+   return( n_sites);
+}
+
+/* As compute_gps_satellite_locations_minus_motion( ),  for all sites at
+once.  Site 's' gets its satellites in locs[s * MAX_N_GPS_SATS...].  If
+'set_mask' is true,  'mask' is set from the sites' culling limits;
+otherwise,  it's used as-is.  'n_found',  if non-NULL,  is set as in
+compute_gps_satellite_locations_minus_motion( ). */
+
+static int compute_multi_site_locations_minus_motion( gps_ephem_t *locs,
+         const double jd_utc, const site_t *sites, const int n_sites,
+         const bool set_mask, char *mask, int *n_found)
+{
+   const double tdt = jd_utc + td_minus_utc( jd_utc) / seconds_per_day;
+   const double tdt_minus_gps = 51.184;
+   const double mjd_gps = tdt - tdt_minus_gps / seconds_per_day - 2400000.5;
+   const double year = (tdt - 2451545.) / 365.25;
+   const size_t n_coords = (size_t)n_sites * MAX_N_GPS_SATS * 3;
+   double *sat_locs = (double *)malloc( n_coords * sizeof( double));
+   double observer_locs[MAX_N_SITES * 3], precess_matrix[9], sun_vect[3];
+   int i, j, site, err_code = 0, rval = 0, n_culled = 0;
+   extern char is_from_tle[];
+
+   assert( sat_locs);
+   if( n_found)
+      *n_found = 0;
+   if( get_earth_frame( tdt, precess_matrix, sun_vect))
+      {
+      printf( "Precession failed\n");
+      free( sat_locs);
+      return( -1);
+      }
+   for( site = 0; site < n_sites; site++)
+      memcpy( observer_locs + site * 3, sites[site].observer_loc,
+                                    3 * sizeof( double));
+   if( tle_usage != USE_TLES_ONLY)
+      {
+      double rough[MAX_N_GPS_SATS * 3];
+
+      if( set_mask && !get_rough_gps_positions( rough, mjd_gps))
+         {
+         char site_mask[MAX_N_GPS_SATS];
+
+         memset( mask, 0, MAX_N_GPS_SATS);
+         for( site = 0; site < n_sites; site++)
+            {
+            set_cull_mask( site_mask, &sites[site].cull, rough,
+                        sites[site].observer_loc, precess_matrix,
+                        sites[site].alt_az_matrix, sun_vect);
+            for( i = 0; i < MAX_N_GPS_SATS; i++)
+               mask[i] |= site_mask[i];
+            }
+         for( i = 0; i < MAX_N_GPS_SATS; i++)
+            if( !mask[i])        /* only those with positions get culled */
+               n_culled++;
+         }
+      err_code = get_gps_positions_multi( sat_locs, observer_locs, n_sites,
+                                 mjd_gps, mask);
+      }
+   else
+      for( i = 0; i < (int)n_coords; i++)
+         sat_locs[i] = 0.;
+   if( err_code)
+      {
+      printf( "Couldn't get satellite positions : %d\n", err_code);
+      free( sat_locs);
+      return( err_code);
+      }
+               /* TLE positions are geocentric,  so they're the same for */
+   if( tle_usage != USE_SP3_ONLY)          /* all sites */
+      {
+      get_gps_positions_from_tle( tle_path, sat_locs, mjd_gps);
+      for( i = 0; i < MAX_N_GPS_SATS; i++)
+         if( is_from_tle[i])
+            for( site = 1; site < n_sites; site++)
+               memcpy( sat_locs + (site * MAX_N_GPS_SATS + i) * 3,
+                       sat_locs + i * 3, 3 * sizeof( double));
+      }
+
+   for( i = 0; i < MAX_N_GPS_SATS; i++)
+      {
+      const double *tptr = sat_locs + i * 3;
+
+      if( (tptr[0] || tptr[1] || tptr[2]) && mask[i])
+         {
+         for( site = 0; site < n_sites; site++)
+            {
+            gps_ephem_t *loc = locs + site * MAX_N_GPS_SATS + rval;
+            double posn[3];
+
+            for( j = 0; j < 3; j++)
+               posn[j] = sat_locs[(site * MAX_N_GPS_SATS + i) * 3 + j];
+            set_loc_geometry( loc, posn, sites[site].observer_loc,
+                        precess_matrix, sites[site].alt_az_matrix,
+                        sun_vect, year);
+            strcpy( loc->obj_desig, desig_from_index( i));
+            loc->sat_idx = i;
+            loc->is_from_tle = is_from_tle[i];
+            }
+         rval++;
+         }
+      }
+   free( sat_locs);
+   if( n_found)
+      *n_found = rval + n_culled;
+   return( rval);
+}
+
+static int compute_multi_site_locations( gps_ephem_t *locs,
+         const double jd_utc, const site_t *sites, const int n_sites,
+         int *n_found)
+{
+   char mask[MAX_N_GPS_SATS];
+   const size_t n_locs = (size_t)n_sites * MAX_N_GPS_SATS;
+   gps_ephem_t *locs2;
+   int n_sats, n_sats2, i, site;
+
+   memset( mask, 1, MAX_N_GPS_SATS);
+   n_sats = compute_multi_site_locations_minus_motion( locs, jd_utc,
+                                    sites, n_sites, true, mask, n_found);
+   if( n_sats <= 0)
+      return( n_sats);
+   locs2 = (gps_ephem_t *)malloc( n_locs * sizeof( gps_ephem_t));
+   assert( locs2);
+   n_sats2 = compute_multi_site_locations_minus_motion( locs2,
+               jd_utc + 1. / seconds_per_day, sites, n_sites, false, mask,
+               NULL);
+   if( n_sats != n_sats2)
+      {
+      printf( "Internal error: n_sats = %d, n_sats2 = %d\n", n_sats, n_sats2);
+      free( locs2);
+      return( 0);
+      }
+   for( site = 0; site < n_sites; site++)
+      for( i = 0; i < n_sats; i++)
+         {
+         gps_ephem_t *loc = locs + site * MAX_N_GPS_SATS + i;
+         const gps_ephem_t *loc2 = locs2 + site * MAX_N_GPS_SATS + i;
+         int j;
+
+         calc_dist_and_posn_ang( &loc->ra, &loc2->ra, &loc->motion, &loc->posn_ang);
+         for( j = 0; j < 3; j++)
+            loc->j2000_topo_vel[j] = loc2->j2000_topo[j] - loc->j2000_topo[j];
+         }
+   free( locs2);
+   set_designations( n_sats, locs, (int)( jd_utc - 2400000.5));
+   for( site = 1; site < n_sites; site++)
+      for( i = 0; i < n_sats; i++)
+         {
+         gps_ephem_t *loc = locs + site * MAX_N_GPS_SATS + i;
+
+         strcpy( loc->international_desig, locs[i].international_desig);
+         strcpy( loc->type, locs[i].type);
+         loc->norad = locs[i].norad;
+         }
+   return( n_sats);
+}
+
+static int list_multiple_sites( const double utc, const char *site_list,
+                  const char *legend, const char *geocentric_legend)
+{
+   site_t *sites = (site_t *)calloc( MAX_N_SITES, sizeof( site_t));
+   gps_ephem_t *locs;
+   int n_sites, n_sats, n_found, site, i;
+
+   assert( sites);
+   n_sites = load_site_list( sites, site_list);
+   if( !n_sites)
+      {
+      printf( "No sites found in '%s'\n", site_list);
+      free( sites);
+      return( ERR_CODE_OBSERVATORY_UNKNOWN);
+      }
+   locs = (gps_ephem_t *)malloc( (size_t)n_sites * MAX_N_GPS_SATS
+                                       * sizeof( gps_ephem_t));
+   assert( locs);
+   n_sats = compute_multi_site_locations( locs, utc, sites, n_sites,
+                                          &n_found);
+   if( n_found <= 0)          /* no data,  as opposed to all culled */
+      printf( "No satellites found\n");
+   for( site = 0; site < n_sites && n_found > 0; site++)
+      {
+      gps_ephem_t *loc = locs + site * MAX_N_GPS_SATS;
+
+      is_topocentric = sites[site].is_topocentric;
+      printf( "\nObservatory (%s) %s\n", sites[site].code, sites[site].name);
+      sort_sat_info( n_sats, loc, sort_order);
+      printf( " Nr:    %s   Desig\n",
+                        (is_topocentric ? legend : geocentric_legend));
+      for( i = 0; i < n_sats; i++)
+         if( loc[i].alt > minimum_altitude || !is_topocentric)
+            if( !loc[i].in_shadow)
+               display_satellite_info( loc + i, true);
+      }
+   free( locs);
+   free( sites);
+   return( 0);
+}
+
+#ifndef CGI_VERSION
+/* Planning grids (-g) : every satellite at every time step of a night,
+written as CSV,  one line per satellite per time.  Running list_gps once
+per time step would re-do all the setup (EOPs,  observatory data,  .sp3
+and TLE files) each time;  this does it once.
+
+   While being computed,  values are kept satellite-major,  one array per
+quantity :  grid->alt[sat_idx * n_times + time_idx],  etc.,  where
+'sat_idx' is the index used by desig_from_index( ).  The times are split
+into blocks,  one per worker process (-j);  workers write straight into
+the arrays,  which are in shared memory.  The caches in 'gps.cpp' and
+here aren't thread-safe,  so we fork( ) instead of using threads.
+
+   Each satellite gets its index the first time it's found in a .sp3 (or
+TLE) file,  and the workers must agree on those indices.  So before any
+workers are started,  we read through all the positions covering the
+grid's time span,  so that each satellite already has its index (and any
+missing files are downloaded once,  rather than by each worker).  */
+
+#define GRID_PRESENT       1
+#define GRID_IN_SHADOW     2
+#define GRID_FROM_TLE      4
+
+#define N_GRID_QUANTITIES  8
+
+typedef struct
+{
+   int n_times, time_format;
+   double jd0, step;
+   double *ra, *dec, *dist, *alt, *az, *elong, *motion, *posn_ang;
+   char *flags;
+   void *memory;
+   size_t memory_size;
+} planning_grid_t;
+
+static bool alloc_planning_grid( planning_grid_t *grid)
+{
+   const size_t n = (size_t)MAX_N_GPS_SATS * (size_t)grid->n_times;
+   double *dptr;
+
+   grid->memory_size = n * (N_GRID_QUANTITIES * sizeof( double) + 1);
+#ifdef _WIN32
+   grid->memory = calloc( grid->memory_size, 1);
+#else
+   grid->memory = mmap( NULL, grid->memory_size, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   if( grid->memory == MAP_FAILED)
+      grid->memory = NULL;
+#endif
+   if( !grid->memory)
+      return( false);
+   dptr = (double *)grid->memory;
+   grid->ra       = dptr;
+   grid->dec      = dptr + n;
+   grid->dist     = dptr + n * 2;
+   grid->alt      = dptr + n * 3;
+   grid->az       = dptr + n * 4;
+   grid->elong    = dptr + n * 5;
+   grid->motion   = dptr + n * 6;
+   grid->posn_ang = dptr + n * 7;
+   grid->flags = (char *)( dptr + n * N_GRID_QUANTITIES);
+   memset( grid->flags, 0, n);
+   return( true);
+}
+
+static void free_planning_grid( planning_grid_t *grid)
+{
+#ifdef _WIN32
+   free( grid->memory);
+#else
+   munmap( grid->memory, grid->memory_size);
+#endif
+   grid->memory = NULL;
+}
+
+static void fill_grid_block( planning_grid_t *grid, const int t0,
+                        const int t1, const mpc_code_t *cdata)
+{
+   gps_ephem_t loc[MAX_N_GPS_SATS];
+   int t, i;
+
+   for( t = t0; t < t1; t++)
+      {
+      const int n_sats = compute_gps_satellite_locations( loc,
+                  grid->jd0 + (double)t * grid->step, cdata, NULL, NULL);
+
+      for( i = 0; i < n_sats; i++)
+         {
+         const size_t k = (size_t)loc[i].sat_idx * grid->n_times + t;
+
+         grid->ra[k] = loc[i].ra;
+         grid->dec[k] = loc[i].dec;
+         grid->dist[k] = loc[i].topo_r;
+         grid->alt[k] = loc[i].alt;
+         grid->az[k] = loc[i].az;
+         grid->elong[k] = loc[i].elong;
+         grid->motion[k] = loc[i].motion;
+         grid->posn_ang[k] = loc[i].posn_ang;
+         grid->flags[k] = GRID_PRESENT
+                  | (loc[i].in_shadow ? GRID_IN_SHADOW : 0)
+                  | (loc[i].is_from_tle ? GRID_FROM_TLE : 0);
+         }
+      }
+}
+
+static void preload_grid_positions( const planning_grid_t *grid,
+                                    const mpc_code_t *cdata)
+{
+   const double jd1 = grid->jd0 + (double)grid->n_times * grid->step;
+   const double jd_min = (jd1 < grid->jd0 ? jd1 : grid->jd0);
+   const double jd_max = (jd1 < grid->jd0 ? grid->jd0 : jd1);
+   const double preload_step = 10. / minutes_per_day;  /* < one glumph */
+   double rough[MAX_N_GPS_SATS * 3], jd;
+   gps_ephem_t loc[MAX_N_GPS_SATS];
+
+   compute_gps_satellite_locations( loc, grid->jd0, cdata, NULL, NULL);
+   if( tle_usage != USE_TLES_ONLY)      /* the step may be negative */
+      for( jd = jd_min; jd < jd_max + preload_step; jd += preload_step)
+         get_rough_gps_positions( rough, jd - 2400000.5);
+}
+
+static void compute_planning_grid( planning_grid_t *grid,
+                     const mpc_code_t *cdata, int n_workers)
+{
+   int i;
+
+   if( n_workers > grid->n_times)
+      n_workers = grid->n_times;
+#ifdef _WIN32
+   n_workers = 1;
+#endif
+   if( n_workers <= 1)
+      fill_grid_block( grid, 0, grid->n_times, cdata);
+#ifndef _WIN32
+   else
+      {
+      pid_t *pids = (pid_t *)calloc( n_workers, sizeof( pid_t));
+
+      assert( pids);
+      preload_grid_positions( grid, cdata);
+      fflush( stdout);        /* so children don't repeat buffered output */
+      for( i = 0; i < n_workers; i++)
+         {
+         const int t0 = (int)( (long)grid->n_times * i / n_workers);
+         const int t1 = (int)( (long)grid->n_times * (i + 1) / n_workers);
+
+         pids[i] = fork( );
+         if( !pids[i])
+            {
+            fill_grid_block( grid, t0, t1, cdata);
+            fflush( stdout);
+            _exit( 0);
+            }
+         if( pids[i] < 0)        /* couldn't fork;  do it ourselves */
+            fill_grid_block( grid, t0, t1, cdata);
+         }
+      for( i = 0; i < n_workers; i++)
+         if( pids[i] > 0)
+            waitpid( pids[i], NULL, 0);
+      free( pids);
+      }
+#endif
+}
+
+static int write_planning_grid( const planning_grid_t *grid,
+                                    const char *filename)
+{
+   FILE *ofile = fopen( filename, "wb");
+   int i, t, n_written = 0;
+   char tbuff[80];
+
+   if( !ofile)
+      {
+      printf( "Couldn't open grid file '%s'\n", filename);
+      return( -1);
+      }
+   fprintf( ofile, "desig,utc,jd,ra,dec,dist_km,az,alt,elong,"
+                   "rate,pa,shadow,tle\n");
+   for( i = 0; i < MAX_N_GPS_SATS; i++)
+      for( t = 0; t < grid->n_times; t++)
+         {
+         const size_t k = (size_t)i * grid->n_times + t;
+         const double jd = grid->jd0 + (double)t * grid->step;
+
+         if( grid->flags[k] & GRID_PRESENT)
+            {
+            full_ctime( tbuff, jd, grid->time_format | FULL_CTIME_ROUNDING);
+            fprintf( ofile, "%s,%s,%.6f,%.6f,%.6f,%.3f,%.2f,%.2f,%.1f,"
+                            "%.3f,%.1f,%d,%d\n",
+                  desig_from_index( i), tbuff, jd,
+                  grid->ra[k] * 180. / PI, grid->dec[k] * 180. / PI,
+                  grid->dist[k], grid->az[k] * 180. / PI,
+                  grid->alt[k] * 180. / PI, grid->elong[k] * 180. / PI,
+                  grid->motion[k] * 3600. * 180. / PI,
+                  360. - grid->posn_ang[k] * 180. / PI,
+                  (grid->flags[k] & GRID_IN_SHADOW) ? 1 : 0,
+                  (grid->flags[k] & GRID_FROM_TLE) ? 1 : 0);
+            n_written++;
+            }
+         }
+   fclose( ofile);
+   return( n_written);
+}
+
+static void make_planning_grid( const char *filename, const double jd0,
+            const double step, const int n_times, const int time_format,
+            const int n_workers, const mpc_code_t *cdata)
+{
+   planning_grid_t grid;
+
+   grid.time_format = time_format;
+   grid.jd0 = jd0;
+   grid.step = step;
+   grid.n_times = n_times;
+   if( n_times <= 0 || !alloc_planning_grid( &grid))
+      {
+      printf( "Couldn't set up a grid of %d times\n", n_times);
+      return;
+      }
+   compute_planning_grid( &grid, cdata, n_workers);
+   printf( "%d entries written to '%s'\n",
+               write_planning_grid( &grid, filename), filename);
+   free_planning_grid( &grid);
+}
+#endif
+
+/* In server mode,  dummy_main( ) gets called repeatedly within one
+process.  Settings made by one request's command-line options mustn't leak
+into the next one,  so everything is reset to defaults at the start of
+each run. */
+
+static void reset_options( void)
+{
+   extern bool use_mgex_data;
+   extern int gps_verbose;
+   extern const char *ephem_data_path;
+
+   minimum_altitude = 0.;
+   show_decimal_degrees = false;
+   sort_order = 1;
+   tle_usage = USE_TLES_AND_SP3;
+   tle_path = DEFAULT_TLE_PATH;
+   names_filename = "names.txt";
+   relocation[0] = '\0';
+   creating_fake_astrometry = false;
+   asterisk_has_been_shown = false;
+   imprecision_warning_shown = relocation_message_shown = false;
+   roving_observer_shown = false;
+   min_jd = start_gps_jd;
+   max_jd = start_gps_jd + 365. * 100.;
+   use_mgex_data = true;
+   gps_verbose = 0;
+   ephem_data_path = "";
+   frame_node_spacing = 600. / seconds_per_day;
+   if( log_file)
+      {
+      fclose( log_file);
+      log_file = NULL;
+      }
+}
+
+/* See 'dailyize.c' for info about 'finals.mix'.  Note that 'finals.all'
+may also be available at ftp://maia.usno.navy.mil/ser7/finals.all.
+
+   Both of those go back to 1973,  and parsing all of them takes a
+noticeable part of the run time for a single listing.  If 'dailyize' has
+also made 'finals.bin' (see 'eop_bin.h'),  we instead map that file,
+check the blocks covering the days we need,  and hand just those lines to
+the EOP loader.  If we're keeping data loaded between runs,  or need EOPs
+for a long span of time (astrometry can cover decades),  we read all of
+'finals.mix' as before.
+
+   If we're keeping data loaded between runs,  the EOPs are only re-read
+if 'finals.mix' or 'finals.bin' has been modified (my server gets a new
+one daily from a cron job) or if the previous load failed.  Otherwise,
+they're reloaded only if we need days outside those already loaded. */
+
+#define EOP_WINDOW_MARGIN          3
+#define EOP_MAX_WINDOW_DAYS     1000
+
+static int eop_rval = 0, eop_file_mjd, eop_mjd_min, eop_mjd_max;
+static time_t eop_mix_mtime, eop_bin_mtime;
+
+/* EOPs are loaded before the command line is parsed,  so if we had to
+fall back from 'finals.bin' to 'finals.mix',  we note why,  and say so
+once we know if we're in verbose mode;  see show_eop_fallback( ). */
+
+static char eop_fallback[300];
+
+static void show_eop_fallback( void)
+{
+   extern int gps_verbose;
+
+   if( gps_verbose && *eop_fallback)
+      {
+      printf( "%s\n", eop_fallback);
+      *eop_fallback = '\0';
+      }
+}
+
+static time_t file_mtime( const char *filename)
+{
+   struct stat buf;
+
+   return( stat( filename, &buf) ? 0 : buf.st_mtime);
+}
+
+/* Returns the number of EOP lines loaded,  or <= 0 if 'finals.bin' is
+missing,  damaged,  or doesn't cover the given days.  The lines are written
+to a temporary file,  since the EOP loader only takes file names.  That
+goes in $TMPDIR (or /tmp),  not the current directory,  which for the
+CGI version needn't be writable and is shared by concurrent runs. */
+
+static int load_eop_window( const int mjd_min, const int mjd_max)
+{
+   FILE *ifile;
+   eop_bin_header_t header;
+   const char *data = NULL;
+   size_t data_size = 0;
+   int rval = -1;
+
+   if( mjd_max < mjd_min)
+      return( -1);
+   ifile = fopen( "finals.bin", "rb");
+   if( !ifile)
+      return( -1);
+   if( fread( &header, sizeof( header), 1, ifile)
+            && !memcmp( header.magic, EOP_BIN_MAGIC, sizeof( header.magic))
+            && header.header_crc == eop_bin_crc32( &header,
+                                 offsetof( eop_bin_header_t, header_crc))
+            && mjd_min >= header.mjd0
+            && mjd_max < header.mjd0 + header.n_records)
+      {
+      data_size = sizeof( header) + (size_t)header.n_blocks * sizeof( uint32_t)
+                  + (size_t)header.n_records * EOP_BIN_RECORD_LEN;
+#ifdef _WIN32
+      data = (const char *)malloc( data_size);
+      fseek( ifile, 0L, SEEK_SET);
+      if( data && !fread( (void *)data, data_size, 1, ifile))
+         {
+         free( (void *)data);
+         data = NULL;
+         }
+#else
+      struct stat buf;
+
+      if( !fstat( fileno( ifile), &buf) && (size_t)buf.st_size >= data_size)
          {
-         jd = get_time_from_string( 0, time_str, FULL_CTIME_YMD, NULL);
-         data_type = FIELD_DATA;
-         ra *= PI / 180.;
-         dec *= PI / 180.;
-//       jd -= exposure / 2.;
-         count++;
+         data = (const char *)mmap( NULL, data_size, PROT_READ, MAP_SHARED,
+                                         fileno( ifile), 0);
+         if( data == (const char *)MAP_FAILED)
+            data = NULL;
          }
-      if( jd > min_jd && jd < max_jd)
+#endif
+      }
+   fclose( ifile);
+   if( data)
+      {
+      const uint32_t *block_crc = (const uint32_t *)( data + sizeof( header));
+      const char *lines = (const char *)( block_crc + header.n_blocks);
+      const int first_block = (mjd_min - header.mjd0) / EOP_BIN_BLOCK_LEN;
+      const int last_block = (mjd_max - header.mjd0) / EOP_BIN_BLOCK_LEN;
+      int i;
+      bool crcs_ok = true;
+
+      for( i = first_block; crcs_ok && i <= last_block; i++)
          {
-         mpc_code_t cdata;
-         gps_ephem_t loc[MAX_N_GPS_SATS];
-         double xi0[MAX_N_GPS_SATS], eta0[MAX_N_GPS_SATS];
-         int i, n_sats, pass, err_code;
-         const double earth_radius = 6378140.;  /* equatorial, in meters */
-         const double TOL = 600.;                /* ten arcmin */
-         double width, height;
-         const double radians_to_arcsec = 3600. * 180. / PI;
-         bool match_found = false;
+         const int n_lines = (i == header.n_blocks - 1 ?
+               header.n_records - i * EOP_BIN_BLOCK_LEN : EOP_BIN_BLOCK_LEN);
 
-         if( data_type == ASTROMETRY)
-            height = width = TOL;
-         else
+         crcs_ok = (block_crc[i] == eop_bin_crc32(
+                  lines + (size_t)i * EOP_BIN_BLOCK_LEN * EOP_BIN_RECORD_LEN,
+                  (size_t)n_lines * EOP_BIN_RECORD_LEN));
+         }
+      if( crcs_ok)
+         {
+         const char *temp_dir = getenv( "TMPDIR");
+         char temp_filename[255];
+         FILE *ofile;
+
+#ifdef _WIN32
+         if( !temp_dir)
+            temp_dir = getenv( "TEMP");
+         if( !temp_dir)
+            temp_dir = ".";
+         snprintf( temp_filename, sizeof( temp_filename), "%s/eop%d.tmp",
+                                          temp_dir, (int)getpid( ));
+         ofile = fopen( temp_filename, "wb");
+#else
+         int fd;
+
+         if( !temp_dir || !*temp_dir)
+            temp_dir = "/tmp";
+         snprintf( temp_filename, sizeof( temp_filename), "%s/eopXXXXXX",
+                                          temp_dir);
+         fd = mkstemp( temp_filename);
+         ofile = (fd >= 0 ? fdopen( fd, "wb") : NULL);
+         if( !ofile && fd >= 0)
             {
-            if( override_field_size)
-               width = height = override_field_size;
-            else
-               get_field_size( &width, &height, jd, mpc_code);
-#ifdef CURRENTLY_UNUSED_DEBUGGING_STATEMENTS
-            if( count < 10)
-               printf( "%f x %f deg FOV\n", width * 180. / PI, height * 180. / PI);
-#endif
-            height *= radians_to_arcsec / 2.;
-            width *= radians_to_arcsec / 2.;
+            close( fd);
+            unlink( temp_filename);
             }
-
-         if( !strcmp( mpc_code, "XXX"))
+#endif
+         if( !ofile)
+            snprintf( eop_fallback, sizeof( eop_fallback),
+                     "Couldn't create '%s': %s", temp_filename, strerror( errno));
+         else
             {
-            err_code = (strcmp( rover_data.code, "XXX") ? -1 : 0);
-            if( err_code)
-#ifdef CGI_VERSION
-               printf( "<b>No position found for code (XXX)."
-                       "<a href='https://www.projectpluto.com/xxx.htm'> Click here for information\n"
-                       "on how to specify a <tt>COD Long.</tt> line in your astrometry file.</a></b>\n");
+            fwrite( lines + (size_t)( mjd_min - header.mjd0) * EOP_BIN_RECORD_LEN,
+                        EOP_BIN_RECORD_LEN, (size_t)( mjd_max - mjd_min + 1), ofile);
+            fclose( ofile);
+            rval = load_earth_orientation_params( temp_filename, NULL);
+            unlink( temp_filename);
+            }
+         }
+#ifdef _WIN32
+      free( (void *)data);
 #else
-               printf( "No position found for code (XXX).  See\n"
-                       "https://www.projectpluto.com/xxx.htm for information\n"
-                       "on how to specify one in your astrometry file.\n");
+      munmap( (void *)data, data_size);
 #endif
-            else
-               cdata = rover_data;
-            }
-         else if( !strcmp( mpc_code, "247") || !strcmp( mpc_code, "270"))
-            {
-            char loc_buff[100];
+      }
+   if( rval > 0)
+      eop_file_mjd = header.file_mjd;
+   return( rval);
+}
 
-            if( fgets_with_ades_xlation( loc_buff, sizeof( loc_buff), ades_context, ifile))
-               {
-               static bool first_time = true;
+/* EOPs are needed from jd1 to jd2.  Ephemerides can run backward in
+time,  so jd2 may come before jd1. */
 
-               if( 3 != get_mpc_code_info( &cdata, loc_buff))
-                  printf( "ERROR : didn't parse the location line for a roving observer correctly\n");
-               else if( first_time)
-                  {
-                  if( cdata.lon > PI)
-                     cdata.lon -= PI + PI;
-                  first_time = false;
-                  printf( "Roving observer found at:\n");
-                  printf( "   Lat %c %f\n", (cdata.lat > 0. ? 'N' : 'S'),
-                                    fabs( cdata.lat * 180. / PI));
-                  printf( "   Lon %c %f\n", (cdata.lon > 0. ? 'E' : 'W'),
-                                    fabs( cdata.lon * 180. / PI));
-                  printf( "   Alt %.3f meters\n", cdata.alt);
-#ifdef CGI_VERSION
-                  printf( google_map_url, cdata.lat * (180. / PI), cdata.lon * (180. / PI));
-                  printf( "Click here for a Google Map for this site.</a>  If you have doubts\n");
-                  printf( "about your roving observer coordinates,  this is a good sanity check.\n");
-#endif
-                  }
-               }
-            else
-               printf( "ERROR : didn't get a location line for a roving observer\n");
-            }
-         else
-            {
-            err_code = get_observer_loc( &cdata, mpc_code);
-            if( err_code)
-               printf( "\nCouldn't find observer '%s': err %d\n", mpc_code,
-                                       err_code);
-            }
-         cdata.rho_cos_phi *= 1. + altitude_adjustment / earth_radius;
-         cdata.rho_sin_phi *= 1. + altitude_adjustment / earth_radius;
-         if( data_type == ASTROMETRY)
-            printf( "%s", buff);
-         for( pass = 0; pass < (exposure ? 2 : 1); pass++)
+static int load_eops( const double jd1, const double jd2, int *file_mjd)
+{
+   const time_t mix_mtime = file_mtime( "finals.mix");
+   const time_t bin_mtime = file_mtime( "finals.bin");
+   const double jd_min = (jd1 < jd2 ? jd1 : jd2);
+   const double jd_max = (jd1 < jd2 ? jd2 : jd1);
+   int mjd_min = INT_MIN, mjd_max = INT_MAX;
+
+   if( !keep_data_loaded && jd_max - jd_min < EOP_MAX_WINDOW_DAYS)
+      {
+      mjd_min = (int)floor( jd_min - 2400000.5) - EOP_WINDOW_MARGIN;
+      mjd_max = (int)floor( jd_max - 2400000.5) + EOP_WINDOW_MARGIN;
+      }
+   if( eop_rval <= 0 || mix_mtime != eop_mix_mtime || bin_mtime != eop_bin_mtime
+                 || mjd_min < eop_mjd_min || mjd_max > eop_mjd_max)
+      {
+      eop_rval = -1;
+      clear_frame_cache( );
+      if( mjd_min != INT_MIN && bin_mtime)
+         {
+         *eop_fallback = '\0';
+         eop_rval = load_eop_window( mjd_min, mjd_max);
+         if( eop_rval <= 0)
             {
-            const double jd_new = jd + ((double)pass - 0.5) * exposure;
+            const size_t len = strlen( eop_fallback);
 
-            n_sats = compute_gps_satellite_locations( loc, jd_new, &cdata);
-            for( i = 0; i < n_sats; i++)
-               {
-               double xi, eta, jd_to_show = jd_new;
-               bool is_a_match = false;
-               const double BAD_PROJECTION = 99999.;
-
-               if( compute_tangent_plane_coords( dec, loc[i].dec, ra - loc[i].ra,
-                              &xi, &eta))
-                  xi = BAD_PROJECTION;      /* place safely outside of contention */
-               xi  *= radians_to_arcsec;
-               eta *= radians_to_arcsec;
-               if( tilt)
-                  {
-                  const double tval = cos( tilt) * xi - sin( tilt) * eta;
+            snprintf( eop_fallback + len, sizeof( eop_fallback) - len,
+                     "%sCouldn't load EOPs from 'finals.bin' (rval %d);  "
+                     "reading 'finals.mix' instead", (len ? "\n" : ""), eop_rval);
+            }
+         }
+      if( eop_rval <= 0)
+         {
+         mjd_min = INT_MIN;
+         mjd_max = INT_MAX;
+         eop_rval = load_earth_orientation_params( "finals.mix", &eop_file_mjd);
+         }
+      if( eop_rval <= 0)
+         eop_rval = load_earth_orientation_params( "finals.all", &eop_file_mjd);
+      eop_mix_mtime = mix_mtime;
+      eop_bin_mtime = bin_mtime;
+      eop_mjd_min = mjd_min;
+      eop_mjd_max = mjd_max;
+      show_eop_fallback( );
+      }
+   *file_mjd = eop_file_mjd;
+   return( eop_rval);
+}
 
-                  eta = cos( tilt) * eta - sin( tilt) * xi;
-                  xi = tval;
-                  }
-               if( fabs( xi) < width && fabs( eta) < height)
-                  is_a_match = true;
-               if( !pass)
-                  {
-                  xi0[i] = xi / width;
-                  eta0[i] = eta / height;
-                  if( xi == BAD_PROJECTION)
-                     xi0[i] = BAD_PROJECTION;
-                  }
-               else if( data_type != ASTROMETRY && !is_a_match
-                              && xi != BAD_PROJECTION && xi0[i] != BAD_PROJECTION)
-                  {
-                  const double t = trail_within_image( xi0[i], eta0[i],
-                           xi / width, eta / height);
+static void free_eops( void)
+{
+   load_earth_orientation_params( NULL, NULL);   /* free up memory */
+   eop_rval = 0;
+}
 
-                  if( t > 0.)       /* part of the trail does cross the image */
-                     {
-                     gps_ephem_t temp_loc[MAX_N_GPS_SATS];
+/* Step sizes are given in seconds,  or in minutes or days with an 'm'
+or 'd' suffix.  Returns the step in days,  and sets a time format with
+precision suited to the step. */
 
-                     is_a_match = true;
-                     xi = xi0[i] + (xi - xi0[i]) * t;
-                     eta = eta0[i] + (eta - eta0[i]) * t;
-                     jd_to_show = jd + (t - 0.5) * exposure;
-                     compute_gps_satellite_locations( temp_loc, jd_to_show, &cdata);
-                     loc[i] = temp_loc[i];
-                     }
-                  }
-               if( is_a_match)
-                  {
-                  const double motion = loc[i].motion * radians_to_arcsec;
-                  const double sin_ang = sin( loc[i].posn_ang);
-                  const double cos_ang = cos( loc[i].posn_ang);
-                  const double cross_res = cos_ang * xi + sin_ang * eta;
-                  double along_res = cos_ang * eta - sin_ang * xi;
+static double get_step_size( const char *ephem_step, int *time_format)
+{
+   double step_size = atof( ephem_step);
+   const char end_char = ephem_step[strlen( ephem_step) - 1];
 
-                  along_res /= motion;
-                  if( data_type == ASTROMETRY)
-                     {
-                     printf( "  %c xresid %10.6f\"  along %11.7fs  ",
-                                    (loc[i].is_from_tle ? '*' : ' '),
-                                    cross_res, along_res);
-                     printf( "%s %s\n", loc[i].obj_desig, loc[i].international_desig);
-                     if( loc[i].is_from_tle)
-                        asterisk_has_been_shown = true;
-                     }
-                  else if( !loc[i].in_shadow || show_sats_in_shadow)
-                     {
-                     full_ctime( time_str, jd_to_show, FULL_CTIME_YMD
-                                 | FULL_CTIME_MONTHS_AS_DIGITS
-                                 | FULL_CTIME_LEADING_ZEROES);
-                     printf( "%s %s ", mpc_code, time_str);
-                     if( log_file)
-                        fprintf( log_file, "%s %s ", mpc_code, time_str);
-                     display_satellite_info( loc + i, true);
-                     printf( "%s %s\n", mpc_code, buff + addenda_start);
-                     if( log_file)
-                        fprintf( log_file, "%s %s\n", mpc_code, buff + addenda_start);
-                     }
-                  n_found++;
-                  match_found = true;
-                  sum_along += along_res;
-                  sum_along2 += along_res * along_res;
-                  sum_cross += cross_res;
-                  sum_cross2 += cross_res * cross_res;
-                  }
-               }
-            }
-         if( data_type == ASTROMETRY && !match_found)
-            printf( "   (no matching satellite found)\n");
-         }
+   *time_format = FULL_CTIME_YMD | FULL_CTIME_LEADING_ZEROES
+                                 | FULL_CTIME_MONTHS_AS_DIGITS;
+   if( end_char == 'm')
+      {
+      step_size /= minutes_per_day;
+      *time_format |= FULL_CTIME_FORMAT_HH_MM | FULL_CTIME_5_PLACES;
       }
-   free_ades2mpc_context( ades_context);
-   if( n_found > 1 && data_type == ASTROMETRY)
+   else if( end_char == 'd')
+      *time_format |= FULL_CTIME_FORMAT_DAY | FULL_CTIME_8_PLACES;
+   else        /* assume seconds */
       {
-      printf( "\n%d observations found\n\n", n_found);
-      sum_along /= (double)n_found;
-      sum_along2 /= (double)n_found;
-      sum_cross /= (double)n_found;
-      sum_cross2 /= (double)n_found;
-      printf( "Avg cross-track : %10.6f +/- %.6f\"\n",
-               sum_cross, sqrt( sum_cross2 - sum_cross * sum_cross));
-      printf( "Avg along-track (timing): %11.7f +/- %.7f seconds\n",
-               sum_along, sqrt( sum_along2 - sum_along * sum_along));
-      if( sum_along > 0.)
-         printf( "Positive along-track errors mean your clock was 'behind' the actual time;\n"
-              "i.e.,  the times reported in the astrometry are earlier than the positions\n"
-              "of the GPS satellites would indicate.\n");
-      else
-         printf( "Negative along-track errors mean your clock was 'ahead' of the actual time;\n"
-              "i.e.,  the times reported in the astrometry are later than the positions\n"
-              "of the GPS satellites would indicate.\n");
+      step_size /= seconds_per_day;
+      *time_format |= FULL_CTIME_MILLISECS;
       }
-   if( !data_type)
-      printf( "Didn't find any astrometry in the input data.  Check the data\n"
-#ifdef CGI_VERSION
-            "to be sure it is in <a href='astromet.htm'>either MPC80 or ADES"
-            "format</a>"
-#else
-            "to be sure it is in either MPC80 or ADES format"
-#endif
-            " and try again.\n");
-   if( n_five_digit_times)
-      printf( "\nWARNING : %u of your observations had times given to five digits.\n"
-              "This isn't terrible,  but it does limit those times to have a precision\n"
-              "of 0.864 seconds.  Record a sixth digit to get 86.4 millisecond precision.\n"
-              "Or (preferred solution) use the ADES format.\n", n_five_digit_times);
+   return( step_size);
+}
 
-   if( n_one_second_times)
-      printf( "\nWARNING : %u of your observations had times given to a precision of\n"
-              "one second.  This isn't terrible,  but it would be better to provide at\n"
-              "least 0.1-second precision.\n", n_one_second_times);
+static void show_gps_cache_stats( void)
+{
+   gps_cache_stats_t stats;
+
+   get_gps_cache_stats( &stats);
+   printf( "GNSS cache: %ld hits, %ld misses, %ld evictions, %ld reloads\n",
+            stats.hits, stats.misses, stats.evictions, stats.reloads);
+   printf( "   %ld glumphs from %ld files,  %lu of %lu bytes,  %ld allocations\n",
+            stats.n_glumphs, stats.n_files, (unsigned long)stats.n_bytes,
+            (unsigned long)stats.budget, stats.n_heap_allocs);
+   if( stats.shared_hits || stats.shared_stores)
+      printf( "   %ld glumphs from shared memory,  %ld files put there\n",
+               stats.shared_hits, stats.shared_stores);
+}
 
-   if( n_five_digit_times || n_one_second_times)
-      printf(
-#ifdef CGI_VERSION
-              "<a href='https://www.projectpluto.com/gps_ast.htm#tips'>"
-              "Click here for information about increasing the reported precision.</a>\n"
-#else
-              "Visit https://www.projectpluto.com/gps_ast.htm#tips for information\n"
-              "about increasing the reported timing precision.\n"
-#endif
-              );
+static void free_listing_data( void)
+{
+   extern int gps_verbose;
 
-   fclose( ifile);
+   if( gps_verbose)
+      show_gps_cache_stats( );
+   if( !keep_data_loaded)
+      {
+      free_eops( );
+      free_cached_gps_positions( );
+      free_observatory_data( );
+      }
+   if( asterisk_has_been_shown)
+      printf( "%s", asterisk_message);
 }
 
-/* See 'dailyize.c' for info about 'finals.mix'.  Note that 'finals.all'
-may also be available at ftp://maia.usno.navy.mil/ser7/finals.all.  */
-
 int dummy_main( const int argc, const char **argv)
 {
    const char *ephem_step = NULL, *ephem_target = NULL;
    bool desig_not_found = false;
    int n_ephem_steps = 20;
+   double event_hours = 0.;
+   const char *field_spec = NULL;
+#ifndef CGI_VERSION
+   const char *grid_filename = NULL;
+   int n_grid_workers = 1;
+#endif
    char observatory_code[20];
    const char *legend =
           "RA      (J2000)     dec     dist (km)    Azim   Alt Elo  Rate  PA ";
@@ -1102,11 +3302,14 @@ int dummy_main( const int argc, const char **argv)
    mpc_code_t cdata;
    gps_ephem_t loc[MAX_N_GPS_SATS];
    char tbuff[80];
-   int err_code = load_earth_orientation_params( "finals.mix", &eop_file_mjd);
+   int err_code;
    FILE *geo_rect_file;
 
-   if( err_code <= 0)
-      err_code = load_earth_orientation_params( "finals.all", &eop_file_mjd);
+   reset_options( );
+   if( argc >= 2 && argv[1][0] == '-' && argv[1][1] == 'f')
+      err_code = load_eops( 0., 1e+10, &eop_file_mjd);    /* all EOPs */
+   else
+      err_code = load_eops( utc, utc, &eop_file_mjd);
 
    full_ctime( tbuff, curr_t, FULL_CTIME_YMD);
    printf( "Current time = %s UTC\n", tbuff);
@@ -1144,12 +3347,39 @@ int dummy_main( const int argc, const char **argv)
             case 'a': case 'A':
                minimum_altitude = atof( arg) * PI / 180.;
                break;
+            case 'b':
+               set_gps_cache_budget( (size_t)( atof( arg) * 1024. * 1024.));
+               break;
+            case 'c':
+               frame_node_spacing = atof( arg) / seconds_per_day;
+               break;
             case 'd': case 'D':
                show_decimal_degrees = true;
                break;
+            case 'e':
+               event_hours = atof( arg);
+               if( event_hours > EVENT_MAX_HOURS)
+                  event_hours = EVENT_MAX_HOURS;
+               break;
+            case 'F':
+               field_spec = arg;
+               break;
+#ifndef CGI_VERSION
+            case 'g':
+               grid_filename = arg;
+               break;
+            case 'H':
+               use_shared_gps_cache( (*arg && *arg != '-' ? arg : "/gps_ephem"), 0);
+               break;
+#endif
             case 'i': case 'I':
                ephem_step = arg;
                break;
+#ifndef CGI_VERSION
+            case 'j':
+               n_grid_workers = atoi( arg);
+               break;
+#endif
             case 'l':
                min_jd = get_time_from_string( curr_t, arg, FULL_CTIME_YMD,
                                  NULL);
@@ -1224,6 +3454,7 @@ int dummy_main( const int argc, const char **argv)
                break;
             }
          }
+   check_gps_data_settings( );
    if( argc >= 2 && argv[1][0] == '-' && argv[1][1] == 'f')
       {
       test_astrometry( get_arg( argc, argv, 1));
@@ -1236,12 +3467,29 @@ int dummy_main( const int argc, const char **argv)
       {
       printf( "Usage possibilities are:\n\n"
               "list_gps (date/time) (MPC station)   (to get a list of sats)\n"
+              "list_gps (date/time) (station),(station),...  (lists for several\n"
+              "            stations at once;  or @(filename) for a file of codes)\n"
               "list_gps (date/time) (MPC station) -o(target) -i(ephem step)\n"
               "list_gps -f (filename)\n\n"
               "-a(alt)     Set minimum altitude (default=0)\n"
+              "-b(MB)      Set memory used for cached GNSS positions (default=16)\n"
+              "-c(sec)     Set spacing of interpolated earth orientation (default=600;\n"
+              "            0=compute directly at each time)\n"
               "-d          RA/decs shown in decimal degrees\n"
+              "-e(hours)   List rise/set and shadow entry/exit times over the given\n"
+              "            number of hours\n"
               "-f          Filename contains astrometry;  get an evaluation of\n"
               "            cross/along-track errors\n"
+              "-F(ra,dec,width[,height[,tilt]])  List satellites crossing the\n"
+              "            given field (degrees) over the -e time span (default\n"
+              "            one hour)\n"
+#ifndef CGI_VERSION
+              "-g(file)    Write a CSV grid of all satellites at -n times,  -i apart\n"
+              "            (default one minute)\n"
+              "-H(name)    Share parsed positions with other processes through\n"
+              "            the named shared memory segment (default /gps_ephem)\n"
+              "-j(#)       Number of worker processes used for -g (default 1)\n"
+#endif
               "-n(#)       Set number of ephemeris steps shown\n"
               "-s(#)       Set sort order (1=elong, 2=RA, 3=alt, 4=desig, 5=COSPAR,\n"
               "            6=dec, 7=dist)\n"
@@ -1250,7 +3498,8 @@ int dummy_main( const int argc, const char **argv)
               "-z          Ephemerides are simulated 80-column MPC astrometry\n");
       return( -1);
       }
-   strcpy( observatory_code, argv[2]);
+   show_eop_fallback( );
+   snprintf( observatory_code, sizeof( observatory_code), "%s", argv[2]);
    if( strlen( observatory_code) < 3)
       {
       printf( "You must specify a three-character MPC code for your site.\n"
@@ -1269,6 +3518,7 @@ int dummy_main( const int argc, const char **argv)
       use_mgex_data = false;
       observatory_code[i] = '\0';
       }
+   check_gps_data_settings( );
    full_ctime( tbuff, utc, FULL_CTIME_YMD | FULL_CTIME_MILLISECS);
    printf( "GPS positions for JD %f = %s UTC\n", utc, tbuff);
    if( utc < start_gps_jd)     /* 1992 Jun 20  0:00:00 UTC */
@@ -1276,6 +3526,12 @@ int dummy_main( const int argc, const char **argv)
       printf( "GPS/GLONASS ephemerides only extend back to 1992 June 20.\n");
       return( ERR_CODE_TOO_FAR_IN_PAST);
       }
+   if( *argv[2] == '@' || strchr( argv[2], ','))
+      {
+      err_code = list_multiple_sites( utc, argv[2], legend, geocentric_legend);
+      free_listing_data( );
+      return( err_code);
+      }
    err_code = get_observer_loc( &cdata, observatory_code);
    if( err_code)
       {
@@ -1315,27 +3571,58 @@ int dummy_main( const int argc, const char **argv)
    else
       legend = geocentric_legend;
 
-   if( ephem_target && ephem_step)
+   if( field_spec)
       {
-      double step_size = atof( ephem_step);
-      const char end_char = ephem_step[strlen( ephem_step) - 1];
-      int j;
-      int time_format = FULL_CTIME_YMD
-                                    | FULL_CTIME_LEADING_ZEROES
-                                    | FULL_CTIME_MONTHS_AS_DIGITS;
-
-      if( end_char == 'm')
-         {
-         step_size /= minutes_per_day;
-         time_format |= FULL_CTIME_FORMAT_HH_MM | FULL_CTIME_5_PLACES;
-         }
-      else if( end_char == 'd')
-         time_format |= FULL_CTIME_FORMAT_DAY | FULL_CTIME_8_PLACES;
-      else        /* assume seconds */
+      double field_ra, field_dec, width, height = 0., tilt = 0.;
+
+      if( !event_hours)
+         event_hours = 1.;
+      if( sscanf( field_spec, "%lf,%lf,%lf,%lf,%lf", &field_ra, &field_dec,
+                  &width, &height, &tilt) < 3)
+         printf( "Couldn't parse the field '%s'.  It should be given as\n"
+                 "-F(RA),(dec),(width)  or -F(RA),(dec),(width),(height),(tilt)\n"
+                 "with all values in decimal degrees.\n", field_spec);
+      else
          {
-         step_size /= seconds_per_day;
-         time_format |= FULL_CTIME_MILLISECS;
+         if( !height)
+            height = width;
+         load_eops( utc, utc + event_hours / 24., &eop_file_mjd);
+         find_field_crossings( utc, event_hours, &cdata,
+                  field_ra * PI / 180., field_dec * PI / 180.,
+                  width * PI / 180., height * PI / 180., tilt * PI / 180.);
          }
+      }
+   else if( event_hours > 0.)
+      {
+      load_eops( utc, utc + event_hours / 24., &eop_file_mjd);
+      find_events( utc, event_hours, &cdata);
+      }
+#ifndef CGI_VERSION
+   else if( grid_filename)
+      {
+      int time_format;
+      const double step_size = get_step_size( (ephem_step ? ephem_step : "1m"),
+                                             &time_format);
+
+      load_eops( utc, utc + (double)n_ephem_steps * step_size,
+                                             &eop_file_mjd);
+      make_planning_grid( grid_filename, utc, step_size, n_ephem_steps,
+                                    time_format, n_grid_workers, &cdata);
+      }
+#endif
+   else if( ephem_target && ephem_step)
+      {
+      int time_format;
+      const double step_size = get_step_size( ephem_step, &time_format);
+      int j;
+      cull_t ephem_cull;       /* we only need the target object */
+
+      load_eops( utc, utc + (double)n_ephem_steps * step_size,
+                                             &eop_file_mjd);
+      memset( &ephem_cull, 0, sizeof( ephem_cull));
+      ephem_cull.min_alt = -PI;
+      ephem_cull.target = ephem_target;
+      set_gps_track( ephem_target);
       if( creating_fake_astrometry)
          printf( "COM Time sigma 1e-9\n");
       else
@@ -1361,7 +3648,8 @@ int dummy_main( const int argc, const char **argv)
             full_ctime( tbuff, curr_utc, time_format | FULL_CTIME_ROUNDING);
             printf( "%-23s", tbuff);
             }
-         n_sats = compute_gps_satellite_locations( loc, curr_utc, &cdata);
+         n_sats = compute_gps_satellite_locations( loc, curr_utc, &cdata,
+                                                &ephem_cull, NULL);
 
          for( j = 0; j < n_sats; j++)
             if( !memcmp( loc[j].obj_desig, ephem_target, 3))
@@ -1377,8 +3665,15 @@ int dummy_main( const int argc, const char **argv)
       }
    else if( !desig_not_found)       /* just list all the satellites */
       {
-      n_sats = compute_gps_satellite_locations( loc, utc, &cdata);
-      if( n_sats <= 0)
+      cull_t listing_cull;
+      int n_found;
+
+      memset( &listing_cull, 0, sizeof( listing_cull));
+      listing_cull.min_alt = (is_topocentric ? minimum_altitude : -PI);
+      listing_cull.skip_shadowed = true;
+      n_sats = compute_gps_satellite_locations( loc, utc, &cdata,
+                                                &listing_cull, &n_found);
+      if( n_found <= 0)          /* no data,  as opposed to all culled */
          {
          printf( "No satellites found\n");
          if( utc > curr_t + 4.)
@@ -1398,10 +3693,7 @@ int dummy_main( const int argc, const char **argv)
                   display_satellite_info( loc + i, true);
          }
       }
-   load_earth_orientation_params( NULL, NULL);   /* free up memory */
-   free_cached_gps_positions( );
-   if( asterisk_has_been_shown)
-      printf( "%s", asterisk_message);
+   free_listing_data( );
    return( 0);
 }
 
@@ -0,0 +1,144 @@
+/* merge_gps.cpp: writes merged daily GNSS ephemeris files
+
+Copyright (C) 2026, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.    */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include "watdefs.h"
+#include "date.h"
+#include "gps.h"
+
+/* For each GPS day in a range,  this goes through the .sp3 files
+(MGEX,  CODE final,  rapid,  and five-day) in the order list_gps would,
+and writes one merged 'gnsswwwwd.mrg' file taking each satellite from the
+best file having it.  list_gps then reads just that file for the day.
+See write_merged_gps_day( ) in 'gps.cpp' for details.  Run it (say,  from
+a cron job) after new files are likely to have shown up :
+
+merge_gps 2024-03-08 2024-03-12 -f
+
+   With -A,  the merged days go into the compressed archive 'gnss.arc'
+instead,  which is meant for keeping years' worth of positions (see
+archive_gps_days( )).  Days already in the archive are kept,  so it
+can be built up a month or a year at a time.
+
+   -A    Put the merged days in the archive instead of in .mrg files
+   -f    Download files that aren't already here (or have been reissued)
+   -l    After merging,  list each satellite and the file its positions
+         for the start time came from
+   -p    Path to the ephemeris files (and where merged files and the
+         archive are written)
+   -v    Verbose output   */
+
+static void error_exit( void)
+{
+   fprintf( stderr, "Usage: merge_gps (start date) [(end date)] [-A] [-f] [-l] [-p path] [-v]\n"
+            "Writes a merged ephemeris file for each GPS day from the start\n"
+            "to the end date,  or with -A,  adds those days to the archive.\n");
+   exit( -1);
+}
+
+int main( const int argc, const char **argv)
+{
+   extern int gps_verbose;
+   extern const char *ephem_data_path;
+   double mjd_start = 0., mjd_end = 0.;
+   bool fetch_files = false, list_sources = false, archive = false;
+   int i, n_dates = 0, rval = 0;
+
+   for( i = 1; i < argc; i++)
+      if( argv[i][0] == '-' && argv[i][1] && !isdigit( argv[i][1]))
+         switch( argv[i][1])
+            {
+            case 'A':
+               archive = true;
+               break;
+            case 'f':
+               fetch_files = true;
+               break;
+            case 'l':
+               list_sources = true;
+               break;
+            case 'p':
+               ephem_data_path = (argv[i][2] || i == argc - 1 ?
+                                    argv[i] + 2 : argv[++i]);
+               break;
+            case 'v':
+               gps_verbose = 1;
+               break;
+            default:
+               printf( "Option '%s' not recognized\n", argv[i]);
+               error_exit( );
+               break;
+            }
+      else
+         {
+         const double mjd = get_time_from_string( 0., argv[i],
+                                 FULL_CTIME_YMD, NULL) - 2400000.5;
+
+         if( n_dates++)
+            mjd_end = mjd;
+         else
+            mjd_start = mjd_end = mjd;
+         }
+   if( !n_dates)
+      error_exit( );
+   if( archive)
+      {
+      const int n_days = archive_gps_days( mjd_start, mjd_end, fetch_files);
+
+      if( n_days < 0)
+         {
+         printf( "Couldn't write the archive\n");
+         rval = -1;
+         }
+      else
+         printf( "%d days archived\n", n_days);
+      }
+   else
+      for( i = (int)floor( mjd_start); i <= (int)floor( mjd_end); i++)
+         {
+         const int n_sats = write_merged_gps_day( (double)i + .5, fetch_files);
+
+         printf( "MJD %d: ", i);
+         if( n_sats == -1)
+            printf( "no ephemeris files found\n");
+         else if( n_sats == -2)
+            printf( "couldn't write the merged file\n");
+         else
+            printf( "%d satellites\n", n_sats);
+         if( n_sats < 0)
+            rval = -1;
+         }
+   if( list_sources)
+      {
+      const char *sources[MAX_N_GPS_SATS];
+
+      if( get_merged_gps_sources( mjd_start, sources) < 0)
+         printf( "No merged file for the start time\n");
+      else
+         for( i = 0; i < MAX_N_GPS_SATS; i++)
+            if( sources[i])
+               printf( "%s  %s\n", desig_from_index( i), sources[i]);
+      }
+   free_cached_gps_positions( );
+   return( rval);
+}
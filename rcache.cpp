@@ -0,0 +1,437 @@
+/* rcache.cpp: caching/coalescing of identical satellite-listing requests
+
+Copyright (C) 2026, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.    */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/file.h>
+#include <dirent.h>
+#endif
+#include "watdefs.h"
+#include "date.h"
+#include "afuncs.h"
+#include "rcache.h"
+#include "gps.h"
+
+int dummy_main( const int argc, const char **argv);      /* list_gps.cpp */
+
+/* At the start of the night,  many users ask for the list of visible
+satellites from the same observatory within a few seconds of each other.
+Each such request used to run compute_gps_satellite_locations( ) anew.
+
+   Instead,  listing requests (not ephemerides or astrometry) are keyed by
+observatory code (or relocation),  time rounded to 'Granularity' seconds,
+sort order,  minimum altitude,  TLE usage,  and angle format.  The output
+for a key is kept in a file in the cache directory for 'Max_age' seconds.
+
+   If several requests for the same key arrive at once,  the first takes
+an flock( ) on the key's lock file and computes the result;  the others
+block on that lock,  then find the result file and just send it.  So
+concurrent identical requests share one computation,  whether they're in
+separate CGI processes or go through 'gps_serv'.
+
+   Settings come from an optional text file (default 'rcache.txt') :
+
+Granularity 10
+Max_age 300
+Dir rcache
+
+   Hit/miss counts,  and the computing time spent and saved,  are kept
+in 'stats.txt' in the cache directory;  show_result_cache_stats( )
+displays them.  'Granularity 0' turns the cache off.
+
+   The same file can also have a line such as
+
+Shared /gps_ephem 64
+
+   in which case parsed GNSS positions are shared between processes in
+a 64-megabyte shared memory segment of that name (see
+use_shared_gps_cache( ) in 'gps.cpp').  That helps whether or not the
+request is one we can cache here. */
+
+#define MAX_CACHED_ARGS 30
+
+typedef struct
+{
+   double granularity, max_age, shared_mb;
+   char dir[100], shared_name[100];
+} rcache_config_t;
+
+static void load_rcache_config( rcache_config_t *config, const char *filename)
+{
+   FILE *ifile = fopen( filename, "rb");
+
+   config->granularity = 10.;
+   config->max_age = 300.;
+   strcpy( config->dir, "rcache");
+   *config->shared_name = '\0';
+   config->shared_mb = 0.;
+   if( ifile)
+      {
+      char buff[200];
+
+      while( fgets( buff, sizeof( buff), ifile))
+         if( *buff != '#')
+            {
+            buff[strcspn( buff, "\r\n")] = '\0';
+            if( !memcmp( buff, "Granularity ", 12))
+               config->granularity = atof( buff + 12);
+            else if( !memcmp( buff, "Max_age ", 8))
+               config->max_age = atof( buff + 8);
+            else if( !memcmp( buff, "Dir ", 4))
+               snprintf( config->dir, sizeof( config->dir), "%.99s", buff + 4);
+            else if( !memcmp( buff, "Shared ", 7))
+               {
+               char name[100];
+
+               if( sscanf( buff + 7, "%99s %lf", name, &config->shared_mb) >= 1)
+                  strcpy( config->shared_name, name);
+               }
+            }
+      fclose( ifile);
+      }
+}
+
+static double current_seconds( void)
+{
+   struct timeval tv;
+
+   gettimeofday( &tv, NULL);
+   return( (double)tv.tv_sec + (double)tv.tv_usec * 1e-6);
+}
+
+/* Only plain listings are cached.  Options that can't change a listing
+(-i and -n only matter for ephemerides) are allowed,  but don't go into
+the key.  Anything else -- an ephemeris target,  astrometry,  verbose
+mode,  a log file -- means we don't cache.  Returns the length of the key,
+or 0 if the request isn't cacheable.  The time in argv[1] is rounded off,
+and 'rounded_time' gets a 'JD' string to use in its place. */
+
+static size_t make_cache_key( const int argc, const char **argv,
+           const double granularity, char *key, const size_t key_size,
+           char *rounded_time)
+{
+   const double jan_1_1970 = 2440587.5;
+   const double curr_t = jan_1_1970 + (double)time( NULL) / seconds_per_day;
+   double jd;
+   int i;
+
+   if( argc < 3 || argv[1][0] == '-' || granularity <= 0.)
+      return( 0);
+   jd = get_time_from_string( curr_t, argv[1], FULL_CTIME_YMD, NULL);
+   jd = floor( jd * seconds_per_day / granularity + .5)
+                        * granularity / seconds_per_day;
+   snprintf( rounded_time, 30, "JD %.8f", jd);
+   snprintf( key, key_size, "%s|%s", rounded_time, argv[2]);
+   for( i = 3; i < argc; i++)
+      {
+      if( argv[i][0] != '-' || !strchr( "asrdtin", argv[i][1]))
+         return( 0);
+      if( argv[i][1] != 'i' && argv[i][1] != 'n')
+         if( strlen( key) + strlen( argv[i]) + 2 < key_size)
+            {
+            strcat( key, "|");
+            strcat( key, argv[i]);
+            }
+      }
+   return( strlen( key));
+}
+
+/* 64-bit FNV-1a hash,  used to turn keys into file names */
+
+static uint64_t fnv1a_hash( const char *text)
+{
+   uint64_t rval = 0xcbf29ce484222325ULL;
+
+   while( *text)
+      {
+      rval ^= (unsigned char)*text++;
+      rval *= 0x100000001b3ULL;
+      }
+   return( rval);
+}
+
+#define STAT_HITS          0
+#define STAT_COALESCED     1
+#define STAT_MISSES        2
+#define STAT_UNCACHEABLE   3
+#define STAT_COMPUTE_TIME  4
+#define STAT_SAVED_TIME    5
+#define N_STATS            6
+
+static const char *stat_names[N_STATS] = { "hits", "coalesced", "misses",
+               "uncacheable", "compute_seconds", "saved_seconds" };
+
+#ifndef _WIN32
+static void read_stats( FILE *ifile, double *stats)
+{
+   char buff[100];
+   int i;
+
+   for( i = 0; i < N_STATS; i++)
+      stats[i] = 0.;
+   fseek( ifile, 0L, SEEK_SET);
+   while( fgets( buff, sizeof( buff), ifile))
+      for( i = 0; i < N_STATS; i++)
+         if( !memcmp( buff, stat_names[i], strlen( stat_names[i]))
+                  && buff[strlen( stat_names[i])] == ' ')
+            stats[i] = atof( buff + strlen( stat_names[i]));
+}
+
+static void update_stats( const rcache_config_t *config, const int which,
+                                        const double seconds)
+{
+   char filename[140];
+   int fd;
+   FILE *fp;
+
+   snprintf( filename, sizeof( filename), "%s/stats.txt", config->dir);
+   fd = open( filename, O_RDWR | O_CREAT, 0666);
+   if( fd < 0)
+      return;
+   flock( fd, LOCK_EX);
+   fp = fdopen( fd, "r+");
+   if( fp)
+      {
+      double stats[N_STATS];
+      int i;
+
+      read_stats( fp, stats);
+      stats[which]++;
+      if( which == STAT_MISSES)
+         stats[STAT_COMPUTE_TIME] += seconds;
+      else if( which != STAT_UNCACHEABLE)
+         stats[STAT_SAVED_TIME] += seconds;
+      fseek( fp, 0L, SEEK_SET);
+      if( ftruncate( fd, 0))
+         perror( "stats.txt");
+      for( i = 0; i < N_STATS; i++)
+         fprintf( fp, (i < STAT_COMPUTE_TIME ? "%s %.0f\n" : "%s %.3f\n"),
+                              stat_names[i], stats[i]);
+      fflush( fp);
+      flock( fd, LOCK_UN);
+      fclose( fp);         /* also closes 'fd' */
+      }
+   else
+      close( fd);
+}
+
+/* A result file has a first line giving the time it took to compute,
+then the output.  When sending it,  the 'Current time' line at the top
+is replaced with the actual current time.  Returns the compute time,  or
+-1 if the file isn't there or is older than 'Max_age'. */
+
+static double send_cached_result( const char *filename, const double max_age)
+{
+   FILE *ifile = fopen( filename, "rb");
+   struct stat file_info;
+   double cost = -1.;
+   char buff[500];
+
+   if( !ifile)
+      return( -1.);
+   if( !fstat( fileno( ifile), &file_info)
+            && difftime( time( NULL), file_info.st_mtime) < max_age
+            && fgets( buff, sizeof( buff), ifile)
+            && !memcmp( buff, "#cost ", 6))
+      {
+      size_t n_read;
+
+      cost = atof( buff + 6);
+      while( (n_read = fread( buff, 1, sizeof( buff), ifile)) > 0)
+         {
+         if( !memcmp( buff, "Current time = ", 15))
+            {
+            const double jan_1_1970 = 2440587.5;
+            char *eol = (char *)memchr( buff, '\n', n_read);
+            char tbuff[80];
+
+            if( eol)
+               {
+               full_ctime( tbuff, jan_1_1970 + (double)time( NULL) / seconds_per_day,
+                                 FULL_CTIME_YMD);
+               printf( "Current time = %s UTC", tbuff);
+               n_read -= (size_t)( eol - buff);
+               memmove( buff, eol, n_read);
+               }
+            }
+         fwrite( buff, 1, n_read, stdout);
+         }
+      }
+   fclose( ifile);
+   return( cost);
+}
+
+/* Every so often,  we clear out results that are too old to be used. */
+
+static void purge_old_results( const rcache_config_t *config)
+{
+   DIR *dir = opendir( config->dir);
+   struct dirent *entry;
+
+   if( !dir)
+      return;
+   while( (entry = readdir( dir)) != NULL)
+      if( *entry->d_name != '.' && strcmp( entry->d_name, "stats.txt"))
+         {
+         char filename[400];
+         struct stat file_info;
+
+         snprintf( filename, sizeof( filename), "%s/%s", config->dir,
+                              entry->d_name);
+         if( !stat( filename, &file_info) && difftime( time( NULL),
+                              file_info.st_mtime) > config->max_age * 2.)
+            unlink( filename);
+         }
+   closedir( dir);
+}
+
+int cached_dummy_main( const int argc, const char **argv,
+                                const char *config_filename)
+{
+   rcache_config_t config;
+   char key[300], rounded_time[30], filename[140], lock_filename[140];
+   char temp_filename[160];
+   const char *new_argv[MAX_CACHED_ARGS];
+   uint64_t hash;
+   double cost, t0;
+   int lock_fd, rval, saved_stdout, i, temp_fd;
+   static unsigned n_misses;
+
+   load_rcache_config( &config, config_filename);
+   if( *config.shared_name)
+      use_shared_gps_cache( config.shared_name,
+                        (size_t)( config.shared_mb * 1024. * 1024.));
+   if( argc > MAX_CACHED_ARGS || !make_cache_key( argc, argv,
+               config.granularity, key, sizeof( key), rounded_time))
+      {
+      if( config.granularity > 0.)
+         update_stats( &config, STAT_UNCACHEABLE, 0.);
+      return( dummy_main( argc, argv));
+      }
+   hash = fnv1a_hash( key);
+   snprintf( filename, sizeof( filename), "%s/%016llx.txt", config.dir,
+                     (unsigned long long)hash);
+   fflush( stdout);
+   if( (cost = send_cached_result( filename, config.max_age)) >= 0.)
+      {
+      update_stats( &config, STAT_HITS, cost);
+      return( 0);
+      }
+   mkdir( config.dir, 0777);
+   snprintf( lock_filename, sizeof( lock_filename), "%s/%016llx.lck", config.dir,
+                     (unsigned long long)hash);
+   lock_fd = open( lock_filename, O_RDWR | O_CREAT, 0666);
+   if( lock_fd < 0)
+      return( dummy_main( argc, argv));
+   flock( lock_fd, LOCK_EX);     /* wait for anyone computing this result */
+   if( (cost = send_cached_result( filename, config.max_age)) >= 0.)
+      {
+      flock( lock_fd, LOCK_UN);
+      close( lock_fd);
+      update_stats( &config, STAT_COALESCED, cost);
+      return( 0);
+      }
+               /* No luck;  we're the ones who have to compute the result */
+   snprintf( temp_filename, sizeof( temp_filename), "%s.%d", filename,
+                     (int)getpid( ));
+   temp_fd = open( temp_filename, O_RDWR | O_CREAT | O_TRUNC, 0666);
+   if( temp_fd < 0)
+      {
+      flock( lock_fd, LOCK_UN);
+      close( lock_fd);
+      return( dummy_main( argc, argv));
+      }
+   for( i = 0; i < argc; i++)
+      new_argv[i] = argv[i];
+   new_argv[1] = rounded_time;
+   t0 = current_seconds( );
+   saved_stdout = dup( STDOUT_FILENO);
+   dup2( temp_fd, STDOUT_FILENO);
+   printf( "#cost %20s\n", "");      /* placeholder,  filled in below */
+   rval = dummy_main( argc, new_argv);
+   fflush( stdout);
+   dup2( saved_stdout, STDOUT_FILENO);
+   close( saved_stdout);
+   cost = current_seconds( ) - t0;
+   snprintf( key, sizeof( key), "#cost %20.6f", cost);
+   if( pwrite( temp_fd, key, strlen( key), 0) < 0)
+      perror( "rcache");
+   close( temp_fd);
+   if( !rval)
+      rename( temp_filename, filename);
+   send_cached_result( (rval ? temp_filename : filename), config.max_age);
+   if( rval)
+      unlink( temp_filename);
+   flock( lock_fd, LOCK_UN);
+   close( lock_fd);
+   update_stats( &config, STAT_MISSES, cost);
+   if( !(++n_misses % 64))
+      purge_old_results( &config);
+   return( rval);
+}
+
+void show_result_cache_stats( const char *config_filename)
+{
+   rcache_config_t config;
+   char filename[140];
+   FILE *ifile;
+
+   load_rcache_config( &config, config_filename);
+   snprintf( filename, sizeof( filename), "%s/stats.txt", config.dir);
+   ifile = fopen( filename, "rb");
+   if( ifile)
+      {
+      double stats[N_STATS], n_cacheable;
+
+      read_stats( ifile, stats);
+      fclose( ifile);
+      n_cacheable = stats[STAT_HITS] + stats[STAT_COALESCED]
+                                    + stats[STAT_MISSES];
+      printf( "Result cache : %.0f hits,  %.0f coalesced,  %.0f misses,"
+              "  %.0f not cacheable\n",
+               stats[STAT_HITS], stats[STAT_COALESCED], stats[STAT_MISSES],
+               stats[STAT_UNCACHEABLE]);
+      if( n_cacheable)
+         printf( "Hit rate %.1f%%;  %.3f s spent computing,  %.3f s saved\n",
+               100. * (stats[STAT_HITS] + stats[STAT_COALESCED]) / n_cacheable,
+               stats[STAT_COMPUTE_TIME], stats[STAT_SAVED_TIME]);
+      }
+   else
+      printf( "No result cache statistics yet\n");
+}
+#else          /* no flock( ) on Windows;  just skip caching */
+int cached_dummy_main( const int argc, const char **argv,
+                                const char *)
+{
+   return( dummy_main( argc, argv));
+}
+
+void show_result_cache_stats( const char *)
+{
+}
+#endif
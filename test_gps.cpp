@@ -1,10 +1,138 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "gps.h"
 
+static double current_seconds( void)
+{
+   struct timespec t;
+
+   clock_gettime( CLOCK_MONOTONIC, &t);
+   return( (double)t.tv_sec + (double)t.tv_nsec * 1e-9);
+}
+
+static int compare_doubles( const void *a, const void *b)
+{
+   const double *a1 = (const double *)a, *b1 = (const double *)b;
+
+   return( *a1 > *b1 ? 1 : (*a1 < *b1 ? -1 : 0));
+}
+
+static void show_latencies( const char *title, double *latency, const int n)
+{
+   qsort( latency, n, sizeof( double), compare_doubles);
+   printf( "%s: %d queries;  median %.1f us,  99%% %.1f us,  max %.1f us\n",
+               title, n, latency[n / 2] * 1e+6, latency[n * 99 / 100] * 1e+6,
+               latency[n - 1] * 1e+6);
+}
+
+/* 'test_gps (MJD) -b' times queries at random times on the given day,
+first by themselves,  then while the next day is loaded in the background.
+Query times should be about the same either way;  the loader shouldn't
+hold them up.  (The positions for the first day are loaded before timing
+starts,  so the first set of queries are all cache hits.) */
+
+static int loader_benchmark( const double mjd)
+{
+   const int max_queries = 200000;
+   double *latency = (double *)malloc( max_queries * sizeof( double));
+   double locs[MAX_N_GPS_SATS * 3], t0, t_load;
+   gps_cache_stats_t stats;
+   int n, rval;
+
+   if( !latency)
+      return( -1);
+   srand( 1);
+   get_gps_positions( locs, NULL, mjd + .5);    /* warm up */
+   for( n = 0; n < 20000; n++)
+      {
+      const double t = mjd + .1 + .8 * (double)rand( ) / (double)RAND_MAX;
+
+      t0 = current_seconds( );
+      get_gps_positions( locs, NULL, t);
+      latency[n] = current_seconds( ) - t0;
+      }
+   show_latencies( "Without loader", latency, n);
+   t_load = current_seconds( );
+   rval = load_gps_positions_in_background( mjd + 1.);
+   if( rval)
+      printf( "Couldn't start loader: rval %d\n", rval);
+   for( n = 0; n < max_queries && is_gps_loader_running( ); n++)
+      {
+      const double t = mjd + .1 + .8 * (double)rand( ) / (double)RAND_MAX;
+
+      t0 = current_seconds( );
+      get_gps_positions( locs, NULL, t);
+      latency[n] = current_seconds( ) - t0;
+      }
+   t_load = current_seconds( ) - t_load;
+   if( n)
+      show_latencies( "During load", latency, n);
+   printf( "Loader took %.3f s\n", t_load);
+   t0 = current_seconds( );
+   get_gps_positions( locs, NULL, mjd + 1.5);
+   printf( "First query on the next day: %.1f us\n",
+               (current_seconds( ) - t0) * 1e+6);
+   get_gps_cache_stats( &stats);
+   printf( "%ld files loaded in the background\n", stats.background_loads);
+   free( latency);
+   return( 0);
+}
+
+/* 'test_gps (MJD) -a (TLE file)' shows the positions
+get_gps_positions_async( ) returns at once,  then the precise ones
+when they've been downloaded. */
+
+static double t_query;
+
+static void show_positions( const double *locs)
+{
+   extern char is_from_tle[];
+   int i;
+
+   for( i = 0; i < MAX_N_GPS_SATS; i++, locs += 3)
+      if( locs[0] || locs[1] || locs[2])
+         printf( "%-4s %14.6f%14.6f%14.6f%s\n", desig_from_index( i),
+                     locs[0], locs[1], locs[2], (is_from_tle[i] ? " TLE" : ""));
+}
+
+static void show_refined_positions( const double *locs, const double mjd_gps,
+                                    const int err_code, void *context)
+{
+   printf( "%s at MJD %f: err_code %d,  %.3f s after the query\n",
+               (const char *)context, mjd_gps, err_code,
+               current_seconds( ) - t_query);
+   show_positions( locs);
+}
+
+static void async_test( const double mjd, const char *tle_filename)
+{
+   double locs[MAX_N_GPS_SATS * 3];
+   int rval;
+
+   t_query = current_seconds( );
+   rval = get_gps_positions_async( locs, NULL, mjd, tle_filename,
+                  show_refined_positions, (void *)"Refined positions");
+   printf( "rval = %d after %.3f s\n", rval, current_seconds( ) - t_query);
+   show_positions( locs);
+   if( rval == GPS_QUERY_PENDING)
+      finish_gps_queries( true);
+}
+
 int main( const int argc, const char **argv)
 {
-   if( argc > 1)
+   if( argc > 2 && !strcmp( argv[2], "-b"))
+      {
+      loader_benchmark( atof( argv[1]));
+      free_cached_gps_positions( );
+      }
+   else if( argc > 3 && !strcmp( argv[2], "-a"))
+      {
+      async_test( atof( argv[1]), argv[3]);
+      free_cached_gps_positions( );
+      }
+   else if( argc > 1)
       {
       double locs[MAX_N_GPS_SATS * 3];
       double *tptr = locs;